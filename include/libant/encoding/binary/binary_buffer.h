@@ -21,37 +21,56 @@
 #ifndef LIBANT_INCLUDE_LIBANT_ENCODING_BINARY_BINARY_BUFFER_H_
 #define LIBANT_INCLUDE_LIBANT_ENCODING_BINARY_BINARY_BUFFER_H_
 
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <cstring>
+#include <memory>
 #include <string>
+#include <libant/utils/noncopyable.h>
 #include <libant/utils/os.h>
 
 #include "endian.h"
+#include "varint.h"
 
 namespace ant {
 
 /**
  * BinaryBuffer can be used to encode data using the specified `endian`.
- * It supports efficient prepending.
+ * It supports efficient prepending. The underlying buffer grows geometrically, so appending is amortized O(1).
  *
  * @tparam endian endian used to encode data into the binary stream
+ * @tparam Allocator allocator of the underlying buffer, eg: std::pmr::polymorphic_allocator<char> to allocate from an
+ *                   arena (std::pmr::monotonic_buffer_resource) or a pool (std::pmr::unsynchronized_pool_resource)
  */
-template<Endian endian>
+template<Endian endian, typename Allocator = std::allocator<char>>
 class BinaryBuffer {
+public:
+    /**
+     * Block is a buffer released by Release() or adopted by Adopt(). It's allocated by the Allocator of the BinaryBuffer.
+     */
+    struct Block {
+        char* mem;         // the buffer
+        uint32_t capacity; // size of the buffer in bytes
+        uint32_t offset;   // offset of the encoded data in the buffer
+        uint32_t size;     // size of the encoded data in bytes
+    };
+
 public:
     /**
      * Creates a BinaryBuffer object to encode data into.
      *
      * @param reservedBytes    initial buffer capacity in bytes used to append data into the BinaryBuffer. Must be > 0.
      * @param prependableBytes max amount of data in bytes allowed to prepend into the BinaryBuffer. Must be <= 200.
+     * @param alloc            allocator of the underlying buffer
      */
-    BinaryBuffer(uint32_t reservedBytes = 128, uint8_t prependableBytes = 0)
-        : prependableBytes_(prependableBytes)
+    BinaryBuffer(uint32_t reservedBytes = 128, uint8_t prependableBytes = 0, const Allocator& alloc = Allocator())
+        : alloc_(alloc)
+        , prependableBytes_(prependableBytes)
     {
         assert(prependableBytes <= 200 && reservedBytes > 0);
         assert(static_cast<uint64_t>(prependableBytes) + reservedBytes <= 0xFFFFFFFF);
-        auto buf = new char[prependableBytes + reservedBytes];
+        auto buf = alloc_.allocate(prependableBytes + reservedBytes);
         head_ = buf + prependableBytes_;
         tail_ = head_;
         headCap_ = prependableBytes_;
@@ -63,9 +82,11 @@ public:
      */
     ~BinaryBuffer()
     {
-        delete[](head_ - headCap_);
+        freeBuffer();
     }
 
+    NONCOPYABLE(BinaryBuffer);
+
     /**
      * Data returns a pointer to the first byte of the encoded data.
      *
@@ -86,17 +107,69 @@ public:
         return tail_ - head_;
     }
 
+    /**
+     * Capacity returns size in bytes of the underlying buffer.
+     *
+     * @return capacity of the BinaryBuffer
+     */
+    uint32_t Capacity() const
+    {
+        return headCap_ + Size() + tailCap_;
+    }
+
     /**
      * Clears the BinaryBuffer. Make sure Clear() is called before reusing a BinaryBuffer.
      */
     void Clear()
     {
-        uint32_t size = Size();
-        uint32_t prependedBytes = prependableBytes_ - headCap_;
-        head_ += prependedBytes;
+        auto buf = head_ - headCap_;
+        auto capacity = Capacity();
+        headCap_ = std::min<uint32_t>(prependableBytes_, capacity);
+        head_ = buf + headCap_;
         tail_ = head_;
-        headCap_ = prependableBytes_;
-        tailCap_ = size - prependedBytes + tailCap_;
+        tailCap_ = capacity - headCap_;
+    }
+
+    /**
+     * Makes sure at least `appendingBytes` bytes could be appended without reallocation.
+     *
+     * @param appendingBytes
+     */
+    void Reserve(uint32_t appendingBytes)
+    {
+        grow(appendingBytes);
+    }
+
+    /**
+     * Releases ownership of the underlying buffer to the caller, who must free it with the Allocator of the BinaryBuffer.
+     * The BinaryBuffer is left empty, and allocates a new buffer on the next appending or Reserve(), or reuses a buffer
+     * passed to Adopt(). Nothing could be prepended before that.
+     *
+     * @return the underlying buffer, {nullptr, 0, 0, 0} if there isn't any
+     */
+    Block Release()
+    {
+        Block block{head_ - headCap_, Capacity(), headCap_, Size()};
+        head_ = tail_ = nullptr;
+        headCap_ = 0;
+        tailCap_ = 0;
+        return block;
+    }
+
+    /**
+     * Frees the underlying buffer and takes ownership of `block`, which must be allocated by the Allocator of the
+     * BinaryBuffer, eg: a block previously released by Release(). The BinaryBuffer is cleared.
+     *
+     * @param block
+     */
+    void Adopt(Block block)
+    {
+        freeBuffer();
+        head_ = block.mem;
+        tail_ = head_;
+        headCap_ = 0;
+        tailCap_ = block.capacity;
+        Clear();
     }
 
     /**
@@ -183,6 +256,19 @@ public:
         PrependInteger(static_cast<StringLenType>(len));
     }
 
+    /**
+     * Prepends an integer encoded as a LEB128 varint into the BinaryBuffer. Signed integers are zigzag encoded.
+     *
+     * @tparam T supported integer types are int8, uint8, int16, uint16, int32, uint32, int64, and uint64
+     * @param val
+     */
+    template<typename T>
+    void PrependVarint(T val)
+    {
+        char buf[kMaxVarintSize];
+        PrependString(buf, EncodeVarint(buf, toVarint(val)) - buf);
+    }
+
     /**
      * Appends an integer into the BinaryBuffer.
      *
@@ -267,7 +353,107 @@ public:
         AppendString(s, len);
     }
 
+    /**
+     * Appends `n` uninitialized bytes into the BinaryBuffer and returns a pointer to them, which is valid until the next
+     * appending. Useful for writing many fields with a single bounds check.
+     *
+     * @param n
+     * @return pointer to the appended bytes
+     */
+    void* AppendUninitialized(uint32_t n)
+    {
+        grow(n);
+        auto p = tail_;
+        tail_ += n;
+        tailCap_ -= n;
+        return p;
+    }
+
+    /**
+     * Appends `count` integers from `vals` into the BinaryBuffer. Much faster than calling AppendInteger() one by one.
+     *
+     * @tparam T supported integer types are int8, uint8, int16, uint16, int32, uint32, int64, and uint64
+     * @param vals
+     * @param count
+     */
+    template<typename T>
+    void AppendArray(const T* vals, size_t count)
+    {
+        assert(count * sizeof(T) <= 0xFFFFFFFF);
+        uint32_t appendingBytes = count * sizeof(T);
+        if (appendingBytes == 0) {
+            return;
+        }
+        grow(appendingBytes);
+        if (endian == SystemEndian) {
+            memcpy(tail_, vals, appendingBytes);
+        } else {
+            ByteSwapCopy<T>(tail_, vals, count);
+        }
+        tail_ += appendingBytes;
+        tailCap_ -= appendingBytes;
+    }
+
+    /**
+     * Appends an integer encoded as a LEB128 varint into the BinaryBuffer. Signed integers are zigzag encoded, so that
+     * integers of small absolute values take few bytes.
+     *
+     * @tparam T supported integer types are int8, uint8, int16, uint16, int32, uint32, int64, and uint64
+     * @param val
+     */
+    template<typename T>
+    void AppendVarint(T val)
+    {
+        grow(kMaxVarintSize);
+        auto end = EncodeVarint(tail_, toVarint(val));
+        tailCap_ -= end - tail_;
+        tail_ = end;
+    }
+
+    /**
+     * Appends `count` integers from `vals` encoded as LEB128 varints into the BinaryBuffer.
+     *
+     * @tparam T supported integer types are int8, uint8, int16, uint16, int32, uint32, int64, and uint64
+     * @param vals
+     * @param count
+     */
+    template<typename T>
+    void AppendVarints(const T* vals, size_t count)
+    {
+        assert(count * kMaxVarintSize <= 0xFFFFFFFF);
+        grow(count * kMaxVarintSize);
+        auto end = tail_;
+        for (size_t i = 0; i != count; ++i) {
+            end = EncodeVarint(end, toVarint(vals[i]));
+        }
+        tailCap_ -= end - tail_;
+        tail_ = end;
+    }
+
+    /**
+     * Appends `val` as a zigzag varint encoded fixed-point integer with `decimals` decimal places, eg: 12.345 is
+     * encoded as 1235 with 2 decimals.
+     *
+     * @param val
+     * @param decimals must be <= 18
+     */
+    void AppendFixedPoint(double val, uint8_t decimals)
+    {
+        AppendVarint(ToFixedPoint(val, decimals));
+    }
+
 private:
+    template<typename T>
+    static uint64_t toVarint(T val)
+    {
+        static_assert(std::is_integral_v<T>, "T must be an integer type");
+        if constexpr (std::is_signed_v<T>) {
+            return ZigZagEncode(val);
+        } else {
+            return val;
+        }
+    }
+
     void grow(uint32_t appendingBytes)
     {
         if (tailCap_ >= appendingBytes) {
@@ -275,18 +461,36 @@ private:
         }
 
         auto size = Size();
-        const uint64_t curSize = static_cast<uint64_t>(headCap_) + size + tailCap_;
-        const uint64_t newSize = ((curSize + appendingBytes) / 1024 + 1) * 1024;
-        assert(newSize <= 0xFFFFFFFF);
-        auto buf = new char[newSize];
-        memcpy(buf + headCap_, head_, size);
-        delete[](head_ - headCap_);
-        head_ = buf + headCap_;
+        const uint64_t curSize = Capacity();
+        // room for prepending is restored if the buffer has been released
+        const uint8_t headCap = head_ ? headCap_ : prependableBytes_;
+        const uint64_t minSize = static_cast<uint64_t>(headCap) + size + appendingBytes;
+        assert(minSize <= 0xFFFFFFFF);
+        // grow geometrically, so that appending byte by byte takes O(log(n)) reallocations
+        uint64_t newSize = std::max<uint64_t>(curSize * 2, minSize);
+        if (newSize > 0xFFFFFFFF) {
+            newSize = minSize;
+        }
+        auto buf = alloc_.allocate(newSize);
+        if (size) {
+            memcpy(buf + headCap, head_, size);
+        }
+        freeBuffer();
+        head_ = buf + headCap;
         tail_ = head_ + size;
-        tailCap_ += (newSize - curSize);
+        headCap_ = headCap;
+        tailCap_ = newSize - headCap - size;
+    }
+
+    void freeBuffer()
+    {
+        if (head_) {
+            alloc_.deallocate(head_ - headCap_, Capacity());
+        }
     }
 
 private:
+    Allocator alloc_;
     const uint8_t prependableBytes_;
     uint8_t headCap_;
     uint32_t tailCap_;
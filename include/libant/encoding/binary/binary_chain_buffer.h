@@ -0,0 +1,371 @@
+/*
+*
+* LibAnt - A handy C++ library
+* Copyright (C) 2022 Antigloss Huang (https://github.com/antigloss) All rights reserved.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+
+#ifndef LIBANT_INCLUDE_LIBANT_ENCODING_BINARY_BINARY_CHAIN_BUFFER_H_
+#define LIBANT_INCLUDE_LIBANT_ENCODING_BINARY_BINARY_CHAIN_BUFFER_H_
+
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <libant/buffer_pool/buffer_pool.h>
+#include <libant/utils/noncopyable.h>
+
+#include "endian.h"
+#include "varint.h"
+
+namespace ant {
+
+/**
+ * BinaryChainBuffer encodes data using the specified `endian` into a chain of pooled fixed size chunks, and exposes the
+ * encoded data as an iovec array which can be handed to writev() or sendmsg() directly. Unlike BinaryBuffer, it never
+ * reallocates or moves the encoded data, and large strings passed to AppendStringRef() are referenced instead of copied.
+ *
+ * @tparam endian endian used to encode data
+ */
+template<Endian endian>
+class BinaryChainBuffer {
+public:
+    using StringBufferPool = BufferPool<std::string, std::string::size_type, &std::string::capacity, &std::string::clear>;
+
+public:
+    /**
+     * Creates a BinaryChainBuffer object to encode data into.
+     *
+     * @param pool             pool to acquire chunks from, could be shared by many BinaryChainBuffers of the same thread.
+     *                         Chunks are allocated from memory if it's nullptr.
+     * @param chunkSize        size in bytes of each chunk. Must be >= prependableBytes + 16.
+     * @param refThreshold     strings passed to AppendStringRef() shorter than this are copied rather than referenced,
+     *                         as an iovec costs more than copying a few bytes.
+     * @param prependableBytes max amount of data in bytes allowed to prepend into the BinaryChainBuffer. Must be <= 200.
+     */
+    explicit BinaryChainBuffer(StringBufferPool::PoolPtr pool = nullptr, uint32_t chunkSize = 4096, uint32_t refThreshold = 512,
+                               uint8_t prependableBytes = 0)
+        : pool_(std::move(pool))
+        , chunkSize_(chunkSize)
+        , refThreshold_(refThreshold)
+        , prependableBytes_(prependableBytes)
+    {
+        assert(prependableBytes <= 200 && chunkSize >= prependableBytes + 16u);
+        reset();
+    }
+
+    NONCOPYABLE(BinaryChainBuffer);
+
+    /**
+     * Iovecs returns the encoded data as an iovec array. It's invalidated by any further modification.
+     * Each referenced string and each chunk takes an iovec, so the array could be longer than IOV_MAX (1024 on Linux),
+     * which writev() and sendmsg() reject with EINVAL. Callers should hand it over in batches of at most IOV_MAX iovecs.
+     *
+     * @return the encoded data as an iovec array
+     */
+    const std::vector<iovec>& Iovecs() const
+    {
+        return iovs_;
+    }
+
+    /**
+     * Size returns number of bytes encoded into the BinaryChainBuffer.
+     *
+     * @return size of the BinaryChainBuffer
+     */
+    size_t Size() const
+    {
+        return size_;
+    }
+
+    /**
+     * Appends all the encoded data into `out`, eg: for APIs that accept only a contiguous buffer.
+     *
+     * @param out
+     */
+    void CopyTo(std::string& out) const
+    {
+        out.reserve(out.size() + size_);
+        for (const auto& iov : iovs_) {
+            out.append(reinterpret_cast<const char*>(iov.iov_base), iov.iov_len);
+        }
+    }
+
+    /**
+     * Clears the BinaryChainBuffer, returns all the chunks but the first one to the pool and drops all the references.
+     */
+    void Clear()
+    {
+        chunks_.resize(1);
+        refs_.clear();
+        iovs_.clear();
+        reset();
+    }
+
+    /**
+     * Prepends an integer into the BinaryChainBuffer.
+     *
+     * @tparam T supported integer types are int8, uint8, int16, uint16, int32, uint32, int64, and uint64
+     * @param val
+     */
+    template<typename T>
+    void PrependInteger(T val)
+    {
+        auto& head = iovs_.front();
+        auto base = reinterpret_cast<char*>(head.iov_base) - sizeof val;
+        assert(base >= chunks_.front()->data());
+        val = toEndian(val);
+        memcpy(base, &val, sizeof val);
+        head.iov_base = base;
+        head.iov_len += sizeof val;
+        size_ += sizeof val;
+    }
+
+    /**
+     * Appends an integer into the BinaryChainBuffer.
+     *
+     * @tparam T supported integer types are int8, uint8, int16, uint16, int32, uint32, int64, and uint64
+     * @param val
+     */
+    template<typename T>
+    void AppendInteger(T val)
+    {
+        val = toEndian(val);
+        memcpy(reserve(sizeof val), &val, sizeof val);
+        commit(sizeof val);
+    }
+
+    /**
+     * Appends an integer encoded as a LEB128 varint into the BinaryChainBuffer. Signed integers are zigzag encoded.
+     *
+     * @tparam T supported integer types are int8, uint8, int16, uint16, int32, uint32, int64, and uint64
+     * @param val
+     */
+    template<typename T>
+    void AppendVarint(T val)
+    {
+        static_assert(std::is_integral_v<T>, "T must be an integer type");
+        auto p = reserve(kMaxVarintSize);
+        if constexpr (std::is_signed_v<T>) {
+            commit(EncodeVarint(p, ZigZagEncode(val)) - p);
+        } else {
+            commit(EncodeVarint(p, val) - p);
+        }
+    }
+
+    /**
+     * Appends `count` integers from `vals` into the BinaryChainBuffer.
+     *
+     * @tparam T supported integer types are int8, uint8, int16, uint16, int32, uint32, int64, and uint64
+     * @param vals
+     * @param count
+     */
+    template<typename T>
+    void AppendArray(const T* vals, size_t count)
+    {
+        while (count) {
+            if (static_cast<size_t>(chunkEnd_ - pos_) < sizeof(T)) {
+                newChunk(0, count * sizeof(T));
+            }
+            auto p = pos_;
+            auto n = std::min(count, static_cast<size_t>(chunkEnd_ - p) / sizeof(T));
+            if (endian == SystemEndian) {
+                memcpy(p, vals, n * sizeof(T));
+            } else {
+                ByteSwapCopy<T>(p, vals, n);
+            }
+            commit(n * sizeof(T));
+            vals += n;
+            count -= n;
+        }
+    }
+
+    /**
+     * Copies string `s` of length `len` into the BinaryChainBuffer.
+     *
+     * @param s
+     * @param len
+     */
+    void AppendString(const void* s, size_t len)
+    {
+        auto src = reinterpret_cast<const char*>(s);
+        while (len) {
+            if (pos_ == chunkEnd_) {
+                newChunk(0, len);
+            }
+            auto n = std::min(len, static_cast<size_t>(chunkEnd_ - pos_));
+            memcpy(pos_, src, n);
+            commit(n);
+            src += n;
+            len -= n;
+        }
+    }
+
+    /**
+     * Copies `val` into the BinaryChainBuffer.
+     *
+     * @param val
+     */
+    void AppendString(const std::string& val)
+    {
+        AppendString(val.data(), val.size());
+    }
+
+    /**
+     * Appends `len` using type `StringLenType` first, then copies `s` into the BinaryChainBuffer.
+     *
+     * @tparam StringLenType type used to encode `len`
+     * @param s
+     * @param len
+     */
+    template<typename StringLenType>
+    void AppendString(const void* s, size_t len)
+    {
+        AppendInteger(static_cast<StringLenType>(len));
+        AppendString(s, len);
+    }
+
+    /**
+     * Appends string `s` of length `len` by reference if `len` >= refThreshold, or copies it otherwise.
+     * `s` must be kept alive and unchanged until the encoded data is no longer used.
+     *
+     * @param s
+     * @param len
+     */
+    void AppendStringRef(const void* s, size_t len)
+    {
+        if (len < refThreshold_) {
+            AppendString(s, len);
+            return;
+        }
+        iovs_.push_back(iovec{const_cast<void*>(s), len});
+        size_ += len;
+        lastIsInline_ = false;
+    }
+
+    /**
+     * Appends `val` by reference if it's at least refThreshold long, or copies it otherwise. `val` is kept alive by the
+     * BinaryChainBuffer until it's cleared or destroyed.
+     *
+     * @param val
+     */
+    void AppendStringRef(std::shared_ptr<const std::string> val)
+    {
+        AppendStringRef(val->data(), val->size());
+        if (val->size() >= refThreshold_) {
+            refs_.emplace_back(std::move(val));
+        }
+    }
+
+    /**
+     * Appends `len` using type `StringLenType` first, then appends `s` by reference as AppendStringRef() does.
+     *
+     * @tparam StringLenType type used to encode `len`
+     * @param s
+     * @param len
+     */
+    template<typename StringLenType>
+    void AppendStringRef(const void* s, size_t len)
+    {
+        AppendInteger(static_cast<StringLenType>(len));
+        AppendStringRef(s, len);
+    }
+
+private:
+    template<typename T>
+    static T toEndian(T val)
+    {
+        if constexpr (endian == Endian::LittleEndian) {
+            return HostToLittleEndian(val);
+        } else {
+            return HostToBigEndian(val);
+        }
+    }
+
+    // start over with the first chunk, leaving `prependableBytes_` of room before the head iovec
+    void reset()
+    {
+        if (chunks_.empty()) {
+            newChunk(prependableBytes_);
+        } else {
+            pos_ = &(*chunks_.front())[prependableBytes_];
+            chunkEnd_ = pos_ - prependableBytes_ + chunkSize_;
+        }
+        // the head iovec, which is empty until something is prepended or appended
+        iovs_.push_back(iovec{pos_, 0});
+        lastIsInline_ = true;
+        size_ = 0;
+    }
+
+    // starts a chunk of at least `minSize` bytes, so that large arrays and strings take a single iovec no matter how
+    // small `chunkSize_` is
+    void newChunk(uint32_t offset, size_t minSize = 0)
+    {
+        auto size = std::max<size_t>(chunkSize_, minSize);
+        auto chunk = pool_ ? pool_->GetBuffer() : std::make_shared<std::string>();
+        chunk->resize(size);
+        pos_ = &(*chunk)[offset];
+        chunkEnd_ = &(*chunk)[0] + size;
+        chunks_.emplace_back(std::move(chunk));
+        lastIsInline_ = false;
+    }
+
+    // returns `n` (<= 16) contiguous bytes of room in the current chunk
+    char* reserve(size_t n)
+    {
+        if (static_cast<size_t>(chunkEnd_ - pos_) < n) {
+            newChunk(0);
+        }
+        return pos_;
+    }
+
+    // takes the next `n` bytes of the current chunk as encoded data
+    void commit(size_t n)
+    {
+        if (lastIsInline_) {
+            iovs_.back().iov_len += n;
+        } else {
+            iovs_.push_back(iovec{pos_, n});
+            lastIsInline_ = true;
+        }
+        pos_ += n;
+        size_ += n;
+    }
+
+private:
+    StringBufferPool::PoolPtr pool_;
+    const uint32_t chunkSize_;
+    const uint32_t refThreshold_;
+    const uint8_t prependableBytes_;
+    bool lastIsInline_;   // if the last iovec ends at pos_ and could be extended
+    char* pos_;           // where to append next in the current chunk
+    char* chunkEnd_;      // end of the current chunk
+    size_t size_;
+    std::vector<StringBufferPool::BufferPtr> chunks_;
+    std::vector<std::shared_ptr<const std::string>> refs_; // keeps alive the strings passed to AppendStringRef()
+    std::vector<iovec> iovs_;
+};
+
+} // namespace ant
+
+#endif //LIBANT_INCLUDE_LIBANT_ENCODING_BINARY_BINARY_CHAIN_BUFFER_H_
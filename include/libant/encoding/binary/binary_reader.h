@@ -21,11 +21,13 @@
 #ifndef LIBANT_ENCODING_BINARY_BINARY_READER_H_
 #define LIBANT_ENCODING_BINARY_BINARY_READER_H_
 
+#include <cstring>
 #include <string>
 #include <string_view>
 #include <libant/utils/os.h>
 
 #include "endian.h"
+#include "varint.h"
 
 namespace ant {
 
@@ -69,6 +71,24 @@ public:
      */
     template<typename T>
     bool ReadInteger(T& val)
+    {
+        if (PeekInteger(val)) {
+            pos_ += sizeof(T);
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * Reads an integer from the binary stream into `val` without consuming it.
+     *
+     * @tparam T supported integer types are int8, uint8, int16, uint16, int32, uint32, int64, and uint64
+     * @param val
+     *
+     * @return true on success, false on failure.
+     */
+    template<typename T>
+    bool PeekInteger(T& val) const
     {
         auto finalPos = pos_ + sizeof(T);
         if (finalPos <= buf_.size()) {
@@ -87,7 +107,92 @@ public:
                 val = BigEndianToHost(*reinterpret_cast<const T*>(&buf_[pos_]));
 #endif
             }
-            pos_ = finalPos;
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * Reads `count` integers from the binary stream into `vals`. Much faster than calling ReadInteger() one by one.
+     *
+     * @tparam T supported integer types are int8, uint8, int16, uint16, int32, uint32, int64, and uint64
+     * @param vals
+     * @param count
+     *
+     * @return true on success, false on failure.
+     */
+    template<typename T>
+    bool ReadArray(T* vals, size_t count)
+    {
+        if (count > (buf_.size() - pos_) / sizeof(T)) {
+            return false;
+        }
+        auto n = count * sizeof(T);
+        if (n == 0) {
+            return true;
+        }
+        if (endian == SystemEndian) {
+            memcpy(vals, buf_.data() + pos_, n);
+        } else {
+            ByteSwapCopy<T>(vals, buf_.data() + pos_, count);
+        }
+        pos_ += n;
+        return true;
+    }
+
+    /**
+     * Reads a LEB128 varint from the binary stream into `val`. Signed integers are zigzag decoded.
+     *
+     * @tparam T supported integer types are int8, uint8, int16, uint16, int32, uint32, int64, and uint64
+     * @param val
+     *
+     * @return true on success, false if the varint is truncated or doesn't fit in T.
+     */
+    template<typename T>
+    bool ReadVarint(T& val)
+    {
+        uint64_t v;
+        auto end = DecodeVarint(buf_.data() + pos_, buf_.data() + buf_.size(), v);
+        if (end && detail::NarrowVarint(v, val)) {
+            pos_ = end - buf_.data();
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * Reads `count` LEB128 varints from the binary stream into `vals`. Signed integers are zigzag decoded.
+     *
+     * @tparam T supported integer types are int8, uint8, int16, uint16, int32, uint32, int64, and uint64
+     * @param vals
+     * @param count
+     *
+     * @return true on success, false if any of the varints is truncated or doesn't fit in T.
+     */
+    template<typename T>
+    bool ReadVarints(T* vals, size_t count)
+    {
+        auto end = DecodeVarints(buf_.data() + pos_, buf_.data() + buf_.size(), vals, count);
+        if (end) {
+            pos_ = end - buf_.data();
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * Reads a fixed-point integer written by BinaryBuffer::AppendFixedPoint() into `val`.
+     *
+     * @param val
+     * @param decimals must be the same as the one passed to AppendFixedPoint()
+     *
+     * @return true on success, false on failure.
+     */
+    bool ReadFixedPoint(double& val, uint8_t decimals)
+    {
+        int64_t v;
+        if (ReadVarint(v)) {
+            val = FromFixedPoint(v, decimals);
             return true;
         }
         return false;
@@ -115,16 +220,95 @@ public:
      */
     template<typename StringLenType>
     bool ReadString(std::string& val)
+    {
+        std::string_view view;
+        if (ReadStringView<StringLenType>(view)) {
+            val.assign(view.data(), view.size());
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * Returns a view of the remaining bytes of the binary stream in `val` without copying them.
+     * `val` is valid as long as the underlying buffer is.
+     *
+     * @param val
+     */
+    void ReadStringView(std::string_view& val)
+    {
+        val = buf_.substr(pos_);
+        pos_ = buf_.size();
+    }
+
+    /**
+     * Reads length of the string of type `StringLenType` first, then returns a view of the string payload in `val`
+     * without copying it. `val` is valid as long as the underlying buffer is.
+     *
+     * @tparam StringLenType type of the length of the string encoded before the string payload
+     * @param val
+     *
+     * @return true on success, false on failure, in which case nothing is consumed.
+     */
+    template<typename StringLenType>
+    bool ReadStringView(std::string_view& val)
     {
         StringLenType len;
-        if (ReadInteger(len) && len >= 0) {
-            auto finalPos = pos_ + len;
-            if (finalPos <= buf_.size()) {
-                val.clear();
-                val.append(&buf_[pos_], len);
-                pos_ = finalPos;
-                return true;
-            }
+        if (PeekInteger(len) && len >= 0 && static_cast<uint64_t>(len) <= buf_.size() - pos_ - sizeof len) {
+            val = buf_.substr(pos_ + sizeof len, len);
+            pos_ += sizeof len + len;
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * Returns a view of the next `n` bytes of the binary stream in `val` without copying them.
+     * `val` is valid as long as the underlying buffer is.
+     *
+     * @param n
+     * @param val
+     *
+     * @return true on success, false if there are less than `n` bytes left.
+     */
+    bool ReadBytes(size_t n, std::string_view& val)
+    {
+        if (PeekBytes(n, val)) {
+            pos_ += n;
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * Returns a view of the next `n` bytes of the binary stream in `val` without consuming them.
+     *
+     * @param n
+     * @param val
+     *
+     * @return true on success, false if there are less than `n` bytes left.
+     */
+    bool PeekBytes(size_t n, std::string_view& val) const
+    {
+        if (n <= buf_.size() - pos_) {
+            val = buf_.substr(pos_, n);
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * Skips the next `n` bytes of the binary stream.
+     *
+     * @param n
+     *
+     * @return true on success, false if there are less than `n` bytes left, in which case nothing is skipped.
+     */
+    bool Skip(size_t n)
+    {
+        if (n <= buf_.size() - pos_) {
+            pos_ += n;
+            return true;
         }
         return false;
     }
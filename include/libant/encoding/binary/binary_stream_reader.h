@@ -0,0 +1,354 @@
+/*
+*
+* LibAnt - A handy C++ library
+* Copyright (C) 2022 Antigloss Huang (https://github.com/antigloss) All rights reserved.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+
+#ifndef LIBANT_INCLUDE_LIBANT_ENCODING_BINARY_BINARY_STREAM_READER_H_
+#define LIBANT_INCLUDE_LIBANT_ENCODING_BINARY_BINARY_STREAM_READER_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "endian.h"
+#include "varint.h"
+
+namespace ant {
+
+/**
+ * BinaryStreamReader decodes data of the specified `endian` from a stream which arrives in chunks, eg: data received by
+ * non-blocking reads. Chunks are queued as they are, without being copied into a contiguous buffer. \n
+ *
+ * Reads are transactional. Each read either succeeds or consumes nothing, and all the reads since the last Commit() could
+ * be undone by Rollback(), so that a message could be decoded field by field, rolled back when it's incomplete, and
+ * decoded again from its beginning when more data arrives. Chunks are released only when they are committed. Eg:
+ *
+ *   reader.Append(std::move(received));
+ *   uint32_t len;
+ *   std::string_view body;
+ *   while (reader.ReadInteger(len) && reader.ReadBytes(len, body, scratch)) {
+ *       handle(body);
+ *       reader.Commit();
+ *   }
+ *   reader.Rollback();
+ *
+ * Malformed() tells a malformed stream apart from an incomplete one after a failed read.
+ *
+ * @tparam endian endian of the stream to be decoded
+ */
+template<Endian endian>
+class BinaryStreamReader {
+public:
+    /**
+     * Queues `chunk` to be read.
+     *
+     * @param chunk
+     */
+    void Append(std::string chunk)
+    {
+        if (!chunk.empty()) {
+            size_ += chunk.size();
+            chunks_.emplace_back(std::move(chunk));
+            // move on to the new chunk if the last one is read up
+            if (offset_ == chunks_[chunkIdx_].size()) {
+                ++chunkIdx_;
+                offset_ = 0;
+            }
+        }
+    }
+
+    /**
+     * Queues a copy of `data` of length `len` to be read.
+     *
+     * @param data
+     * @param len
+     */
+    void Append(const void* data, size_t len)
+    {
+        Append(std::string(reinterpret_cast<const char*>(data), len));
+    }
+
+    /**
+     * Available returns number of bytes not yet read.
+     *
+     * @return number of bytes not yet read
+     */
+    size_t Available() const
+    {
+        return size_ - consumed_;
+    }
+
+    /**
+     * Malformed tells whether a malformed varint has been met, ie: one longer than 10 bytes, or one that doesn't fit in
+     * the integer type it's read into. Reads return false both when there isn't enough data and when the stream is
+     * malformed, and the stream can't be resynchronized in the latter case, so callers should check Malformed() after a
+     * failed read and drop the stream rather than waiting for more data.
+     *
+     * @return true if a malformed varint has been met
+     */
+    bool Malformed() const
+    {
+        return malformed_;
+    }
+
+    /**
+     * Commits all the reads since the last Commit(), and releases the chunks read up.
+     */
+    void Commit()
+    {
+        chunks_.erase(chunks_.begin(), chunks_.begin() + chunkIdx_);
+        if (!chunks_.empty() && offset_ == chunks_.front().size()) {
+            chunks_.pop_front();
+            offset_ = 0;
+        }
+        chunkIdx_ = 0;
+        headOffset_ = offset_;
+        size_ -= consumed_;
+        consumed_ = 0;
+    }
+
+    /**
+     * Undoes all the reads since the last Commit().
+     */
+    void Rollback()
+    {
+        chunkIdx_ = 0;
+        offset_ = headOffset_;
+        consumed_ = 0;
+    }
+
+    /**
+     * Runs `f(*this)` as a transaction. The reads made by `f` are committed if `f` returns true, or rolled back otherwise.
+     *
+     * @param f
+     * @return what `f` returns
+     */
+    template<typename F>
+    bool Transact(F&& f)
+    {
+        Commit();
+        if (f(*this)) {
+            Commit();
+            return true;
+        }
+        Rollback();
+        return false;
+    }
+
+    /**
+     * Reads an integer from the stream into `val`.
+     *
+     * @tparam T supported integer types are int8, uint8, int16, uint16, int32, uint32, int64, and uint64
+     * @param val
+     *
+     * @return true on success, false if there isn't enough data.
+     */
+    template<typename T>
+    bool ReadInteger(T& val)
+    {
+        if (!PeekInteger(val)) {
+            return false;
+        }
+        advance(sizeof val);
+        return true;
+    }
+
+    /**
+     * Reads an integer from the stream into `val` without consuming it.
+     *
+     * @tparam T supported integer types are int8, uint8, int16, uint16, int32, uint32, int64, and uint64
+     * @param val
+     *
+     * @return true on success, false if there isn't enough data.
+     */
+    template<typename T>
+    bool PeekInteger(T& val) const
+    {
+        if (Available() < sizeof val) {
+            return false;
+        }
+        copyOut(&val, sizeof val);
+        if constexpr (endian == Endian::LittleEndian) {
+            val = LittleEndianToHost(val);
+        } else {
+            val = BigEndianToHost(val);
+        }
+        return true;
+    }
+
+    /**
+     * Reads a LEB128 varint from the stream into `val`. Signed integers are zigzag decoded.
+     *
+     * @tparam T supported integer types are int8, uint8, int16, uint16, int32, uint32, int64, and uint64
+     * @param val
+     *
+     * @return true on success, false if there isn't enough data, or the varint is malformed, in which case Malformed()
+     *         returns true from then on.
+     */
+    template<typename T>
+    bool ReadVarint(T& val)
+    {
+        if (!Available()) {
+            return false;
+        }
+        const auto& chunk = chunks_[chunkIdx_];
+        const char* p = chunk.data() + offset_;
+        uint64_t v;
+        auto end = DecodeVarint(p, chunk.data() + chunk.size(), v);
+        size_t n;
+        if (end) {
+            n = end - p;
+        } else {
+            // the varint spans chunks
+            char buf[kMaxVarintSize];
+            auto len = std::min(Available(), sizeof(buf));
+            copyOut(buf, len);
+            end = DecodeVarint(buf, buf + len, v);
+            if (!end) {
+                // a varint never takes more than kMaxVarintSize bytes, more data won't make it valid
+                if (len == kMaxVarintSize) {
+                    malformed_ = true;
+                }
+                return false;
+            }
+            n = end - buf;
+        }
+        if (!detail::NarrowVarint(v, val)) {
+            malformed_ = true;
+            return false;
+        }
+        advance(n);
+        return true;
+    }
+
+    /**
+     * Copies the next `n` bytes of the stream into `val`.
+     *
+     * @param n
+     * @param val
+     *
+     * @return true on success, false if there isn't enough data.
+     */
+    bool ReadBytes(size_t n, std::string& val)
+    {
+        if (Available() < n) {
+            return false;
+        }
+        val.resize(n);
+        copyOut(val.data(), n);
+        advance(n);
+        return true;
+    }
+
+    /**
+     * Returns a view of the next `n` bytes of the stream in `val`. `val` refers to the queued chunk directly if the bytes
+     * are all in it, and is valid until the next Commit(). Otherwise, the bytes are copied into `scratch` and `val`
+     * refers to `scratch`. Could be used to decode a framed message with BinaryReader.
+     *
+     * @param n
+     * @param val
+     * @param scratch
+     *
+     * @return true on success, false if there isn't enough data.
+     */
+    bool ReadBytes(size_t n, std::string_view& val, std::string& scratch)
+    {
+        if (Available() < n) {
+            return false;
+        }
+        if (n == 0) {
+            // there may be no chunk at all
+            val = std::string_view();
+            return true;
+        }
+        if (n <= chunks_[chunkIdx_].size() - offset_) {
+            val = std::string_view(chunks_[chunkIdx_]).substr(offset_, n);
+        } else {
+            scratch.resize(n);
+            copyOut(scratch.data(), n);
+            val = scratch;
+        }
+        advance(n);
+        return true;
+    }
+
+    /**
+     * Skips the next `n` bytes of the stream.
+     *
+     * @param n
+     *
+     * @return true on success, false if there isn't enough data, in which case nothing is skipped.
+     */
+    bool Skip(size_t n)
+    {
+        if (Available() < n) {
+            return false;
+        }
+        advance(n);
+        return true;
+    }
+
+private:
+    // copies the next `n` (<= Available()) bytes into `dst` without consuming them
+    void copyOut(void* dst, size_t n) const
+    {
+        auto d = reinterpret_cast<char*>(dst);
+        auto offset = offset_;
+        for (auto idx = chunkIdx_; n; ++idx, offset = 0) {
+            const auto& chunk = chunks_[idx];
+            auto len = std::min(n, chunk.size() - offset);
+            memcpy(d, chunk.data() + offset, len);
+            d += len;
+            n -= len;
+        }
+    }
+
+    // consumes the next `n` (<= Available()) bytes
+    void advance(size_t n)
+    {
+        if (!n) {
+            return;
+        }
+        consumed_ += n;
+        n += offset_;
+        // stays at the end of the last chunk if it's read up
+        while (n >= chunks_[chunkIdx_].size() && chunkIdx_ + 1 != chunks_.size()) {
+            n -= chunks_[chunkIdx_].size();
+            ++chunkIdx_;
+        }
+        offset_ = n;
+    }
+
+private:
+    std::deque<std::string> chunks_;
+    size_t chunkIdx_{0};   // chunk being read
+    size_t offset_{0};     // reading position in chunks_[chunkIdx_]
+    size_t headOffset_{0}; // committed position in chunks_[0]
+    size_t size_{0};       // number of bytes not yet committed
+    size_t consumed_{0};   // number of bytes read since the last Commit()
+    bool malformed_{false};
+};
+
+} // namespace ant
+
+#endif //LIBANT_INCLUDE_LIBANT_ENCODING_BINARY_BINARY_STREAM_READER_H_
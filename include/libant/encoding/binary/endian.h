@@ -21,7 +21,13 @@
 #ifndef LIBANT_ENCODING_BINARY_ENDIAN_H_
 #define LIBANT_ENCODING_BINARY_ENDIAN_H_
 
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <type_traits>
+#if defined(__AVX2__) || defined(__SSSE3__)
+#include <immintrin.h>
+#endif
 
 #ifdef _WIN32
 #include <winsock2.h>
@@ -485,6 +491,71 @@ inline uint64_t HostToLittleEndian(uint64_t v)
     return v;
 }
 
+namespace detail {
+
+// pshufb control reversing the bytes of each N-byte element, within each 128-bit lane
+template<size_t N>
+struct ByteSwapShuffle {
+    constexpr ByteSwapShuffle()
+        : mask()
+    {
+        for (size_t i = 0; i != sizeof(mask); ++i) {
+            mask[i] = static_cast<char>(i % 16 / N * N + N - 1 - i % N);
+        }
+    }
+
+    alignas(32) char mask[32];
+};
+
+template<size_t N>
+inline constexpr ByteSwapShuffle<N> kByteSwapShuffle{};
+
+} // namespace detail
+
+/**
+ * Copies `count` integers of type T from `src` to `dst`, swapping the bytes of each of them. `src` and `dst` needn't be
+ * aligned. Uses AVX2 or SSSE3 pshufb if enabled at compile time.
+ *
+ * @tparam T supported integer types are int8, uint8, int16, uint16, int32, uint32, int64, and uint64
+ * @param dst
+ * @param src
+ * @param count
+ */
+template<typename T>
+void ByteSwapCopy(void* dst, const void* src, size_t count)
+{
+    static_assert(std::is_integral_v<T>, "T must be an integer type");
+    auto d = reinterpret_cast<char*>(dst);
+    auto s = reinterpret_cast<const char*>(src);
+    if constexpr (sizeof(T) == 1) {
+        memcpy(d, s, count);
+        return;
+    } else {
+        size_t n = count * sizeof(T);
+        size_t i = 0;
+#ifdef __AVX2__
+        const auto mask32 = _mm256_load_si256(reinterpret_cast<const __m256i*>(detail::kByteSwapShuffle<sizeof(T)>.mask));
+        for (; i + 32 <= n; i += 32) {
+            auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(d + i), _mm256_shuffle_epi8(v, mask32));
+        }
+#endif
+#ifdef __SSSE3__
+        const auto mask16 = _mm_load_si128(reinterpret_cast<const __m128i*>(detail::kByteSwapShuffle<sizeof(T)>.mask));
+        for (; i + 16 <= n; i += 16) {
+            auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(d + i), _mm_shuffle_epi8(v, mask16));
+        }
+#endif
+        for (; i != n; i += sizeof(T)) {
+            T v;
+            memcpy(&v, s + i, sizeof v);
+            v = ByteSwap(v);
+            memcpy(d + i, &v, sizeof v);
+        }
+    }
+}
+
 } // namespace ant
 
 #endif //LIBANT_ENCODING_BINARY_ENDIAN_H_
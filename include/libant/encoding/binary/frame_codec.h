@@ -0,0 +1,339 @@
+/*
+*
+* LibAnt - A handy C++ library
+* Copyright (C) 2022 Antigloss Huang (https://github.com/antigloss) All rights reserved.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+
+
+#ifndef LIBANT_INCLUDE_LIBANT_ENCODING_BINARY_FRAME_CODEC_H_
+#define LIBANT_INCLUDE_LIBANT_ENCODING_BINARY_FRAME_CODEC_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include "binary_buffer.h"
+#include "endian.h"
+#include "varint.h"
+
+namespace ant {
+
+/**
+ * Format of the length header of a frame. The length doesn't include the header itself.
+ */
+enum class FrameHeader {
+    BigEndian16,    // 2 bytes big endian
+    LittleEndian16, // 2 bytes little endian
+    BigEndian32,    // 4 bytes big endian
+    LittleEndian32, // 4 bytes little endian
+    Varint,         // LEB128 varint, 1 to 5 bytes
+};
+
+/**
+ * FrameCodec splits a byte stream into "length header + body" frames. \n
+ *
+ * Many messages could be encoded into one output buffer at once, so that they are sent with a single write, and all the
+ * complete frames in an input buffer are decoded in one pass as views into the buffer, without copying any bodies. Eg:
+ *
+ *   ant::FrameCodec codec(ant::FrameHeader::BigEndian32, 1 << 20);
+ *   size_t consumed;
+ *   if (!codec.Decode(input.data(), input.size(), [](std::string_view body) { handle(body); }, consumed)) {
+ *       // the peer sent an oversized or malformed frame, close the connection
+ *   }
+ *   input.erase(0, consumed); // keep the incomplete frame, if any, until more data arrives
+ */
+class FrameCodec {
+public:
+    /**
+     * @param header format of the length header
+     * @param maxFrameSize max length of a frame body, frames longer than it are rejected by both encoding and decoding.
+     *                     It's capped by the max length representable by `header`.
+     */
+    explicit FrameCodec(FrameHeader header = FrameHeader::BigEndian32, uint32_t maxFrameSize = 0xFFFFFFFF)
+        : header_(header)
+    {
+        switch (header) {
+        case FrameHeader::BigEndian16:
+        case FrameHeader::LittleEndian16:
+            maxHeaderSize_ = 2;
+            maxFrameSize_ = std::min<uint32_t>(maxFrameSize, 0xFFFF);
+            break;
+        case FrameHeader::BigEndian32:
+        case FrameHeader::LittleEndian32:
+            maxHeaderSize_ = 4;
+            maxFrameSize_ = maxFrameSize;
+            break;
+        default:
+            maxHeaderSize_ = static_cast<uint32_t>(VarintSize(maxFrameSize));
+            maxFrameSize_ = maxFrameSize;
+            break;
+        }
+    }
+
+    FrameHeader Header() const
+    {
+        return header_;
+    }
+
+    uint32_t MaxFrameSize() const
+    {
+        return maxFrameSize_;
+    }
+
+    /**
+     * @return max number of bytes taken by a length header. BinaryBuffers passed to Seal() must be able to prepend that
+     *         many bytes.
+     */
+    uint32_t MaxHeaderSize() const
+    {
+        return maxHeaderSize_;
+    }
+
+    /**
+     * @param bodyLen
+     * @return number of bytes taken by the length header of a frame of length `bodyLen`
+     */
+    uint32_t HeaderSize(size_t bodyLen) const
+    {
+        return header_ == FrameHeader::Varint ? static_cast<uint32_t>(VarintSize(bodyLen)) : maxHeaderSize_;
+    }
+
+    /**
+     * Appends a frame of `body` of length `len` into `out`.
+     *
+     * @param out
+     * @param body
+     * @param len
+     * @return false if `len` exceeds MaxFrameSize(), or the frame doesn't fit in the 4GB limit of `out`. Nothing is
+     *         appended in that case
+     */
+    template<Endian endian, typename Allocator>
+    bool Encode(BinaryBuffer<endian, Allocator>& out, const void* body, size_t len) const
+    {
+        if (len > maxFrameSize_) {
+            return false;
+        }
+        const size_t total = HeaderSize(len) + len;
+        if (total > 0xFFFFFFFF - out.Size()) {
+            return false;
+        }
+        auto p = static_cast<char*>(out.AppendUninitialized(static_cast<uint32_t>(total)));
+        p = writeHeader(p, static_cast<uint32_t>(len));
+        if (len) {
+            memcpy(p, body, len);
+        }
+        return true;
+    }
+
+    /**
+     * Appends `count` frames of `bodies` into `out`. The space of all the frames is reserved at once, so it's cheaper
+     * than calling Encode() one by one.
+     *
+     * @param out
+     * @param bodies
+     * @param count
+     * @return false if any of `bodies` exceeds MaxFrameSize(), or the frames don't fit in the 4GB limit of `out`.
+     *         Nothing is appended in that case
+     */
+    template<Endian endian, typename Allocator>
+    bool Encode(BinaryBuffer<endian, Allocator>& out, const std::string_view* bodies, size_t count) const
+    {
+        size_t total = 0;
+        for (size_t i = 0; i != count; ++i) {
+            if (bodies[i].size() > maxFrameSize_) {
+                return false;
+            }
+            total += HeaderSize(bodies[i].size()) + bodies[i].size();
+        }
+        if (total == 0) {
+            return true;
+        }
+        if (total > 0xFFFFFFFF - out.Size()) {
+            return false;
+        }
+
+        auto p = static_cast<char*>(out.AppendUninitialized(static_cast<uint32_t>(total)));
+        for (size_t i = 0; i != count; ++i) {
+            p = writeHeader(p, static_cast<uint32_t>(bodies[i].size()));
+            if (!bodies[i].empty()) {
+                memcpy(p, bodies[i].data(), bodies[i].size());
+                p += bodies[i].size();
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Turns the whole content of `msg` into a frame by prepending a length header to it, so that a message serialized
+     * directly into a BinaryBuffer needn't be copied. `msg` must be able to prepend MaxHeaderSize() bytes.
+     *
+     * @param msg
+     * @return false if the size of `msg` exceeds MaxFrameSize(), `msg` is left untouched in that case
+     */
+    template<Endian endian, typename Allocator>
+    bool Seal(BinaryBuffer<endian, Allocator>& msg) const
+    {
+        auto len = msg.Size();
+        if (len > maxFrameSize_) {
+            return false;
+        }
+        switch (header_) {
+        case FrameHeader::BigEndian16:
+            msg.PrependInteger(endian == Endian::BigEndian ? static_cast<uint16_t>(len) : ByteSwap(static_cast<uint16_t>(len)));
+            break;
+        case FrameHeader::LittleEndian16:
+            msg.PrependInteger(endian == Endian::LittleEndian ? static_cast<uint16_t>(len) : ByteSwap(static_cast<uint16_t>(len)));
+            break;
+        case FrameHeader::BigEndian32:
+            msg.PrependInteger(endian == Endian::BigEndian ? len : ByteSwap(len));
+            break;
+        case FrameHeader::LittleEndian32:
+            msg.PrependInteger(endian == Endian::LittleEndian ? len : ByteSwap(len));
+            break;
+        default:
+            msg.PrependVarint(len);
+            break;
+        }
+        return true;
+    }
+
+    /**
+     * Decodes all the complete frames in `data` of length `len`, and calls `onFrame(std::string_view body)` for each
+     * of them. The bodies are views into `data`.
+     *
+     * @param data
+     * @param len
+     * @param onFrame
+     * @param consumed set to the number of bytes taken by the decoded frames. The remaining bytes are the beginning of
+     *                 an incomplete frame and should be kept until more data arrives.
+     * @return false if a frame exceeding MaxFrameSize() or a malformed header is found. The frames before it are
+     *         decoded and counted by `consumed`, but the stream can't be resynchronized and should be dropped.
+     */
+    template<typename F>
+    bool Decode(const void* data, size_t len, F&& onFrame, size_t& consumed) const
+    {
+        auto begin = static_cast<const char*>(data);
+        auto p = begin;
+        auto end = begin + len;
+        bool ok = true;
+        for (;;) {
+            uint64_t bodyLen;
+            const char* body;
+            if (header_ == FrameHeader::Varint) {
+                body = DecodeVarint(p, end, bodyLen);
+                if (!body) {
+                    // a truncated varint is incomplete, a varint longer than the max header is malformed
+                    ok = static_cast<size_t>(end - p) < maxHeaderSize_;
+                    break;
+                }
+            } else {
+                if (static_cast<size_t>(end - p) < maxHeaderSize_) {
+                    break;
+                }
+                bodyLen = readFixedHeader(p);
+                body = p + maxHeaderSize_;
+            }
+            if (bodyLen > maxFrameSize_) {
+                ok = false;
+                break;
+            }
+            if (bodyLen > static_cast<size_t>(end - body)) {
+                break;
+            }
+            onFrame(std::string_view(body, bodyLen));
+            p = body + bodyLen;
+        }
+        consumed = p - begin;
+        return ok;
+    }
+
+    /**
+     * Decodes all the complete frames in `data` of length `len`, and appends their bodies into `frames`.
+     *
+     * @param data
+     * @param len
+     * @param frames views into `data`
+     * @param consumed set to the number of bytes taken by the decoded frames
+     * @return false if a frame exceeding MaxFrameSize() or a malformed header is found
+     */
+    bool Decode(const void* data, size_t len, std::vector<std::string_view>& frames, size_t& consumed) const
+    {
+        return Decode(
+            data, len, [&frames](std::string_view body) { frames.emplace_back(body); }, consumed);
+    }
+
+private:
+    char* writeHeader(char* p, uint32_t len) const
+    {
+        switch (header_) {
+        case FrameHeader::BigEndian16: {
+            auto v = HostToBigEndian(static_cast<uint16_t>(len));
+            memcpy(p, &v, sizeof v);
+            return p + sizeof v;
+        }
+        case FrameHeader::LittleEndian16: {
+            auto v = HostToLittleEndian(static_cast<uint16_t>(len));
+            memcpy(p, &v, sizeof v);
+            return p + sizeof v;
+        }
+        case FrameHeader::BigEndian32: {
+            auto v = HostToBigEndian(len);
+            memcpy(p, &v, sizeof v);
+            return p + sizeof v;
+        }
+        case FrameHeader::LittleEndian32: {
+            auto v = HostToLittleEndian(len);
+            memcpy(p, &v, sizeof v);
+            return p + sizeof v;
+        }
+        default:
+            return EncodeVarint(p, len);
+        }
+    }
+
+    uint32_t readFixedHeader(const char* p) const
+    {
+        uint16_t v16;
+        uint32_t v32;
+        switch (header_) {
+        case FrameHeader::BigEndian16:
+            memcpy(&v16, p, sizeof v16);
+            return BigEndianToHost(v16);
+        case FrameHeader::LittleEndian16:
+            memcpy(&v16, p, sizeof v16);
+            return LittleEndianToHost(v16);
+        case FrameHeader::BigEndian32:
+            memcpy(&v32, p, sizeof v32);
+            return BigEndianToHost(v32);
+        default:
+            memcpy(&v32, p, sizeof v32);
+            return LittleEndianToHost(v32);
+        }
+    }
+
+private:
+    FrameHeader header_;
+    uint32_t maxHeaderSize_;
+    uint32_t maxFrameSize_;
+};
+
+} // namespace ant
+
+#endif //LIBANT_INCLUDE_LIBANT_ENCODING_BINARY_FRAME_CODEC_H_
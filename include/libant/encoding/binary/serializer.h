@@ -0,0 +1,461 @@
+/*
+*
+* LibAnt - A handy C++ library
+* Copyright (C) 2022 Antigloss Huang (https://github.com/antigloss) All rights reserved.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+
+#ifndef LIBANT_INCLUDE_LIBANT_ENCODING_BINARY_SERIALIZER_H_
+#define LIBANT_INCLUDE_LIBANT_ENCODING_BINARY_SERIALIZER_H_
+
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "binary_buffer.h"
+#include "binary_reader.h"
+#include "endian.h"
+
+// ANT_SERIALIZER_FIELDS(obj, a, b, ...) expands to obj.a, obj.b, ...
+#define ANT_SERIALIZER_EXPAND(x_) x_
+#define ANT_SERIALIZER_F1(obj_, f_) obj_.f_
+#define ANT_SERIALIZER_F2(obj_, f_, ...) obj_.f_, ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_F1(obj_, __VA_ARGS__))
+#define ANT_SERIALIZER_F3(obj_, f_, ...) obj_.f_, ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_F2(obj_, __VA_ARGS__))
+#define ANT_SERIALIZER_F4(obj_, f_, ...) obj_.f_, ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_F3(obj_, __VA_ARGS__))
+#define ANT_SERIALIZER_F5(obj_, f_, ...) obj_.f_, ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_F4(obj_, __VA_ARGS__))
+#define ANT_SERIALIZER_F6(obj_, f_, ...) obj_.f_, ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_F5(obj_, __VA_ARGS__))
+#define ANT_SERIALIZER_F7(obj_, f_, ...) obj_.f_, ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_F6(obj_, __VA_ARGS__))
+#define ANT_SERIALIZER_F8(obj_, f_, ...) obj_.f_, ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_F7(obj_, __VA_ARGS__))
+#define ANT_SERIALIZER_F9(obj_, f_, ...) obj_.f_, ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_F8(obj_, __VA_ARGS__))
+#define ANT_SERIALIZER_F10(obj_, f_, ...) obj_.f_, ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_F9(obj_, __VA_ARGS__))
+#define ANT_SERIALIZER_F11(obj_, f_, ...) obj_.f_, ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_F10(obj_, __VA_ARGS__))
+#define ANT_SERIALIZER_F12(obj_, f_, ...) obj_.f_, ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_F11(obj_, __VA_ARGS__))
+#define ANT_SERIALIZER_F13(obj_, f_, ...) obj_.f_, ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_F12(obj_, __VA_ARGS__))
+#define ANT_SERIALIZER_F14(obj_, f_, ...) obj_.f_, ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_F13(obj_, __VA_ARGS__))
+#define ANT_SERIALIZER_F15(obj_, f_, ...) obj_.f_, ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_F14(obj_, __VA_ARGS__))
+#define ANT_SERIALIZER_F16(obj_, f_, ...) obj_.f_, ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_F15(obj_, __VA_ARGS__))
+#define ANT_SERIALIZER_F17(obj_, f_, ...) obj_.f_, ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_F16(obj_, __VA_ARGS__))
+#define ANT_SERIALIZER_F18(obj_, f_, ...) obj_.f_, ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_F17(obj_, __VA_ARGS__))
+#define ANT_SERIALIZER_F19(obj_, f_, ...) obj_.f_, ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_F18(obj_, __VA_ARGS__))
+#define ANT_SERIALIZER_F20(obj_, f_, ...) obj_.f_, ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_F19(obj_, __VA_ARGS__))
+#define ANT_SERIALIZER_F21(obj_, f_, ...) obj_.f_, ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_F20(obj_, __VA_ARGS__))
+#define ANT_SERIALIZER_F22(obj_, f_, ...) obj_.f_, ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_F21(obj_, __VA_ARGS__))
+#define ANT_SERIALIZER_F23(obj_, f_, ...) obj_.f_, ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_F22(obj_, __VA_ARGS__))
+#define ANT_SERIALIZER_F24(obj_, f_, ...) obj_.f_, ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_F23(obj_, __VA_ARGS__))
+#define ANT_SERIALIZER_F25(obj_, f_, ...) obj_.f_, ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_F24(obj_, __VA_ARGS__))
+#define ANT_SERIALIZER_F26(obj_, f_, ...) obj_.f_, ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_F25(obj_, __VA_ARGS__))
+#define ANT_SERIALIZER_F27(obj_, f_, ...) obj_.f_, ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_F26(obj_, __VA_ARGS__))
+#define ANT_SERIALIZER_F28(obj_, f_, ...) obj_.f_, ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_F27(obj_, __VA_ARGS__))
+#define ANT_SERIALIZER_F29(obj_, f_, ...) obj_.f_, ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_F28(obj_, __VA_ARGS__))
+#define ANT_SERIALIZER_F30(obj_, f_, ...) obj_.f_, ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_F29(obj_, __VA_ARGS__))
+#define ANT_SERIALIZER_F31(obj_, f_, ...) obj_.f_, ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_F30(obj_, __VA_ARGS__))
+#define ANT_SERIALIZER_F32(obj_, f_, ...) obj_.f_, ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_F31(obj_, __VA_ARGS__))
+#define ANT_SERIALIZER_PICK(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, \
+                            _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, name_, ...) name_
+#define ANT_SERIALIZER_FIELDS(obj_, ...)                                                                                      \
+    ANT_SERIALIZER_EXPAND(ANT_SERIALIZER_PICK(__VA_ARGS__,                                                                    \
+                                              ANT_SERIALIZER_F32, ANT_SERIALIZER_F31, ANT_SERIALIZER_F30, ANT_SERIALIZER_F29, \
+                                              ANT_SERIALIZER_F28, ANT_SERIALIZER_F27, ANT_SERIALIZER_F26, ANT_SERIALIZER_F25, \
+                                              ANT_SERIALIZER_F24, ANT_SERIALIZER_F23, ANT_SERIALIZER_F22, ANT_SERIALIZER_F21, \
+                                              ANT_SERIALIZER_F20, ANT_SERIALIZER_F19, ANT_SERIALIZER_F18, ANT_SERIALIZER_F17, \
+                                              ANT_SERIALIZER_F16, ANT_SERIALIZER_F15, ANT_SERIALIZER_F14, ANT_SERIALIZER_F13, \
+                                              ANT_SERIALIZER_F12, ANT_SERIALIZER_F11, ANT_SERIALIZER_F10, ANT_SERIALIZER_F9,  \
+                                              ANT_SERIALIZER_F8, ANT_SERIALIZER_F7, ANT_SERIALIZER_F6, ANT_SERIALIZER_F5,     \
+                                              ANT_SERIALIZER_F4, ANT_SERIALIZER_F3, ANT_SERIALIZER_F2, ANT_SERIALIZER_F1)     \
+                          (obj_, __VA_ARGS__))
+
+/**
+ * Makes struct `type_` serializable by ant::Serialize() and ant::Deserialize(). Fields are encoded in the listed order.
+ * Must be used in the namespace of `type_`, eg:
+ *
+ *   struct Pos {
+ *       int32_t x;
+ *       int32_t y;
+ *   };
+ *   ANT_SERIALIZABLE(Pos, x, y)
+ *
+ *   struct Player {
+ *       uint32_t uid;
+ *       std::string name;
+ *       Pos pos;
+ *       std::vector<uint32_t> items;
+ *       std::optional<uint32_t> guild;
+ *   };
+ *   ANT_SERIALIZABLE(Player, uid, name, pos, items, guild)
+ *
+ * Supported field types and their encodings:
+ *   integers, enums, floats, doubles and bools: fixed size using the endian of the BinaryBuffer / BinaryReader
+ *   std::string, std::string_view:              varint length followed by the payload. string_view fields are
+ *                                               decoded as views into the input, without copying
+ *   std::vector:                                varint number of elements followed by the elements
+ *   std::optional:                              uint8 flag (0 or 1) followed by the value if the flag is 1
+ *   structs made serializable by ANT_SERIALIZABLE
+ * Up to 32 fields could be listed.
+ */
+#define ANT_SERIALIZABLE(type_, ...)                                                                 \
+    [[maybe_unused]] inline auto AntSerializableFields(const type_& obj)                              \
+    {                                                                                                \
+        return std::tie(ANT_SERIALIZER_FIELDS(obj, __VA_ARGS__));                                    \
+    }                                                                                                \
+    [[maybe_unused]] inline auto AntSerializableFields(type_& obj)                                    \
+    {                                                                                                \
+        return std::tie(ANT_SERIALIZER_FIELDS(obj, __VA_ARGS__));                                    \
+    }
+
+namespace ant {
+
+namespace detail {
+
+template<typename T, typename = void>
+struct IsSerializable : std::false_type {
+};
+
+template<typename T>
+struct IsSerializable<T, std::void_t<decltype(AntSerializableFields(std::declval<const T&>()))>> : std::true_type {
+};
+
+template<typename T>
+struct IsVector : std::false_type {
+};
+
+template<typename T, typename A>
+struct IsVector<std::vector<T, A>> : std::true_type {
+};
+
+template<typename T>
+struct IsOptional : std::false_type {
+};
+
+template<typename T>
+struct IsOptional<std::optional<T>> : std::true_type {
+};
+
+template<size_t N>
+struct UIntOfSize;
+
+template<>
+struct UIntOfSize<1> {
+    using type = uint8_t;
+};
+
+template<>
+struct UIntOfSize<2> {
+    using type = uint16_t;
+};
+
+template<>
+struct UIntOfSize<4> {
+    using type = uint32_t;
+};
+
+template<>
+struct UIntOfSize<8> {
+    using type = uint64_t;
+};
+
+template<typename T>
+using SerializableFields = decltype(AntSerializableFields(std::declval<const T&>()));
+
+template<typename T>
+constexpr size_t FixedSize();
+
+template<typename Tuple, size_t... I>
+constexpr size_t fieldsFixedSize(std::index_sequence<I...>)
+{
+    // a struct is of fixed size only if all its fields are
+    if constexpr (((FixedSize<std::decay_t<std::tuple_element_t<I, Tuple>>>() != 0) && ...)) {
+        return (FixedSize<std::decay_t<std::tuple_element_t<I, Tuple>>>() + ... + 0);
+    } else {
+        return 0;
+    }
+}
+
+// encoded size of T if it's always the same, 0 otherwise
+template<typename T>
+constexpr size_t FixedSize()
+{
+    if constexpr (std::is_arithmetic_v<T> || std::is_enum_v<T>) {
+        return sizeof(T);
+    } else if constexpr (IsSerializable<T>::value) {
+        using Fields = SerializableFields<T>;
+        return fieldsFixedSize<Fields>(std::make_index_sequence<std::tuple_size_v<Fields>>());
+    } else {
+        return 0;
+    }
+}
+
+// writes `val` of fixed size into `p` without bounds checking
+template<Endian endian, typename T>
+char* WriteFixed(char* p, const T& val)
+{
+    if constexpr (std::is_enum_v<T>) {
+        return WriteFixed<endian>(p, static_cast<std::underlying_type_t<T>>(val));
+    } else if constexpr (std::is_arithmetic_v<T>) {
+        typename UIntOfSize<sizeof(T)>::type v;
+        memcpy(&v, &val, sizeof v);
+        if constexpr (endian == Endian::LittleEndian) {
+            v = HostToLittleEndian(v);
+        } else {
+            v = HostToBigEndian(v);
+        }
+        memcpy(p, &v, sizeof v);
+        return p + sizeof v;
+    } else {
+        std::apply([&p](const auto&... fields) { ((p = WriteFixed<endian>(p, fields)), ...); }, AntSerializableFields(val));
+        return p;
+    }
+}
+
+// reads `val` of fixed size from `p` without bounds checking
+template<Endian endian, typename T>
+const char* ReadFixed(const char* p, T& val)
+{
+    if constexpr (std::is_enum_v<T>) {
+        std::underlying_type_t<T> v;
+        p = ReadFixed<endian>(p, v);
+        val = static_cast<T>(v);
+        return p;
+    } else if constexpr (std::is_same_v<T, bool>) {
+        val = *p != 0;
+        return p + 1;
+    } else if constexpr (std::is_arithmetic_v<T>) {
+        typename UIntOfSize<sizeof(T)>::type v;
+        memcpy(&v, p, sizeof v);
+        if constexpr (endian == Endian::LittleEndian) {
+            v = LittleEndianToHost(v);
+        } else {
+            v = BigEndianToHost(v);
+        }
+        memcpy(&val, &v, sizeof v);
+        return p + sizeof v;
+    } else {
+        std::apply([&p](auto&... fields) { ((p = ReadFixed<endian>(p, fields)), ...); }, AntSerializableFields(val));
+        return p;
+    }
+}
+
+// number of the consecutive fields of fixed size starting from the I-th field, and their total size
+template<typename Tuple, size_t I>
+constexpr std::pair<size_t, size_t> FixedRun()
+{
+    if constexpr (I < std::tuple_size_v<Tuple>) {
+        constexpr size_t size = FixedSize<std::decay_t<std::tuple_element_t<I, Tuple>>>();
+        if constexpr (size != 0) {
+            constexpr auto rest = FixedRun<Tuple, I + 1>();
+            return {rest.first + 1, rest.second + size};
+        }
+    }
+    return {0, 0};
+}
+
+template<Endian endian, typename Tuple, size_t... I>
+char* writeFixedFields(char* p, const Tuple& fields, std::index_sequence<I...>)
+{
+    ((p = WriteFixed<endian>(p, std::get<I>(fields))), ...);
+    return p;
+}
+
+template<Endian endian, typename Tuple, size_t... I>
+const char* readFixedFields(const char* p, const Tuple& fields, std::index_sequence<I...>)
+{
+    ((p = ReadFixed<endian>(p, std::get<I>(fields))), ...);
+    return p;
+}
+
+template<size_t Offset, size_t... I>
+constexpr std::index_sequence<(Offset + I)...> offsetSequence(std::index_sequence<I...>)
+{
+    return {};
+}
+
+template<Endian endian, typename Allocator, typename T>
+void SerializeValue(BinaryBuffer<endian, Allocator>& buf, const T& val);
+
+template<Endian endian, typename T>
+bool DeserializeValue(BinaryReader<endian>& reader, T& val);
+
+// encodes the fields from the I-th one, each run of fields of fixed size is written with a single bounds check
+template<size_t I, Endian endian, typename Allocator, typename Tuple>
+void SerializeFields(BinaryBuffer<endian, Allocator>& buf, const Tuple& fields)
+{
+    if constexpr (I < std::tuple_size_v<Tuple>) {
+        constexpr auto run = FixedRun<Tuple, I>();
+        if constexpr (run.first != 0) {
+            auto p = reinterpret_cast<char*>(buf.AppendUninitialized(run.second));
+            writeFixedFields<endian>(p, fields, offsetSequence<I>(std::make_index_sequence<run.first>()));
+            SerializeFields<I + run.first>(buf, fields);
+        } else {
+            SerializeValue(buf, std::get<I>(fields));
+            SerializeFields<I + 1>(buf, fields);
+        }
+    }
+}
+
+template<size_t I, Endian endian, typename Tuple>
+bool DeserializeFields(BinaryReader<endian>& reader, const Tuple& fields)
+{
+    if constexpr (I < std::tuple_size_v<Tuple>) {
+        constexpr auto run = FixedRun<Tuple, I>();
+        if constexpr (run.first != 0) {
+            std::string_view bytes;
+            if (!reader.ReadBytes(run.second, bytes)) {
+                return false;
+            }
+            readFixedFields<endian>(bytes.data(), fields, offsetSequence<I>(std::make_index_sequence<run.first>()));
+            return DeserializeFields<I + run.first>(reader, fields);
+        } else {
+            return DeserializeValue(reader, std::get<I>(fields)) && DeserializeFields<I + 1>(reader, fields);
+        }
+    }
+    return true;
+}
+
+template<Endian endian, typename Allocator, typename T>
+void SerializeValue(BinaryBuffer<endian, Allocator>& buf, const T& val)
+{
+    if constexpr (FixedSize<T>() != 0) {
+        WriteFixed<endian>(reinterpret_cast<char*>(buf.AppendUninitialized(FixedSize<T>())), val);
+    } else if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+        std::string_view s(val);
+        buf.AppendVarint(s.size());
+        buf.AppendString(s.data(), s.size());
+    } else if constexpr (IsVector<T>::value) {
+        using E = typename T::value_type;
+        buf.AppendVarint(val.size());
+        if constexpr (std::is_integral_v<E> && !std::is_same_v<E, bool>) {
+            using U = typename UIntOfSize<sizeof(E)>::type;
+            buf.AppendArray(reinterpret_cast<const U*>(val.data()), val.size());
+        } else if constexpr (FixedSize<E>() != 0) {
+            auto p = reinterpret_cast<char*>(buf.AppendUninitialized(FixedSize<E>() * val.size()));
+            for (const auto& e : val) {
+                p = WriteFixed<endian>(p, e);
+            }
+        } else {
+            for (const auto& e : val) {
+                SerializeValue(buf, e);
+            }
+        }
+    } else if constexpr (IsOptional<T>::value) {
+        buf.AppendInteger(static_cast<uint8_t>(val.has_value()));
+        if (val) {
+            SerializeValue(buf, *val);
+        }
+    } else {
+        static_assert(IsSerializable<T>::value, "type not supported, use ANT_SERIALIZABLE to make it serializable");
+        SerializeFields<0>(buf, AntSerializableFields(val));
+    }
+}
+
+template<Endian endian, typename T>
+bool DeserializeValue(BinaryReader<endian>& reader, T& val)
+{
+    if constexpr (FixedSize<T>() != 0) {
+        std::string_view bytes;
+        if (!reader.ReadBytes(FixedSize<T>(), bytes)) {
+            return false;
+        }
+        ReadFixed<endian>(bytes.data(), val);
+        return true;
+    } else if constexpr (std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view>) {
+        uint32_t len;
+        std::string_view s;
+        if (!reader.ReadVarint(len) || !reader.ReadBytes(len, s)) {
+            return false;
+        }
+        val = T(s);
+        return true;
+    } else if constexpr (IsVector<T>::value) {
+        using E = typename T::value_type;
+        constexpr size_t elemSize = FixedSize<E>();
+        uint32_t n;
+        // every element takes at least one byte, don't let a broken count allocate lots of memory
+        if (!reader.ReadVarint(n) || n > reader.RemainingLength() / (elemSize ? elemSize : 1)) {
+            return false;
+        }
+        val.resize(n);
+        if constexpr (std::is_integral_v<E> && !std::is_same_v<E, bool>) {
+            using U = typename UIntOfSize<sizeof(E)>::type;
+            return reader.ReadArray(reinterpret_cast<U*>(val.data()), n);
+        } else if constexpr (elemSize != 0) {
+            std::string_view bytes;
+            reader.ReadBytes(elemSize * n, bytes);
+            auto p = bytes.data();
+            for (auto& e : val) {
+                p = ReadFixed<endian>(p, e);
+            }
+            return true;
+        } else {
+            for (auto& e : val) {
+                if (!DeserializeValue(reader, e)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    } else if constexpr (IsOptional<T>::value) {
+        uint8_t hasValue;
+        if (!reader.ReadInteger(hasValue) || hasValue > 1) {
+            return false;
+        }
+        if (!hasValue) {
+            val.reset();
+            return true;
+        }
+        return DeserializeValue(reader, val.emplace());
+    } else {
+        static_assert(IsSerializable<T>::value, "type not supported, use ANT_SERIALIZABLE to make it serializable");
+        return DeserializeFields<0>(reader, AntSerializableFields(val));
+    }
+}
+
+} // namespace detail
+
+/**
+ * Appends `obj` into `buf`. Consecutive fields of fixed size are written with a single bounds check.
+ *
+ * @param buf
+ * @param obj a struct made serializable by ANT_SERIALIZABLE, or any other supported type
+ */
+template<Endian endian, typename Allocator, typename T>
+void Serialize(BinaryBuffer<endian, Allocator>& buf, const T& obj)
+{
+    detail::SerializeValue(buf, obj);
+}
+
+/**
+ * Reads `obj` from `reader`. std::string_view fields refer to the underlying buffer of `reader`.
+ *
+ * @param reader
+ * @param obj a struct made serializable by ANT_SERIALIZABLE, or any other supported type
+ *
+ * @return true on success, false if the stream is truncated or malformed, in which case `obj` could be partially read.
+ */
+template<Endian endian, typename T>
+bool Deserialize(BinaryReader<endian>& reader, T& obj)
+{
+    return detail::DeserializeValue(reader, obj);
+}
+
+} // namespace ant
+
+#endif //LIBANT_INCLUDE_LIBANT_ENCODING_BINARY_SERIALIZER_H_
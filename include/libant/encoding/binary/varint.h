@@ -0,0 +1,277 @@
+/*
+*
+* LibAnt - A handy C++ library
+* Copyright (C) 2022 Antigloss Huang (https://github.com/antigloss) All rights reserved.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+
+#ifndef LIBANT_INCLUDE_LIBANT_ENCODING_BINARY_VARINT_H_
+#define LIBANT_INCLUDE_LIBANT_ENCODING_BINARY_VARINT_H_
+
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "endian.h"
+
+namespace ant {
+
+/**
+ * Max number of bytes of a LEB128 varint encoded 64-bit integer
+ */
+constexpr size_t kMaxVarintSize = 10;
+
+/**
+ * Maps a signed integer to an unsigned one so that integers of small absolute values are encoded into few bytes by
+ * varint, eg: 0 -> 0, -1 -> 1, 1 -> 2, -2 -> 3.
+ *
+ * @param v
+ * @return
+ */
+template<typename T>
+constexpr std::make_unsigned_t<T> ZigZagEncode(T v)
+{
+    static_assert(std::is_integral_v<T> && std::is_signed_v<T>, "T must be a signed integer type");
+    using U = std::make_unsigned_t<T>;
+    return static_cast<U>(static_cast<U>(static_cast<U>(v) << 1) ^ static_cast<U>(v >> (sizeof(T) * 8 - 1)));
+}
+
+/**
+ * Reverses ZigZagEncode().
+ *
+ * @param v
+ * @return
+ */
+template<typename U>
+constexpr std::make_signed_t<U> ZigZagDecode(U v)
+{
+    static_assert(std::is_integral_v<U> && std::is_unsigned_v<U>, "U must be an unsigned integer type");
+    return static_cast<std::make_signed_t<U>>(static_cast<U>((v >> 1) ^ static_cast<U>(0 - (v & 1))));
+}
+
+/**
+ * Returns number of bytes needed to encode `v` as a varint.
+ *
+ * @param v
+ * @return
+ */
+inline size_t VarintSize(uint64_t v)
+{
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        ++n;
+    }
+    return n;
+}
+
+/**
+ * Encodes `v` as a LEB128 varint into `p`, which must have kMaxVarintSize bytes of room.
+ *
+ * @param p
+ * @param v
+ * @return pointer to the byte following the encoded varint
+ */
+inline char* EncodeVarint(char* p, uint64_t v)
+{
+    while (v >= 0x80) {
+        *p++ = static_cast<char>(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = static_cast<char>(v);
+    return p;
+}
+
+namespace detail {
+
+inline unsigned CountTrailingZeros(uint64_t v)
+{
+#ifdef _MSC_VER
+    unsigned long idx;
+    _BitScanForward64(&idx, v);
+    return idx;
+#else
+    return __builtin_ctzll(v);
+#endif
+}
+
+// decodes a varint byte by byte, rejects truncated varints and those overflowing 64 bits
+inline const char* DecodeVarintSlow(const char* p, const char* end, uint64_t& val)
+{
+    uint64_t r = 0;
+    for (unsigned shift = 0; shift < 64 && p != end; shift += 7) {
+        auto b = static_cast<uint8_t>(*p++);
+        r |= static_cast<uint64_t>(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            if (shift == 63 && b > 1) {
+                return nullptr;
+            }
+            val = r;
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+// narrows `v` into `val`, zigzag decodes it if T is signed
+template<typename T>
+inline bool NarrowVarint(uint64_t v, T& val)
+{
+    static_assert(std::is_integral_v<T>, "T must be an integer type");
+    using U = std::make_unsigned_t<T>;
+    if (v > std::numeric_limits<U>::max()) {
+        return false;
+    }
+    if constexpr (std::is_signed_v<T>) {
+        val = ZigZagDecode(static_cast<U>(v));
+    } else {
+        val = static_cast<T>(v);
+    }
+    return true;
+}
+
+constexpr double kPowersOf10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18};
+
+} // namespace detail
+
+/**
+ * Decodes a LEB128 varint from [p, end) into `val`. Varints of up to 8 bytes are decoded without per byte branches
+ * if at least 8 bytes are readable.
+ *
+ * @param p
+ * @param end
+ * @param val
+ * @return pointer to the byte following the decoded varint, nullptr if the varint is truncated or overflows 64 bits
+ */
+inline const char* DecodeVarint(const char* p, const char* end, uint64_t& val)
+{
+    if (p != end && !(*p & 0x80)) {
+        val = static_cast<uint8_t>(*p);
+        return p + 1;
+    }
+
+    if (end - p >= 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof v);
+        v = LittleEndianToHost(v);
+        // the high bit of the last byte of the varint is the lowest clear high bit
+        uint64_t stops = ~v & 0x8080808080808080ULL;
+        if (stops) {
+            v &= stops ^ (stops - 1);
+            // squeeze out the continuation bits: 7 bits per byte -> 14 bits per 2 bytes -> 28 bits per 4 bytes -> 56 bits
+            v = ((v & 0x7F007F007F007F00ULL) >> 1) | (v & 0x007F007F007F007FULL);
+            v = ((v & 0x3FFF00003FFF0000ULL) >> 2) | (v & 0x00003FFF00003FFFULL);
+            v = ((v & 0x0FFFFFFF00000000ULL) >> 4) | (v & 0x000000000FFFFFFFULL);
+            val = v;
+            return p + detail::CountTrailingZeros(stops) / 8 + 1;
+        }
+    }
+    return detail::DecodeVarintSlow(p, end, val);
+}
+
+/**
+ * Decodes `count` consecutive varints from [p, end) into `vals`. Signed integers are zigzag decoded. With SSE2, runs of
+ * single byte varints are located 16 bytes at a time and copied out without decoding them one by one.
+ *
+ * @tparam T supported integer types are int8, uint8, int16, uint16, int32, uint32, int64, and uint64
+ * @param p
+ * @param end
+ * @param vals
+ * @param count
+ * @return pointer to the byte following the last decoded varint, nullptr if any varint is truncated or doesn't fit in T
+ */
+template<typename T>
+const char* DecodeVarints(const char* p, const char* end, T* vals, size_t count)
+{
+    uint64_t v;
+#ifdef __SSE2__
+    auto fromByte = [](char c) {
+        if constexpr (std::is_signed_v<T>) {
+            return static_cast<T>(ZigZagDecode(static_cast<uint8_t>(c)));
+        } else {
+            return static_cast<T>(static_cast<uint8_t>(c));
+        }
+    };
+
+    while (count >= 16 && end - p >= 16) {
+        auto mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))));
+        // bytes before the first one with the continuation bit set are single byte varints
+        unsigned n = mask ? detail::CountTrailingZeros(mask) : 16;
+        for (unsigned i = 0; i != n; ++i) {
+            vals[i] = fromByte(p[i]);
+        }
+        p += n;
+        vals += n;
+        count -= n;
+        if (mask) {
+            p = DecodeVarint(p, end, v);
+            if (!p || !detail::NarrowVarint(v, *vals)) {
+                return nullptr;
+            }
+            ++vals;
+            --count;
+        }
+    }
+#endif
+    for (; count; --count, ++vals) {
+        p = DecodeVarint(p, end, v);
+        if (!p || !detail::NarrowVarint(v, *vals)) {
+            return nullptr;
+        }
+    }
+    return p;
+}
+
+/**
+ * Converts `val` to a fixed-point integer with `decimals` (<= 18) decimal places, eg: 12.345 -> 1235 with 2 decimals.
+ *
+ * @param val
+ * @param decimals
+ * @return
+ */
+inline int64_t ToFixedPoint(double val, uint8_t decimals)
+{
+    assert(decimals <= 18);
+    return std::llround(val * detail::kPowersOf10[decimals]);
+}
+
+/**
+ * Reverses ToFixedPoint().
+ *
+ * @param val
+ * @param decimals
+ * @return
+ */
+inline double FromFixedPoint(int64_t val, uint8_t decimals)
+{
+    assert(decimals <= 18);
+    return static_cast<double>(val) / detail::kPowersOf10[decimals];
+}
+
+} // namespace ant
+
+#endif //LIBANT_INCLUDE_LIBANT_ENCODING_BINARY_VARINT_H_
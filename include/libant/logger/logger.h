@@ -22,19 +22,194 @@
 #define LIBANT_LOGGER_LOGGER_H_
 
 #include <atomic>
+#include <cmath>
 #ifdef _WIN32
 #include <fstream>
 #include <iostream>
 #else
+#include <sys/uio.h>
 #include <unistd.h>
 #endif
+#include <cstring>
+#include <ctime>
 #include <memory>
 #include <mutex>
+#include <string_view>
+#include <type_traits>
+#include <vector>
 #include <libant/logger/fmt/chrono.h>
 #include <libant/logger/fmt/format.h>
 
 namespace ant {
 
+namespace detail {
+
+/**
+ * DeferredFormat describes a format string whose formatting is deferred to the background thread of Logger.
+ */
+struct DeferredFormat {
+    fmt::string_view format;
+    uint32_t id;
+    std::string binaryDef; // definition of the format string written to binary logfiles
+};
+
+/**
+ * Register a format string for deferred formatting. `format` must be valid forever.
+ *
+ * @param format
+ * @return descriptor of the format string
+ */
+const DeferredFormat* RegisterDeferredFormat(fmt::string_view format);
+
+enum DeferredArgType : uint8_t {
+    DeferredArgInt,
+    DeferredArgUInt,
+    DeferredArgDouble,
+    DeferredArgBool,
+    DeferredArgChar,
+    DeferredArgString,
+    DeferredArgPointer,
+    DeferredArgFloat, // kept apart from DeferredArgDouble, as a float is formatted with fewer digits
+};
+
+template<typename V>
+inline char* EncodeDeferredValue(char* p, DeferredArgType type, V v)
+{
+    *p = static_cast<char>(type);
+    memcpy(p + 1, &v, sizeof(v));
+    return p + 1 + sizeof(v);
+}
+
+inline char* EncodeDeferredString(char* p, const char* str, uint32_t len)
+{
+    p = EncodeDeferredValue(p, DeferredArgString, len);
+    memcpy(p, str, len);
+    return p + len;
+}
+
+/**
+ * DeferredArg tells if an argument of type T can be captured for deferred formatting, and how it's captured.
+ * Arguments are captured as a type tag followed by the raw bytes.
+ */
+template<typename T, typename = void>
+struct DeferredArg {
+    static constexpr bool kSupported = false;
+};
+
+template<typename T>
+struct DeferredArg<T, std::enable_if_t<std::is_integral<T>::value && std::is_signed<T>::value && !std::is_same<T, char>::value>> {
+    static constexpr bool kSupported = true;
+    static size_t Size(T) { return 1 + sizeof(int64_t); }
+    static char* Encode(char* p, T v) { return EncodeDeferredValue(p, DeferredArgInt, static_cast<int64_t>(v)); }
+};
+
+template<typename T>
+struct DeferredArg<T, std::enable_if_t<std::is_unsigned<T>::value && !std::is_same<T, bool>::value && !std::is_same<T, char>::value>> {
+    static constexpr bool kSupported = true;
+    static size_t Size(T) { return 1 + sizeof(uint64_t); }
+    static char* Encode(char* p, T v) { return EncodeDeferredValue(p, DeferredArgUInt, static_cast<uint64_t>(v)); }
+};
+
+template<>
+struct DeferredArg<float> {
+    static constexpr bool kSupported = true;
+    static size_t Size(float) { return 1 + sizeof(float); }
+    static char* Encode(char* p, float v) { return EncodeDeferredValue(p, DeferredArgFloat, v); }
+};
+
+template<>
+struct DeferredArg<double> {
+    static constexpr bool kSupported = true;
+    static size_t Size(double) { return 1 + sizeof(double); }
+    static char* Encode(char* p, double v) { return EncodeDeferredValue(p, DeferredArgDouble, v); }
+};
+
+template<>
+struct DeferredArg<bool> {
+    static constexpr bool kSupported = true;
+    static size_t Size(bool) { return 2; }
+    static char* Encode(char* p, bool v) { return EncodeDeferredValue(p, DeferredArgBool, v); }
+};
+
+template<>
+struct DeferredArg<char> {
+    static constexpr bool kSupported = true;
+    static size_t Size(char) { return 2; }
+    static char* Encode(char* p, char v) { return EncodeDeferredValue(p, DeferredArgChar, v); }
+};
+
+template<typename T>
+struct DeferredArg<T, std::enable_if_t<std::is_same<T, const char*>::value || std::is_same<T, char*>::value>> {
+    static constexpr bool kSupported = true;
+    static size_t Size(const char* v) { return 1 + sizeof(uint32_t) + strlen(v); }
+    static char* Encode(char* p, const char* v) { return EncodeDeferredString(p, v, static_cast<uint32_t>(strlen(v))); }
+};
+
+template<typename T>
+struct DeferredArg<T, std::enable_if_t<std::is_same<T, std::string>::value || std::is_same<T, std::string_view>::value
+                                       || std::is_same<T, fmt::string_view>::value>> {
+    static constexpr bool kSupported = true;
+    static size_t Size(const T& v) { return 1 + sizeof(uint32_t) + v.size(); }
+    static char* Encode(char* p, const T& v) { return EncodeDeferredString(p, v.data(), static_cast<uint32_t>(v.size())); }
+};
+
+template<typename T>
+struct DeferredArg<T, std::enable_if_t<std::is_same<T, void*>::value || std::is_same<T, const void*>::value
+                                       || std::is_same<T, std::nullptr_t>::value>> {
+    static constexpr bool kSupported = true;
+    static size_t Size(const void*) { return 1 + sizeof(uint64_t); }
+    static char* Encode(char* p, const void* v) { return EncodeDeferredValue(p, DeferredArgPointer, reinterpret_cast<uintptr_t>(v)); }
+};
+
+/**
+ * SourceLocation is written as `file:line` by Logger::LogKV().
+ */
+struct SourceLocation {
+    const char* file;
+    int line;
+};
+
+/**
+ * Append `s` to `buf` as a JSON string, or as a logfmt value which is quoted only if necessary.
+ */
+void AppendKVString(std::string& buf, std::string_view s, bool logfmt);
+
+/**
+ * Append `value` to `buf` as a JSON value, or as a logfmt value.
+ */
+template<typename T>
+void AppendKVValue(std::string& buf, const T& value, bool logfmt)
+{
+    if constexpr (std::is_same<T, bool>::value) {
+        buf.append(value ? "true" : "false");
+    } else if constexpr (std::is_same<T, char>::value) {
+        AppendKVString(buf, std::string_view(&value, 1), logfmt);
+    } else if constexpr (std::is_integral<T>::value) {
+        fmt::format_int s(value);
+        buf.append(s.data(), s.size());
+    } else if constexpr (std::is_floating_point<T>::value) {
+        if (!logfmt && !std::isfinite(value)) {
+            buf.append("null"); // not allowed by JSON
+        } else {
+            fmt::format_to(std::back_inserter(buf), "{}", value);
+        }
+    } else if constexpr (std::is_same<T, std::nullptr_t>::value) {
+        buf.append("null");
+    } else if constexpr (std::is_same<T, SourceLocation>::value) {
+        fmt::basic_memory_buffer<char, 256> s;
+        fmt::format_to(s, "{}:{}", value.file, value.line);
+        AppendKVString(buf, std::string_view(s.data(), s.size()), logfmt);
+    } else if constexpr (std::is_convertible<const T&, std::string_view>::value) {
+        AppendKVString(buf, value, logfmt);
+    } else {
+        fmt::memory_buffer s;
+        fmt::format_to(s, "{}", value);
+        AppendKVString(buf, std::string_view(s.data(), s.size()), logfmt);
+    }
+}
+
+} // namespace detail
+
 /**
  * Logger is a thread-safe logging facility which writes logs with different severity levels to files, console, or both.
  * Logs with different severity levels are written to different logfiles.
@@ -45,7 +220,8 @@ namespace ant {
  *   \l Auto rotation: It'll create a new logfile whenever day changes or size of the current logfile exceeds the configured size limit.
  *   \l Log levels: 5 different levels are supported. Logs with different levels are written to different logfiles. By setting the Logger object to a higher log level, lower level logs will be filtered out.
  *   \l Log-through: Logs with higher severity level will be written to all the logfiles with lower severity level if configured to do so.
- *   \l Logs are not buffered, they are written to logfiles immediately with fileStream.write(log.c_str(), log.size()).
+ *   \l Logs are not buffered by default, they are written to logfiles immediately with fileStream.write(log.c_str(), log.size()).
+ *   \l Async mode: Logs are formatted by the calling thread into a per-thread lock-free ring buffer, and written to logfiles in batches by a background thread. Not supported on Windows.
  *   \l Symlinks named `LOG_LEVEL`.log_filename_prefix.log will be created and link to the most current logfiles.
  */
 class Logger {
@@ -82,6 +258,36 @@ public:
         ControlFlagLogDate = 0x02,    // Controls if a date string formatted as '20201201' is prepended to the logs.
         ControlFlagNoPrepends = 0x04, // Don't prepend any additional info to the logs.
         ControlFlagNoSymlinks = 0x08, // Don't create symlinks.
+        ControlFlagCoarseClock = 0x10, // Timestamp the logs with CLOCK_REALTIME_COARSE, which is much cheaper but only accurate to a few milliseconds. Linux only.
+        ControlFlagLogMicroseconds = 0x20, // Append microseconds formatted as '.000123' to the time prepended to the logs.
+        ControlFlagSingleFile = 0x40, // Write logs of all levels once to a single logfile named 'filenamePrefix.ALL.DateTime.log'. Logs are told apart by
+                                      // the level initial prepended, eg. `grep '^E'` for the errors. ControlFlagLogThrough is ignored.
+    };
+
+    /**
+     * FormatMode controls when and where the logs are formatted in async mode.
+     */
+    enum FormatMode {
+        FormatEager,    // Format on the calling thread.
+        FormatDeferred, // Capture the arguments on the calling thread, format on the background thread.
+        FormatBinary,   // Capture the arguments on the calling thread, write them unformatted to `.bin` logfiles. Use DecodeBinaryLog() to read them.
+    };
+
+    /**
+     * OverflowPolicy controls what happens when a thread logs faster than the background thread writes in async mode.
+     */
+    enum OverflowPolicy {
+        OverflowBlock,           // Wait until there is enough room in the buffer.
+        OverflowDrop,            // Discard the log.
+        OverflowDropWithCounter, // Discard the log, and write a line telling how many logs are discarded afterwards.
+    };
+
+    /**
+     * KVFormat controls how LogKV() writes structured logs.
+     */
+    enum KVFormat {
+        KVFormatJSON,   // A JSON object per line, eg: {"time":"2020-12-01T12:34:56.123456","level":"INFO","msg":"login","uid":12321}
+        KVFormatLogfmt, // logfmt, eg: time=2020-12-01T12:34:56.123456 level=INFO msg=login uid=12321
     };
 
     /**
@@ -115,6 +321,73 @@ public:
         {
         }
 
+        /**
+         * Enable async mode. Not supported on Windows.
+         *
+         * @param policy What to do when the buffer of a thread is full.
+         * @param bufferSizeInKB Size of the buffer allocated for each thread writing logs, rounded up to power of 2.
+         * @param flushIntervalMS The background thread writes logs at least once every `flushIntervalMS` milliseconds.
+         */
+        void SetAsync(OverflowPolicy policy = OverflowBlock, uint32_t bufferSizeInKB = 1024, uint32_t flushIntervalMS = 100)
+        {
+            async_ = true;
+            overflowPolicy_ = policy;
+            asyncBufferSize_ = bufferSizeInKB;
+            flushInterval_ = flushIntervalMS;
+        }
+
+        /**
+         * Set how the logs are formatted in async mode, FormatEager by default. Logs are deferred only if the format
+         * string is wrapped by FMT_STRING() (as LOG_XXX do) and all the arguments are integers, floats, doubles, bools,
+         * chars, strings or void pointers; the others are formatted eagerly in any mode.
+         *
+         * @param mode
+         */
+        void SetFormatMode(FormatMode mode)
+        {
+            formatMode_ = mode;
+        }
+
+        /**
+         * Write the logfiles through mmap instead of write(). Not supported on Windows. Logfiles are preallocated
+         * `preallocSizeInMB` at a time, and the next logfile of each level is created and preallocated by a background
+         * thread, so that rotation doesn't stall the logging thread. Logfiles are truncated to their actual size when
+         * closed, but might end with zeros if the process crashes.
+         *
+         * @param preallocSizeInMB Size preallocated at a time. Capped to the maximum size of a logfile.
+         */
+        void SetMmap(uint32_t preallocSizeInMB = 64)
+        {
+            mmap_ = true;
+            mmapPreallocSize_ = preallocSizeInMB;
+        }
+
+        /**
+         * Compress the logfiles into `.gz` files by a background thread once they're rotated. The compressed files keep
+         * the modification time of the logfiles, so FilePurger purges them as it did the logfiles. Logfiles still
+         * queued when the Logger object is destroyed are left uncompressed. Not supported on Windows, and ignored if
+         * libant is built without zlib (LIBANT_WITH_ZLIB is not defined).
+         *
+         * @param level Compression level from 1 (fastest) to 9 (smallest).
+         * @param maxMBPerSecond Compress at most so many MB of logs per second to bound the CPU usage. 0 means unlimited.
+         */
+        void SetCompression(int level = 6, uint32_t maxMBPerSecond = 32)
+        {
+            compress_ = true;
+            compressionLevel_ = level;
+            compressionRate_ = maxMBPerSecond;
+        }
+
+        /**
+         * Set how LogKV() and LOG_XXX_KV write structured logs, KVFormatJSON by default.
+         *
+         * @param format
+         */
+        void SetKVFormat(KVFormat format)
+        {
+            kvFormat_ = format;
+        }
+
     private:
         std::string logDir_;
         std::string logFilenamePrefix_;
@@ -123,6 +396,17 @@ public:
         LogDest logDest_;
         uint32_t controlFlags_;
         bool enableThreadMutex_;
+        bool async_{false};
+        OverflowPolicy overflowPolicy_{OverflowBlock};
+        uint32_t asyncBufferSize_{0}; // in KB
+        uint32_t flushInterval_{0};   // in milliseconds
+        FormatMode formatMode_{FormatEager};
+        bool mmap_{false};
+        uint32_t mmapPreallocSize_{0}; // in MB
+        bool compress_{false};
+        int compressionLevel_{0};
+        uint32_t compressionRate_{0}; // in MB per second
+        KVFormat kvFormat_{KVFormatJSON};
     };
 
 public:
@@ -132,6 +416,7 @@ public:
      * @param cfg
      */
     Logger(const Cfg& cfg);
+    ~Logger();
 
     /**
      * Change log level of the Logger object at runtime. Thread-safe.
@@ -151,6 +436,17 @@ public:
         logDest_ = dest;
     }
 
+    /**
+     * Check if logs of `level` would be written. Thread-safe.
+     *
+     * @param level
+     * @return true if logs of `level` would be written
+     */
+    bool IsEnabled(LogLevel level) const
+    {
+        return logLevel_.load(std::memory_order_relaxed) <= level && logDest_.load(std::memory_order_relaxed) != LogDestNone;
+    }
+
     /**
      * Writes a log. Use FMT_STRING() on the format string to enable static argument count checking. \n
      * Eg: Log(ant::Logger::LogLevelInfo, FMT_STRING("User login. uid={} ip={}"), 12321, "127.0.0.1")
@@ -171,6 +467,15 @@ public:
             return;
         }
 
+        auto curTm = now();
+#ifndef _WIN32
+        if constexpr (fmt::is_compile_string<S>::value && (detail::DeferredArg<std::decay_t<Args>>::kSupported && ...)) {
+            if (deferred_ && logDeferred(level, logThrough_ ? lowestLevel : level, dest, curTm, format, args...)) {
+                return;
+            }
+        }
+#endif
+
         std::string* buf;
         if (multiThreaded_) {
             buf = &thrBuf_;
@@ -178,59 +483,100 @@ public:
             buf = &buf_;
         }
 
-        auto backInserter = std::back_insert_iterator<std::string>(*buf);
-        auto tNow = std::chrono::system_clock::now();
-        auto curTm = std::chrono::duration_cast<std::chrono::microseconds>(tNow.time_since_epoch()).count();
-        auto tmNow = fmt::localtime(curTm / 1000000);
-        if (!(controlFlags_ & ControlFlagNoPrepends)) {
-            if (!(controlFlags_ & ControlFlagLogDate)) {
-                fmt::format_to(backInserter, "{}{:%H:%M:%S} ", levelInitials_[level], tmNow);
-            } else {
-                fmt::format_to(backInserter, "{}{:%Y%m%d %H:%M:%S} ", levelInitials_[level], tmNow);
-            }
-        }
-        fmt::format_to(backInserter, format, std::forward<Args>(args)...);
+        const auto& timeCache = cachedTime(curTm);
+        auto tmNow = timeCache.tmNow;
+        auto microSeconds = static_cast<uint32_t>(curTm % 1000000);
+        appendPrefix(*buf, controlFlags_, level, timeCache, microSeconds);
+        fmt::format_to(std::back_insert_iterator<std::string>(*buf), format, std::forward<Args>(args)...);
         buf->append("\n");
+        writeLog(level, lowestLevel, dest, curTm, tmNow, microSeconds, *buf);
+    }
 
-        if (logDest_ & LogDestFile) {
-            auto microSeconds = static_cast<uint32_t>(curTm % 1000000);
-            if (controlFlags_ & ControlFlagLogThrough) {
-                for (int lv = level; lv >= lowestLevel; --lv) {
-                    loggers_[lv]->Log(tmNow, microSeconds, *buf);
-                }
-            } else {
-                loggers_[level]->Log(tmNow, microSeconds, *buf);
-            }
-        }
-
-        if (logDest_ & LogDestConsole) {
-            if (multiThreaded_) {
-                lock_.lock();
-            }
+    /**
+     * Writes a structured log in the format set by Cfg::SetKVFormat(). The fields are written in the order of `time`
+     * and `level` (unless ControlFlagNoPrepends is set), `msg`, then `kvs`. \n
+     * Eg: LogKV(ant::Logger::LogLevelInfo, "login", "uid", 12321, "ip", "127.0.0.1")
+     *
+     * @param level
+     * @param msg
+     * @param kvs Keys and values in turn. Keys are strings. Values are integers, floats, bools, chars, strings, nullptr,
+     *            or anything else fmt can format, which are written as strings.
+     */
+    template<typename... KVs>
+    void LogKV(LogLevel level, std::string_view msg, const KVs&... kvs)
+    {
+        static_assert(sizeof...(KVs) % 2 == 0, "keys and values must come in pairs");
 
-#ifdef _WIN32
-            std::cout.write(buf->c_str(), buf->size());
-#else
-            std::ignore = write(STDOUT_FILENO, buf->c_str(), buf->size());
-#endif
+        LogLevel lowestLevel = logLevel_;
+        LogDest dest = logDest_;
+        if (lowestLevel > level || dest == LogDestNone) {
+            return;
+        }
 
-            if (multiThreaded_) {
-                lock_.unlock();
-            }
+        auto curTm = now();
+        std::string* buf;
+        if (multiThreaded_) {
+            buf = &thrBuf_;
+        } else {
+            buf = &buf_;
         }
 
-        buf->clear();
+        const auto& timeCache = cachedTime(curTm);
+        auto tmNow = timeCache.tmNow;
+        auto microSeconds = static_cast<uint32_t>(curTm % 1000000);
+        if (!kvLogfmt_) {
+            buf->push_back('{');
+        }
+        if (!(controlFlags_ & ControlFlagNoPrepends)) {
+            // 2020-12-01T12:34:56.123456
+            const char* t = timeCache.text;
+            char time[26] = {t[0], t[1], t[2], t[3], '-', t[4], t[5], '-', t[6], t[7], 'T', t[9], t[10], ':', t[12], t[13], ':', t[15], t[16], '.'};
+            formatMicroseconds(time + 20, microSeconds);
+            appendKV(*buf, "time", std::string_view(time, sizeof(time)));
+            appendKV(*buf, "level", levelNames_[level]);
+        }
+        appendKV(*buf, "msg", msg);
+        appendKVs(*buf, kvs...);
+        buf->append(kvLogfmt_ ? "\n" : "}\n");
+        writeLog(level, lowestLevel, dest, curTm, tmNow, microSeconds, *buf);
     }
 
+    /**
+     * Wait until all the logs written before are handed over to the OS. Returns immediately if not in async mode.
+     */
+    void Flush();
+
+    /**
+     * Get number of logs discarded in async mode because of buffer overflow.
+     *
+     * @return number of logs discarded
+     */
+    uint64_t DroppedCount() const;
+
+    /**
+     * Decode a `.bin` logfile written in FormatBinary mode into a text logfile. The binary logfile can only be decoded
+     * on machines with the same byte order.
+     *
+     * @param binPath path of the binary logfile
+     * @param textPath path of the text logfile to be written
+     * @return true on success, false if failed to read or write the files, or the binary logfile is corrupted
+     */
+    static bool DecodeBinaryLog(const std::string& binPath, const std::string& textPath);
+
 private:
+    class AsyncWriter;
+    class SegmentPreparer;
+    class Compressor;
+
     class Impl {
     public:
-        Impl(const Logger* parent, const std::string& filenamePrefix, LogLevel level, bool enableMutex);
+        // `levelName` is used to name the logfiles
+        Impl(const Logger* parent, const std::string& filenamePrefix, const std::string& levelName, bool enableMutex);
 
 #ifndef _WIN32
         ~Impl()
         {
-            close(outFD_);
+            closeFile(false);
         }
 #endif
 
@@ -249,47 +595,365 @@ private:
             }
         }
 
+#ifndef _WIN32
+        /**
+         * Queue a log to be written by WriteBatch(). Used by the background thread of async mode only.
+         * `content` must be valid until WriteBatch() is called.
+         */
+        void Append(const tm& tmNow, uint32_t microSeconds, const char* content, size_t len);
+
+        /**
+         * Queue a record to be written to the binary logfile. The definition of `format` is written before its first use
+         * in each logfile, so that every binary logfile is self-contained.
+         */
+        void AppendBinary(const tm& tmNow, uint32_t microSeconds, const detail::DeferredFormat* format, const char* head, size_t headLen,
+                          const char* content, size_t len);
+
+        /**
+         * Write the logs queued by Append() with as few writev() as possible.
+         */
+        void WriteBatch();
+#endif
+
     private:
         bool log(const tm& tmNow, uint32_t microSeconds, const std::string& content);
+        // open a new logfile if the day changes, the current one is full, or there is no logfile opened yet
+        bool prepareFile(const tm& tmNow, uint32_t microSeconds);
+        bool writeBatch();
+#ifndef _WIN32
+        // precede the batch with the definitions of the formats it uses but not yet defined in the current logfile
+        void defineFormats();
+#endif
+        // start a new batch if there is no batch yet or the current one can't hold `len` more bytes
+        void prepareBatch(const tm& tmNow, uint32_t microSeconds);
+#ifndef _WIN32
+        // open a logfile, taking the one prepared by SegmentPreparer if any
+        bool openFile(const std::string& filename);
+        // close the logfile, and compress it if `compress` is true and compression is enabled
+        void closeFile(bool compress = true);
+        bool writeFile(const char* data, size_t len);
+        // map the chunk of the logfile in which the next log is written, preallocating it if necessary
+        bool remap();
+#endif
 
     private:
         const Logger* parent_;
-        const LogLevel level_;
+        const std::string levelName_;
         const bool enableMutex_;
         const std::string symlink_;
+#ifndef _WIN32
+        const std::string nextPath_; // where SegmentPreparer prepares the next logfile in mmap mode
+#endif
 
         std::mutex lock_; // protects the following variables
 #ifdef _WIN32
         std::ofstream out_;
 #else
         int outFD_{-1};
+        std::string curPath_;
+        char* map_{nullptr}; // maps [mapOffset_, mapOffset_ + mapSize_) of the logfile in mmap mode
+        uint64_t mapOffset_{0};
+        uint64_t mapSize_{0};
+        uint64_t syncedSize_{0}; // the logs before are synced and dropped from memory
 #endif
         int curDay_{-1};
         uint64_t curFileSize_{0};
+
+#ifndef _WIN32
+        std::vector<iovec> batch_; // used by the background thread of async mode only
+        uint64_t batchSize_{0};
+        tm batchTm_;
+        uint32_t batchMicroSeconds_{0};
+        uint64_t batchSeq_{0};
+        std::vector<uint64_t> formatBatchSeqs_; // in which batch a format is used last time, indexed by format id
+        std::vector<const detail::DeferredFormat*> batchFormats_; // formats used by the current batch
+        uint64_t fileSeq_{0}; // bumped by openFile(), forgetting the formats defined in the previous logfile
+        std::vector<uint64_t> formatFileSeqs_; // in which logfile a format is defined last time, indexed by format id
+#endif
+    };
+
+    // write a formatted log in `buf`, then clear `buf`
+    void writeLog(LogLevel level, LogLevel lowestLevel, LogDest dest, int64_t curTm, const tm& tmNow, uint32_t microSeconds, std::string& buf)
+    {
+#ifndef _WIN32
+        if (async_) {
+            submit(level, logThrough_ ? lowestLevel : level, dest, curTm, buf);
+            buf.clear();
+            if (level == LogLevelFatal) {
+                Flush(); // the process is going to exit
+            }
+            return;
+        }
+#endif
+
+        if (logDest_ & LogDestFile) {
+            if (logThrough_) {
+                for (int lv = level; lv >= lowestLevel; --lv) {
+                    loggers_[lv]->Log(tmNow, microSeconds, buf);
+                }
+            } else {
+                loggers_[level]->Log(tmNow, microSeconds, buf);
+            }
+        }
+
+        if (logDest_ & LogDestConsole) {
+            if (multiThreaded_) {
+                lock_.lock();
+            }
+
+#ifdef _WIN32
+            std::cout.write(buf.c_str(), buf.size());
+#else
+            std::ignore = write(STDOUT_FILENO, buf.c_str(), buf.size());
+#endif
+
+            if (multiThreaded_) {
+                lock_.unlock();
+            }
+        }
+
+        buf.clear();
+    }
+
+    // local time of a second, with its text formatted as '20201201 12:34:56'
+    struct TimeCache {
+        int64_t second{-1};
+        tm tmNow{};
+        char text[18]{};
     };
 
+    // current time in microseconds
+    int64_t now() const
+    {
+#ifdef CLOCK_REALTIME_COARSE
+        if (controlFlags_ & ControlFlagCoarseClock) {
+            timespec ts;
+            clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+            return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+        }
+#endif
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // local time of `timeUS`, cached per thread to call localtime and format the text only once a second
+    static const TimeCache& cachedTime(int64_t timeUS)
+    {
+        auto& cache = thrTimeCache_;
+        const int64_t second = timeUS / 1000000;
+        if (cache.second != second) {
+            cache.tmNow = fmt::localtime(static_cast<time_t>(second));
+            fmt::format_to_n(cache.text, sizeof(cache.text) - 1, "{:%Y%m%d %H:%M:%S}", cache.tmNow);
+            cache.second = second;
+        }
+        return cache;
+    }
+
+    // append the level initial and the time to `buf` according to `controlFlags`
+    template<typename Buffer>
+    static void appendPrefix(Buffer& buf, uint32_t controlFlags, LogLevel level, const TimeCache& timeCache, uint32_t microSeconds)
+    {
+        if (controlFlags & ControlFlagNoPrepends) {
+            return;
+        }
+
+        char prefix[32];
+        char* p = prefix;
+        *p++ = levelInitials_[level];
+        if (controlFlags & ControlFlagLogDate) {
+            memcpy(p, timeCache.text, 17);
+            p += 17;
+        } else {
+            memcpy(p, timeCache.text + 9, 8);
+            p += 8;
+        }
+        if (controlFlags & ControlFlagLogMicroseconds) {
+            *p++ = '.';
+            p = formatMicroseconds(p, microSeconds);
+        }
+        *p++ = ' ';
+        buf.append(prefix, p);
+    }
+
+    // write `microSeconds` as 6 digits to `p`, returns the end
+    static char* formatMicroseconds(char* p, uint32_t microSeconds)
+    {
+        for (int i = 5; i >= 0; --i) {
+            p[i] = static_cast<char>('0' + microSeconds % 10);
+            microSeconds /= 10;
+        }
+        return p + 6;
+    }
+
+    template<typename K, typename V>
+    void appendKV(std::string& buf, const K& key, const V& value)
+    {
+        static_assert(std::is_convertible<const K&, std::string_view>::value, "keys must be strings");
+        if (kvLogfmt_) {
+            if (!buf.empty()) {
+                buf.push_back(' ');
+            }
+            buf.append(std::string_view(key));
+            buf.push_back('=');
+        } else {
+            if (buf.size() > 1) {
+                buf.push_back(',');
+            }
+            detail::AppendKVString(buf, key, false);
+            buf.push_back(':');
+        }
+        detail::AppendKVValue(buf, value, kvLogfmt_);
+    }
+
+    void appendKVs(std::string&)
+    {
+    }
+
+    template<typename K, typename V, typename... KVs>
+    void appendKVs(std::string& buf, const K& key, const V& value, const KVs&... kvs)
+    {
+        appendKV(buf, key, value);
+        appendKVs(buf, kvs...);
+    }
+
+#ifndef _WIN32
+    void submit(LogLevel level, LogLevel lowestLevel, LogDest dest, int64_t timeUS, const std::string& content);
+
+    template<typename S, typename... Args>
+    bool logDeferred(LogLevel level, LogLevel lowestLevel, LogDest dest, int64_t timeUS, const S& format, const Args&... args)
+    {
+        // one per call site, as each FMT_STRING() is of a unique type
+        static const detail::DeferredFormat* deferredFormat = detail::RegisterDeferredFormat(fmt::to_string_view(format));
+
+        const size_t size = (size_t(0) + ... + detail::DeferredArg<std::decay_t<Args>>::Size(args));
+        if (size > maxDeferredSize_) {
+            return false;
+        }
+        char* p = reserveDeferred(level, lowestLevel, dest, timeUS, deferredFormat, size);
+        if (p) {
+            ((p = detail::DeferredArg<std::decay_t<Args>>::Encode(p, args)), ...);
+            commitDeferred();
+        }
+        if (level == LogLevelFatal) {
+            Flush(); // the process is going to exit
+        }
+        return true;
+    }
+
+    // returns where to write the arguments, nullptr if the log is dropped
+    char* reserveDeferred(LogLevel level, LogLevel lowestLevel, LogDest dest, int64_t timeUS, const detail::DeferredFormat* format, size_t size);
+    void commitDeferred();
+#endif
+
 private:
     const std::string logDir_;
     const std::string logPathPrefix_;
     const uint64_t logFileMaxSize_;
     const uint32_t controlFlags_;
+    const bool logThrough_;
     const bool multiThreaded_;
+    const bool deferred_;
+    const bool binary_;
+    const bool mmap_;
+    uint64_t mmapChunkSize_{0}; // size mapped and preallocated at a time
+    const bool kvLogfmt_;
+    size_t maxDeferredSize_{0}; // logs with larger arguments are formatted eagerly
 
     std::mutex lock_; // protects cout
 
     std::atomic<LogLevel> logLevel_;
     std::atomic<LogDest> logDest_;
-    std::unique_ptr<Impl> loggers_[LogLevelCount];
+#ifndef _WIN32
+    std::unique_ptr<Compressor> compressor_;
+    std::unique_ptr<SegmentPreparer> preparer_; // hands rotated logfiles to compressor_, so must be destroyed before it
+#endif
+    std::unique_ptr<Impl> impls_[LogLevelCount];
+    Impl* loggers_[LogLevelCount]; // all point to impls_[0] if ControlFlagSingleFile is set
+    std::unique_ptr<AsyncWriter> async_;
     std::string buf_;
     static thread_local std::string thrBuf_;
+    static thread_local TimeCache thrTimeCache_;
     static constexpr char levelInitials_[LogLevelCount] = {'T', 'I', 'W', 'E', 'F'};
+    static constexpr std::string_view levelNames_[LogLevelCount] = {"TRACE", "INFO", "WARN", "ERROR", "FATAL"};
 };
 
 namespace detail {
 
 extern std::unique_ptr<Logger> gLogger;
 
-}
+/**
+ * LogEveryN lets through the first of every `n` logs of a call site. Thread-safe, but the counting is approximate
+ * when multiple threads hit the same call site at the same time, which keeps it cheap.
+ */
+class LogEveryN {
+public:
+    explicit LogEveryN(uint64_t n)
+        : n_(n ? n : 1)
+    {
+    }
+
+    /**
+     * @param suppressed set to the number of logs suppressed since the last one let through
+     * @return true if the log should be written
+     */
+    bool Allow(uint64_t& suppressed)
+    {
+        const uint64_t left = left_.load(std::memory_order_relaxed);
+        if (left) {
+            left_.store(left - 1, std::memory_order_relaxed);
+            return false;
+        }
+        left_.store(n_ - 1, std::memory_order_relaxed);
+        suppressed = first_.exchange(false, std::memory_order_relaxed) ? 0 : n_ - 1;
+        return true;
+    }
+
+private:
+    const uint64_t n_;
+    std::atomic<uint64_t> left_{0}; // logs to be suppressed before the next one is let through
+    std::atomic<bool> first_{true};
+};
+
+/**
+ * LogRateLimiter lets through at most `maxPerSecond` logs of a call site every second. Thread-safe, but a few more
+ * logs might be let through when multiple threads hit the same call site at the same time.
+ */
+class LogRateLimiter {
+public:
+    explicit LogRateLimiter(uint32_t maxPerSecond)
+        : max_(maxPerSecond)
+    {
+    }
+
+    /**
+     * @param suppressed set to the number of logs suppressed since the last one let through
+     * @return true if the log should be written
+     */
+    bool Allow(uint64_t& suppressed)
+    {
+        // time() reads the clock without locking in vDSO, and it's fine that it isn't monotonic here
+        const time_t second = time(nullptr);
+        if (window_.load(std::memory_order_relaxed) != second) {
+            window_.store(second, std::memory_order_relaxed);
+            count_.store(0, std::memory_order_relaxed);
+        }
+        const uint32_t count = count_.load(std::memory_order_relaxed);
+        if (count >= max_) {
+            suppressed_.store(suppressed_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+        count_.store(count + 1, std::memory_order_relaxed);
+        suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+
+private:
+    const uint32_t max_;
+    std::atomic<time_t> window_{0};
+    std::atomic<uint32_t> count_{0};
+    std::atomic<uint64_t> suppressed_{0};
+};
+
+} // namespace detail
 
 /**
  * Initialize the global Logger object. Should be call once and only once. \n
@@ -324,17 +988,54 @@ inline void SetGlobalLoggerLogDest(Logger::LogDest dest)
 
 #if defined(_WIN64) || defined(_WIN32)
 #define LOGGER_WRITE(level_, fmt_, ...) ant::detail::gLogger->Log(level_, FMT_STRING("{}:{}] " fmt_), strrchr("\\" __FILE__, '\\') + 1, __LINE__, ##__VA_ARGS__)
+#define LOGGER_WRITE_KV(level_, msg_, ...) \
+    ant::detail::gLogger->LogKV(level_, msg_, "src", ant::detail::SourceLocation{strrchr("\\" __FILE__, '\\') + 1, __LINE__}, ##__VA_ARGS__)
 #else
 #define LOGGER_WRITE(level_, fmt_, ...) ant::detail::gLogger->Log(level_, FMT_STRING("{}:{}] " fmt_), strrchr("/" __FILE__, '/') + 1, __LINE__, ##__VA_ARGS__)
+#define LOGGER_WRITE_KV(level_, msg_, ...) \
+    ant::detail::gLogger->LogKV(level_, msg_, "src", ant::detail::SourceLocation{strrchr("/" __FILE__, '/') + 1, __LINE__}, ##__VA_ARGS__)
 #endif
 
+// Writes a log if `limiterType_(limiterArg_)`, a static object of the call site, lets it through, appending the number of
+// logs suppressed before. Logs of disabled levels are neither written nor counted.
+#define LOGGER_WRITE_LIMITED(level_, limiterType_, limiterArg_, fmt_, ...)                                        \
+    do {                                                                                                          \
+        if (ant::detail::gLogger->IsEnabled(level_)) {                                                            \
+            static limiterType_ antLogLimiter_(limiterArg_);                                                      \
+            uint64_t antLogSuppressed_ = 0;                                                                       \
+            if (antLogLimiter_.Allow(antLogSuppressed_)) {                                                        \
+                if (antLogSuppressed_) {                                                                          \
+                    LOGGER_WRITE(level_, fmt_ " [{} similar logs suppressed]", ##__VA_ARGS__, antLogSuppressed_); \
+                } else {                                                                                          \
+                    LOGGER_WRITE(level_, fmt_, ##__VA_ARGS__);                                                    \
+                }                                                                                                 \
+            }                                                                                                     \
+        }                                                                                                         \
+    } while (false)
+
 #ifndef DISABLE_LOG_TRACE
 /**
  * Writes trace level log. Could be disable at compile time by defining DISABLE_LOG_TRACE
  */
 #define LOG_TRACE(fmt_, ...) LOGGER_WRITE(ant::Logger::LogLevelTrace, fmt_, ##__VA_ARGS__)
+/**
+ * Writes trace level log at most `maxPerSecond_` times a second from the call site.
+ */
+#define LOG_TRACE_RATE_LIMITED(maxPerSecond_, fmt_, ...) \
+    LOGGER_WRITE_LIMITED(ant::Logger::LogLevelTrace, ant::detail::LogRateLimiter, maxPerSecond_, fmt_, ##__VA_ARGS__)
+/**
+ * Writes the first of every `n_` trace level logs from the call site.
+ */
+#define LOG_TRACE_EVERY_N(n_, fmt_, ...) LOGGER_WRITE_LIMITED(ant::Logger::LogLevelTrace, ant::detail::LogEveryN, n_, fmt_, ##__VA_ARGS__)
+/**
+ * Writes trace level structured log with the source location, eg: LOG_TRACE_KV("login", "uid", 12321)
+ */
+#define LOG_TRACE_KV(msg_, ...) LOGGER_WRITE_KV(ant::Logger::LogLevelTrace, msg_, ##__VA_ARGS__)
 #else
 #define LOG_TRACE(...)
+#define LOG_TRACE_RATE_LIMITED(...)
+#define LOG_TRACE_EVERY_N(...)
+#define LOG_TRACE_KV(...)
 #endif
 
 #ifndef DISABLE_LOG_INFO
@@ -342,8 +1043,24 @@ inline void SetGlobalLoggerLogDest(Logger::LogDest dest)
  * Writes info level log. Could be disable at compile time by defining DISABLE_LOG_INFO
  */
 #define LOG_INFO(fmt_, ...) LOGGER_WRITE(ant::Logger::LogLevelInfo, fmt_, ##__VA_ARGS__)
+/**
+ * Writes info level log at most `maxPerSecond_` times a second from the call site.
+ */
+#define LOG_INFO_RATE_LIMITED(maxPerSecond_, fmt_, ...) \
+    LOGGER_WRITE_LIMITED(ant::Logger::LogLevelInfo, ant::detail::LogRateLimiter, maxPerSecond_, fmt_, ##__VA_ARGS__)
+/**
+ * Writes the first of every `n_` info level logs from the call site.
+ */
+#define LOG_INFO_EVERY_N(n_, fmt_, ...) LOGGER_WRITE_LIMITED(ant::Logger::LogLevelInfo, ant::detail::LogEveryN, n_, fmt_, ##__VA_ARGS__)
+/**
+ * Writes info level structured log with the source location, eg: LOG_INFO_KV("login", "uid", 12321)
+ */
+#define LOG_INFO_KV(msg_, ...) LOGGER_WRITE_KV(ant::Logger::LogLevelInfo, msg_, ##__VA_ARGS__)
 #else
 #define LOG_INFO(...)
+#define LOG_INFO_RATE_LIMITED(...)
+#define LOG_INFO_EVERY_N(...)
+#define LOG_INFO_KV(...)
 #endif
 
 #ifndef DISABLE_LOG_WARN
@@ -351,8 +1068,24 @@ inline void SetGlobalLoggerLogDest(Logger::LogDest dest)
  * Writes warn level log. Could be disable at compile time by defining DISABLE_LOG_WARN
  */
 #define LOG_WARN(fmt_, ...) LOGGER_WRITE(ant::Logger::LogLevelWarn, fmt_, ##__VA_ARGS__)
+/**
+ * Writes warn level log at most `maxPerSecond_` times a second from the call site.
+ */
+#define LOG_WARN_RATE_LIMITED(maxPerSecond_, fmt_, ...) \
+    LOGGER_WRITE_LIMITED(ant::Logger::LogLevelWarn, ant::detail::LogRateLimiter, maxPerSecond_, fmt_, ##__VA_ARGS__)
+/**
+ * Writes the first of every `n_` warn level logs from the call site.
+ */
+#define LOG_WARN_EVERY_N(n_, fmt_, ...) LOGGER_WRITE_LIMITED(ant::Logger::LogLevelWarn, ant::detail::LogEveryN, n_, fmt_, ##__VA_ARGS__)
+/**
+ * Writes warn level structured log with the source location, eg: LOG_WARN_KV("login", "uid", 12321)
+ */
+#define LOG_WARN_KV(msg_, ...) LOGGER_WRITE_KV(ant::Logger::LogLevelWarn, msg_, ##__VA_ARGS__)
 #else
 #define LOG_WARN(...)
+#define LOG_WARN_RATE_LIMITED(...)
+#define LOG_WARN_EVERY_N(...)
+#define LOG_WARN_KV(...)
 #endif
 
 #ifndef DISABLE_LOG_ERROR
@@ -360,8 +1093,24 @@ inline void SetGlobalLoggerLogDest(Logger::LogDest dest)
  * Writes error level log. Could be disable at compile time by defining DISABLE_LOG_ERROR
  */
 #define LOG_ERROR(fmt_, ...) LOGGER_WRITE(ant::Logger::LogLevelError, fmt_, ##__VA_ARGS__)
+/**
+ * Writes error level log at most `maxPerSecond_` times a second from the call site.
+ */
+#define LOG_ERROR_RATE_LIMITED(maxPerSecond_, fmt_, ...) \
+    LOGGER_WRITE_LIMITED(ant::Logger::LogLevelError, ant::detail::LogRateLimiter, maxPerSecond_, fmt_, ##__VA_ARGS__)
+/**
+ * Writes the first of every `n_` error level logs from the call site.
+ */
+#define LOG_ERROR_EVERY_N(n_, fmt_, ...) LOGGER_WRITE_LIMITED(ant::Logger::LogLevelError, ant::detail::LogEveryN, n_, fmt_, ##__VA_ARGS__)
+/**
+ * Writes error level structured log with the source location, eg: LOG_ERROR_KV("login", "uid", 12321)
+ */
+#define LOG_ERROR_KV(msg_, ...) LOGGER_WRITE_KV(ant::Logger::LogLevelError, msg_, ##__VA_ARGS__)
 #else
 #define LOG_ERROR(...)
+#define LOG_ERROR_RATE_LIMITED(...)
+#define LOG_ERROR_EVERY_N(...)
+#define LOG_ERROR_KV(...)
 #endif
 
 /**
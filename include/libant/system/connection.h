@@ -0,0 +1,211 @@
+/*
+*
+* LibAnt - A handy C++ library
+* Copyright (C) 2022 Antigloss Huang (https://github.com/antigloss) All rights reserved.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+
+#ifndef LIBANT_INCLUDE_LIBANT_SYSTEM_CONNECTION_H_
+#define LIBANT_INCLUDE_LIBANT_SYSTEM_CONNECTION_H_
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+
+#include <libant/buffer_pool/buffer_pool.h>
+#include <libant/system/epoll.h>
+#include <libant/utils/noncopyable.h>
+
+namespace ant {
+
+/**
+ * Connection is a buffered non-blocking stream socket driven by an EventPoll object.
+ * It reads until EAGAIN within a per-iteration budget (the rest is rescheduled via EventPoll::ReportAgainIn),
+ * queues outgoing data in pooled buffers, flushes them with a gathered sendmsg, and turns EventOut on only while
+ * there is pending output. \n
+ *
+ * Callbacks are invoked from EventPoll::Dispatch(). A Connection must not be destroyed inside its own callbacks,
+ * except for the close callback, which is always the last one to be invoked.
+ */
+class Connection {
+public:
+    using StringBufferPool = BufferPool<std::string, std::string::size_type, &std::string::capacity, &std::string::clear>;
+
+    /**
+     * Called with all the received but not yet consumed data. Consumed bytes should be erased from `input`,
+     * the rest are kept and passed in again along with the data received later.
+     */
+    using MessageCallback = std::function<void(Connection& conn, std::string& input)>;
+    /**
+     * Called when the connection is closed by the peer (err == 0) or an error occurs (err is the errno).
+     * The fd is already removed from the EventPoll and closed.
+     */
+    using CloseCallback = std::function<void(Connection& conn, int err)>;
+    using WatermarkCallback = std::function<void(Connection& conn)>;
+
+public:
+    /**
+     * Construct a Connection object. Call Start() to begin receiving data.
+     *
+     * @param poll EventPoll object to drive the connection
+     * @param fd a connected non-blocking stream socket, which is owned by the Connection object from now on
+     * @param pool pool to acquire input/output buffers from, could be shared by many connections of the same thread
+     */
+    Connection(EventPoll& poll, int fd, const StringBufferPool::PoolPtr& pool);
+
+    /**
+     * Close the fd if it's not yet closed. No callback is invoked. The EventPoll object must outlive the Connection.
+     */
+    ~Connection()
+    {
+        Close();
+    }
+
+    NONCOPYABLE(Connection);
+
+    void SetMessageCallback(MessageCallback cb)
+    {
+        onMessage_ = std::move(cb);
+    }
+
+    void SetCloseCallback(CloseCallback cb)
+    {
+        onClose_ = std::move(cb);
+    }
+
+    /**
+     * `onHigh` is called when pending output grows beyond `highWatermark` bytes, eg: to stop reading from the data source.
+     * `onLow` is called when pending output drains to `lowWatermark` bytes or less after `onHigh` was called.
+     *
+     * @param highWatermark
+     * @param lowWatermark
+     * @param onHigh
+     * @param onLow
+     */
+    void SetWatermarks(size_t highWatermark, size_t lowWatermark, WatermarkCallback onHigh, WatermarkCallback onLow)
+    {
+        highWatermark_ = highWatermark;
+        lowWatermark_ = lowWatermark;
+        onHighWatermark_ = std::move(onHigh);
+        onLowWatermark_ = std::move(onLow);
+    }
+
+    /**
+     * Limits bytes read from the socket per event loop iteration, so that a busy connection won't starve the others. 0 means unlimited.
+     *
+     * @param bytes
+     */
+    void SetReadBudget(size_t bytes)
+    {
+        readBudget_ = bytes;
+    }
+
+    /**
+     * Add the connection to the EventPoll object. Output queued by Send() before Start() is sent once the fd is writable,
+     * and if Send() failed before Start(), the close callback is invoked in the next event loop iteration.
+     */
+    void Start();
+
+    /**
+     * Send `len` bytes of `data`. Data that can't be sent immediately is copied into the output queue.
+     *
+     * @param data
+     * @param len
+     * @return false if the connection is closed or broken, true otherwise.
+     */
+    bool Send(const void* data, size_t len);
+
+    /**
+     * Send the whole `buf` without copying it. `buf` is released once it's sent.
+     *
+     * @param buf
+     * @return false if the connection is closed or broken, true otherwise.
+     */
+    bool Send(StringBufferPool::BufferPtr buf);
+
+    /**
+     * Remove the fd from the EventPoll object and close it. Pending output is discarded, and no callback is invoked.
+     */
+    void Close();
+
+    int FD() const
+    {
+        return fd_;
+    }
+
+    bool Closed() const
+    {
+        return fd_ == -1;
+    }
+
+    /**
+     * PendingOutputBytes returns number of bytes queued but not yet sent.
+     *
+     * @return number of bytes queued but not yet sent
+     */
+    size_t PendingOutputBytes() const
+    {
+        return pendingBytes_;
+    }
+
+private:
+    struct OutputChunk {
+        StringBufferPool::BufferPtr buf;
+        size_t offset;
+    };
+
+    void onReadable(int fd);
+    void onWritable(int fd);
+    // send as much queued output as possible, returns 0 on success, errno on failure
+    int flush();
+    void enqueue(const char* data, size_t len);
+    void watchOut();
+    void setPendingError(int err);
+    void checkWatermarks();
+    void closeByPeer(int err);
+
+private:
+    static constexpr size_t kReadSize = 16 * 1024;
+    static constexpr size_t kMinReadHint = 512;
+    // small writes are merged into the last chunk up to this size
+    static constexpr size_t kMaxMergedChunkSize = 64 * 1024;
+
+    EventPoll& poll_;
+    int fd_;
+    StringBufferPool::PoolPtr pool_;
+    StringBufferPool::BufferPtr input_;
+    std::deque<OutputChunk> output_;
+    size_t pendingBytes_{0};
+    size_t readBudget_{256 * 1024};
+    size_t readHint_{kMinReadHint}; // bytes read into the input buffer directly, adapted to the recent reads
+    size_t highWatermark_{SIZE_MAX};
+    size_t lowWatermark_{0};
+    bool started_{false};
+    bool aboveHighWatermark_{false};
+    bool watchingOut_{false};
+    int pendingErr_{0}; // error occurred inside Send(), reported via the close callback later
+
+    MessageCallback onMessage_;
+    CloseCallback onClose_;
+    WatermarkCallback onHighWatermark_;
+    WatermarkCallback onLowWatermark_;
+};
+
+} // namespace ant
+
+#endif //LIBANT_INCLUDE_LIBANT_SYSTEM_CONNECTION_H_
@@ -23,17 +23,75 @@
 
 #include <cassert>
 #include <cerrno>
+#include <cstdint>
 #include <cstring>
 
 #include <queue>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 #include <sys/epoll.h>
 
+#include <libant/timer/timer.h>
+
 namespace ant {
 
+class IoUring;
+
+/**
+ * EventPollStats is a snapshot of the statistics collected by an EventPoll object, see EventPoll::EnableStats().
+ */
+struct EventPollStats {
+    static constexpr int kHistogramBuckets = 32;
+
+    /**
+     * Callback kinds reported by slow callback records.
+     */
+    enum CallbackKind {
+        CallbackIn,
+        CallbackOut,
+        CallbackAgainIn, // EventIn redispatched due to ReportAgainIn()
+        CallbackTimers,  // all the timers fired in one iteration
+        CallbackPlugin,
+    };
+
+    struct SlowCallback {
+        int fd; // -1 for CallbackTimers and CallbackPlugin
+        CallbackKind kind;
+        uint64_t elapsedUS;
+        time_t timeMS; // EventPoll::NowMS() when the callback is invoked
+    };
+
+    uint64_t iterations;
+    // busyHistogram[i] counts iterations spending [2^(i-1), 2^i) microseconds (busyHistogram[0] for < 1us) processing events after wakeup
+    uint64_t busyHistogram[kHistogramBuckets];
+    uint64_t maxBusyUS;
+    uint64_t totalBusyUS;
+    // eventsHistogram[i] counts wakeups returning [2^(i-1), 2^i) events (eventsHistogram[0] for 0 event)
+    uint64_t eventsHistogram[kHistogramBuckets];
+    uint64_t totalEvents;
+    uint64_t redispatchUS; // time spent redispatching events reported by ReportAgainIn()
+    uint64_t timersUS;     // time spent firing timers
+    uint64_t slowCallbacks;
+    // the most recent slow callbacks, oldest first
+    std::vector<SlowCallback> recentSlowCallbacks;
+};
+
 class EventPoll {
+public:
+    enum EventType {
+        EventIn = EPOLLIN,
+        EventOut = EPOLLOUT,
+        EventIO = EventIn | EventOut,
+
+        // internal use only
+        event_err = EPOLLERR,
+        event_hup = EPOLLHUP,
+        event_rdhup = EPOLLRDHUP,
+        event_et = EPOLLET
+    };
+
 private:
     // forbid copy and assignment
     EventPoll(const EventPoll&) = delete;
@@ -360,30 +418,49 @@ private:
         EventHandler()
         {
             in_use = false;
+            dirty = false;
+            uring_tag = 0;
         }
 
     public:
         bool in_use;
         bool use_et;
+        // true if it's queued in m_dirty_hdlrs
+        bool dirty;
+        // carried in the low bits of the user_data of the current io_uring poll request, so that CQEs of the requests it
+        // replaced are told apart and ignored
+        uint8_t uring_tag;
+        int fd;
+        // events requested by Add/Modify
+        EventType ev_type;
+        // events currently registered to the kernel
+        EventType registered_ev_type;
         CallbackBase* in;
         CallbackBase* out;
     };
 
 public:
-    enum EventType {
-        EventIn = EPOLLIN,
-        EventOut = EPOLLOUT,
-        EventIO = EventIn | EventOut,
-
-        // internal use only
-        event_err = EPOLLERR,
-        event_hup = EPOLLHUP,
-        event_rdhup = EPOLLRDHUP,
-        event_et = EPOLLET
+    /**
+     * Backend used to wait for events.
+     */
+    enum Backend {
+        BackendEpoll,
+        // Multishot poll requests through io_uring (Linux 5.13+). Falls back to BackendEpoll if io_uring is unavailable.
+        // Level-triggered fds are polled with IORING_POLL_ADD_LEVEL if the kernel supports it (Linux 5.19+), or with oneshot
+        // poll requests re-armed after each event otherwise.
+        // Add/Modify/Remove are queued and submitted altogether with the next wait, so they cost no syscall of their own.
+        BackendIoUring,
     };
 
 public:
-    EventPoll(int maxfd = 20000, int timeout = -1);
+    /**
+     * Construct an EventPoll object.
+     *
+     * @param maxfd only a hint, the fd table grows on demand in chunks of kHandlerChunkSize
+     * @param timeout timeout (in millisecond) for epoll_wait, -1 means wait until an event or a timer arrives
+     * @param backend
+     */
+    EventPoll(int maxfd = 20000, int timeout = -1, Backend backend = BackendEpoll);
     ~EventPoll();
 
     void AddPlugin(void (*plugin)())
@@ -512,20 +589,29 @@ public:
         add_event(fd, ev_type, in, out, use_et);
     }
 
+    /**
+     * Modify the events watched for `fd`. The change is applied right before the next wait, and changes
+     * that end up with the registered events (eg. EventOut toggled on and off within one iteration) cost no syscall at all.
+     * Hence Modify() can't be used to re-trigger readiness of an edge-triggered fd, use ReportAgainIn() instead.
+     * A failure to apply the change is reported by Dispatch() with std::runtime_error.
+     */
     void Modify(int fd, EventType ev_type)
     {
-        assert((fd < m_maxfd) && (fd > -1) && m_ev_hdlrs[fd].in_use);
+        assert(has_handler(fd) && get_handler(fd)->in_use);
 
-        if (epoll_control(EPOLL_CTL_MOD, fd, ev_type, m_ev_hdlrs[fd].use_et) == -1) {
-            throw std::runtime_error(std::string("epoll_ctl (EPOLL_CTL_MOD) failed: ") + strerror(errno));
+        EventHandler* evhdlr = get_handler(fd);
+        evhdlr->ev_type = ev_type;
+        if (!evhdlr->dirty && ev_type != evhdlr->registered_ev_type) {
+            evhdlr->dirty = true;
+            m_dirty_hdlrs.push_back(evhdlr);
         }
     }
 
     void Remove(int fd)
     {
-        assert((fd < m_maxfd) && (fd > -1) && m_ev_hdlrs[fd].in_use);
+        assert(has_handler(fd) && get_handler(fd)->in_use);
 
-        EventHandler* evhdlr = &m_ev_hdlrs[fd];
+        EventHandler* evhdlr = get_handler(fd);
         evhdlr->in_use = false;
         delete evhdlr->in;
         delete evhdlr->out;
@@ -536,38 +622,136 @@ public:
 
     void ReportAgainIn(int fd)
     {
-        assert((fd < m_maxfd) && (fd > -1) && m_ev_hdlrs[fd].in_use);
+        assert(has_handler(fd) && get_handler(fd)->in_use);
+
+        m_read_evs.push(get_handler(fd));
+    }
+
+    /**
+     * Timers returns the TimerManager driven by Dispatch(). Timers are fired after the ready events of each iteration,
+     * and epoll_wait never sleeps past the earliest timer. Expiring times must be based on NowMS().
+     *
+     * @return the TimerManager owned by this EventPoll
+     */
+    TimerManager& Timers()
+    {
+        return m_timers;
+    }
+
+    /**
+     * NowMS returns milliseconds of a monotonic clock, cached at the beginning of Dispatch() and after each epoll_wait.
+     *
+     * @return cached current time in milliseconds
+     */
+    time_t NowMS() const
+    {
+        return m_now;
+    }
 
-        m_read_evs.push(&m_ev_hdlrs[fd]);
+    /**
+     * GetBackend returns the backend actually in use, which may differ from the requested one if io_uring is unavailable.
+     *
+     * @return backend in use
+     */
+    Backend GetBackend() const
+    {
+        return m_uring ? BackendIoUring : BackendEpoll;
     }
 
+    /**
+     * Start collecting loop statistics. Callbacks taking `slowCallbackThresholdUS` microseconds or longer are recorded.
+     * Costs two clock reads per callback while enabled.
+     *
+     * @param slowCallbackThresholdUS
+     */
+    void EnableStats(uint32_t slowCallbackThresholdUS = 10000);
+
+    /**
+     * Stop collecting loop statistics. Collected statistics are kept.
+     */
+    void DisableStats();
+
+    /**
+     * GetStats returns a snapshot of the loop statistics. Can be called from any thread.
+     *
+     * @return snapshot of the loop statistics
+     */
+    EventPollStats GetStats() const;
+
+    /**
+     * Run the event loop until there is neither a registered fd nor a pending timer.
+     */
     void Dispatch();
 
 private:
+    static constexpr int kHandlerChunkShift = 10;
+    static constexpr int kHandlerChunkSize = 1 << kHandlerChunkShift;
+    static constexpr int kMaxEventsPerWait = 4096;
+    // EventHandlers are aligned to at least 8 bytes, leaving 3 low bits of their addresses for uring_tag
+    static constexpr uint8_t kUringTagMask = 7;
+
+    bool has_handler(int fd) const
+    {
+        return (fd > -1) && (static_cast<size_t>(fd >> kHandlerChunkShift) < m_hdlr_chunks.size());
+    }
+
+    EventHandler* get_handler(int fd) const
+    {
+        return &m_hdlr_chunks[fd >> kHandlerChunkShift][fd & (kHandlerChunkSize - 1)];
+    }
+
     void add_event(int fd, EventType ev_type, CallbackBase* in, CallbackBase* out, bool use_et);
+    // apply the pending modifications queued by Modify()
+    void flush_modifications();
+    // execute the callback, timing it if statistics are enabled
+    void execute(CallbackBase* cb, int fd, EventPollStats::CallbackKind kind);
+    void record_slow_callback(int fd, EventPollStats::CallbackKind kind, uint64_t elapsedUS);
     int epoll_control(int op, int fd, EventType ev_type, bool use_et);
+    // queue poll requests equivalent to epoll_ctl into the io_uring SQ, they are submitted altogether before waiting
+    int uring_control(int op, int fd, EventType ev_type, bool use_et);
+    // user_data of the current io_uring poll request of `evhdlr`
+    static uint64_t uring_user_data(const EventHandler* evhdlr)
+    {
+        return reinterpret_cast<uint64_t>(evhdlr) | evhdlr->uring_tag;
+    }
+    // wait for events, returns number of events filled into m_avail_evs, or -1 on failure
+    int wait_events(int timeout);
+    int uring_wait_events(int timeout);
     // dispatch all the ready events reported by epoll
     void dispatch_ready_events(int ev_num);
     // redispatch all the ready but not yet finish processing 'EventIn' events
     void redispatch_in_events();
+    // timeout for epoll_wait, shortened to the earliest timer if there is any
+    int wait_timeout() const;
+    void update_now();
 
 private:
     /*! epoll fd */
     int m_epfd;
+    /*! io_uring used instead of epoll if not null */
+    IoUring* m_uring;
+    /*! true if the kernel supports level-triggered multishot poll requests */
+    bool m_uring_level;
     /*! timeout (in millisecond) for epoll_wait */
     int m_timeout;
     /*! number of events added to epoll */
     int m_ev_num;
-    /*! maximum fd */
-    int m_maxfd;
-    /*! hold callbacks of each fd (up to m_maxfd elements) */
-    EventHandler* m_ev_hdlrs;
-    /*! contains the available events */
+    /*! hold callbacks of each fd, chunks are allocated on demand and never move */
+    std::vector<EventHandler*> m_hdlr_chunks;
+    /*! handlers modified since the last wait */
+    std::vector<EventHandler*> m_dirty_hdlrs;
+    /*! contains the available events (up to kMaxEventsPerWait elements) */
     epoll_event* m_avail_evs;
     /*! contains events to report again for reading */
     std::queue<EventHandler*> m_read_evs;
     /*! extra user code */
     CallbackBase* m_plugin;
+    /*! timers driven by Dispatch() */
+    TimerManager m_timers;
+    /*! cached current time (in millisecond) of a monotonic clock */
+    time_t m_now;
+    /*! loop statistics, allocated along with the EventPoll so that GetStats() never races with its creation */
+    struct LoopStats* m_stats;
 };
 
 } // namespace ant
@@ -0,0 +1,112 @@
+/*
+*
+* LibAnt - A handy C++ library
+* Copyright (C) 2022 Antigloss Huang (https://github.com/antigloss) All rights reserved.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+
+#ifndef LIBANT_INCLUDE_LIBANT_SYSTEM_IO_URING_H_
+#define LIBANT_INCLUDE_LIBANT_SYSTEM_IO_URING_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include <linux/io_uring.h>
+
+#include <libant/utils/noncopyable.h>
+
+namespace ant {
+
+/**
+ * IoUring is a minimal wrapper of the raw io_uring syscalls, no liburing required.
+ * SQEs acquired by GetSqe() are batched and submitted altogether by the next Submit() or Wait().
+ */
+class IoUring {
+public:
+    IoUring() = default;
+    ~IoUring();
+
+    NONCOPYABLE(IoUring);
+
+    /**
+     * Setup the rings.
+     *
+     * @param entries number of SQ entries, CQ entries are twice as many.
+     * @param requiredFeatures IORING_FEAT_XXX flags that must be supported by the running kernel.
+     * @return true on success, false if io_uring is unavailable or any required feature is unsupported.
+     */
+    bool Init(uint32_t entries, uint32_t requiredFeatures);
+
+    /**
+     * GetSqe returns a zeroed SQE to be filled in. Pending SQEs are submitted first if the SQ is full.
+     *
+     * @return pointer to a free SQE, or nullptr if the SQ is still full after submission.
+     */
+    io_uring_sqe* GetSqe();
+
+    /**
+     * Submit all the pending SQEs without waiting for completions.
+     *
+     * @return number of SQEs submitted on success, -1 on failure with errno set.
+     */
+    int Submit();
+
+    /**
+     * Submit all the pending SQEs and wait until at least one CQE is available or `timeoutMS` elapses.
+     *
+     * @param timeoutMS -1 means wait until a CQE is available.
+     * @return 0 on success or timeout, -1 on failure with errno set.
+     */
+    int Wait(int timeoutMS);
+
+    /**
+     * Copy up to `maxCqes` available CQEs into `cqes` and mark them as seen.
+     *
+     * @param cqes
+     * @param maxCqes
+     * @return number of CQEs copied.
+     */
+    uint32_t PeekCqes(io_uring_cqe* cqes, uint32_t maxCqes);
+
+private:
+    int enter(uint32_t toSubmit, uint32_t minComplete, int timeoutMS);
+    uint32_t pendingSqes() const;
+
+private:
+    int ringFD_{-1};
+    void* sqRing_{nullptr};
+    size_t sqRingSize_{0};
+    void* cqRing_{nullptr};
+    size_t cqRingSize_{0};
+    io_uring_sqe* sqes_{nullptr};
+    size_t sqesSize_{0};
+
+    uint32_t* sqHead_{nullptr};
+    uint32_t* sqTail_{nullptr};
+    uint32_t sqMask_{0};
+    uint32_t sqEntries_{0};
+    uint32_t sqeTail_{0}; // SQEs acquired by GetSqe() but not yet published to the kernel lie in [*sqTail_, sqeTail_)
+
+    uint32_t* cqHead_{nullptr};
+    uint32_t* cqTail_{nullptr};
+    uint32_t cqMask_{0};
+    io_uring_cqe* cqes_{nullptr};
+};
+
+} // namespace ant
+
+#endif //LIBANT_INCLUDE_LIBANT_SYSTEM_IO_URING_H_
@@ -34,6 +34,7 @@ namespace ant {
 /**
  * ThreadPoolEx can run any kind of task, including function, functor, lambda, etc.
  * The only limitation is that the task must return std::shared_ptr<AbsOutput> as it's result.
+ * A task returning nullptr has no output to be got by GetJobOutput().
  */
 class ThreadPoolEx {
 public:
@@ -164,7 +165,11 @@ private:
 template<typename Function>
 void ThreadPoolEx::Executor<Function>::Exec(ThreadPoolEx& pool)
 {
-    pool.pushResult(func_());
+    auto result = func_();
+    // tasks run for their side effects only return nullptr, don't pile them up in the output queue
+    if (result) {
+        pool.pushResult(std::move(result));
+    }
 }
 
 class ThreadPoolEx::Worker {
@@ -18,39 +18,194 @@
 *
 */
 
+
 #ifndef LIBANT_INCLUDE_LIBANT_TIMER_TIMER_H_
 #define LIBANT_INCLUDE_LIBANT_TIMER_TIMER_H_
 
+#include <cstdint>
+#include <ctime>
 #include <functional>
-#include <map>
+#include <vector>
+
+#include <libant/utils/noncopyable.h>
 
 namespace ant {
 
+/**
+ * TimerManager is a hierarchical timing wheel driven by Update(). Adding and expiring a timer cost O(1),
+ * and timer nodes are pooled, so no memory is allocated per timer in steady state except by the callback itself. \n
+ *
+ * Time is divided into ticks of `tickMS` milliseconds. A timer fires within one tick after its expiring time, never earlier.
+ * Timers within the same tick fire in the order they are added. Timers added by a callback whose expiring time
+ * has already come fire with the next tick, that is, not within the current Update() if it's already at the last tick. \n
+ *
+ * Every timer is identified by a TimerId, with which it can be cancelled or rescheduled in O(1) until it fires.
+ * A TimerId is never reused, so a stale id is harmless.
+ */
 class TimerManager {
 public:
-    void Update(time_t curTimeMS)
+    using Callback = std::function<void(time_t curTimeMS)>;
+    using TimerId = uint64_t;
+
+    static constexpr TimerId kInvalidTimerId = 0;
+
+public:
+    /**
+     * Construct a TimerManager object.
+     *
+     * @param tickMS resolution of the timers in milliseconds. Must be > 0.
+     */
+    explicit TimerManager(uint32_t tickMS = 1);
+    ~TimerManager();
+
+    NONCOPYABLE(TimerManager);
+
+    /**
+     * Fire all the timers expired at `curTimeMS`.
+     *
+     * @param curTimeMS current time in milliseconds
+     */
+    void Update(time_t curTimeMS);
+
+    /**
+     * Add a timer which fires when Update() is called with a time not less than `expiringTimeMS`.
+     *
+     * @param expiringTimeMS
+     * @param cb
+     * @return id of the timer, never kInvalidTimerId
+     */
+    TimerId AddTimer(time_t expiringTimeMS, Callback cb);
+
+    /**
+     * Cancel a timer. Cancelling a timer which has fired, is firing, or has been cancelled already is a no-op.
+     *
+     * @param id id returned by AddTimer()
+     * @return true if the timer is cancelled, false if there is no such timer pending
+     */
+    bool Cancel(TimerId id);
+
+    /**
+     * Change the expiring time of a pending timer, keeping its callback and id. Cheap enough to be called on every
+     * packet, e.g. to push back an idle timeout.
+     *
+     * @param id id returned by AddTimer()
+     * @param expiringTimeMS new expiring time
+     * @return true on success, false if there is no such timer pending
+     */
+    bool Reschedule(TimerId id, time_t expiringTimeMS);
+
+    /**
+     * Get the time when the earliest timer is due. The time returned might be earlier than the real expiring time
+     * of any timer if all the timers are far away, in which case calling Update() at that time just moves the timers
+     * closer and costs nothing else.
+     *
+     * @param expiringTimeMS set to the time when Update() should be called next on success
+     * @return true on success, false if there is no timer at all
+     */
+    bool NextExpiringTime(time_t& expiringTimeMS) const;
+
+    /**
+     * Size returns number of pending timers.
+     *
+     * @return number of pending timers
+     */
+    size_t Size() const
     {
-        for (auto iter = timers_.begin(); iter != timers_.end(); iter = timers_.erase(iter)) {
-            if (iter->first > curTimeMS) {
-                break;
-            }
-            iter->second(curTimeMS);
-        }
+        return size_;
     }
 
-    void AddTimer(time_t expiringTimeMS, std::function<void(time_t curTimeMS)> cb)
+    /**
+     * Remove all the timers.
+     */
+    void Clear();
+
+private:
+    struct Link {
+        Link* prev;
+        Link* next;
+    };
+
+    struct Node : public Link {
+        int64_t tick;
+        uint32_t index; // position in the pool, the lower half of TimerId
+        uint32_t gen;   // bumped whenever the node is freed, the upper half of TimerId
+        int level;      // level of the wheel the node is in, or kPendingLevel
+        Callback cb;
+    };
+
+    static constexpr int kLevels = 5;
+    static constexpr int kRootBits = 10;
+    static constexpr int kLevelBits = 6;
+    static constexpr int kRootSlots = 1 << kRootBits;
+    static constexpr int kLevelSlots = 1 << kLevelBits;
+    static constexpr int kNodesPerBlock = 1024; // must be power of 2
+    static constexpr int kPendingLevel = -1;
+
+    static int levelShift(int level)
     {
-        timers_.emplace(std::make_pair(expiringTimeMS, std::move(cb)));
+        return level ? kRootBits + (level - 1) * kLevelBits : 0;
     }
 
-    void Clear()
+    static int levelSlots(int level)
     {
-        timers_.clear();
+        return level ? kLevelSlots : kRootSlots;
     }
 
-public:
-    // <ExpiringTime, Callback>
-    std::multimap<time_t, std::function<void(time_t curTimeMS)>> timers_;
+    static void initList(Link* head)
+    {
+        head->prev = head;
+        head->next = head;
+    }
+
+    static void pushBack(Link* head, Link* link)
+    {
+        link->prev = head->prev;
+        link->next = head;
+        head->prev->next = link;
+        head->prev = link;
+    }
+
+    static void unlink(Link* link)
+    {
+        link->prev->next = link->next;
+        link->next->prev = link->prev;
+    }
+
+    Link* slot(int level, int idx)
+    {
+        return &slots_[level ? kRootSlots + (level - 1) * kLevelSlots + idx : idx];
+    }
+
+    const Link* slot(int level, int idx) const
+    {
+        return &slots_[level ? kRootSlots + (level - 1) * kLevelSlots + idx : idx];
+    }
+
+    Node* allocNode();
+    void freeNode(Node* node);
+    // find the pending timer identified by `id`, nullptr if not found
+    Node* findNode(TimerId id) const;
+    // take `node` out of wheel or pending_ without freeing it
+    void detach(Node* node);
+    // put `node` into the wheel according to its tick
+    void place(Node* node);
+    // move the timers of a slot in `level` to lower levels, returns index of the slot
+    int cascade(int level);
+    void clearList(Link* head);
+
+private:
+    const uint32_t tickMS_;
+    bool started_{false};
+    int64_t curTick_{0}; // next tick to be processed
+    size_t size_{0};
+    size_t levelSize_[kLevels]{};
+
+    Link slots_[kRootSlots + (kLevels - 1) * kLevelSlots];
+    Link pending_; // timers added before the first Update(), when the current tick is still unknown
+    Link firing_;  // timers detached from the wheel and being fired
+
+    std::vector<Node*> blocks_;
+    Node* freeNodes_{nullptr}; // singly linked via Link::next
 };
 
 } // namespace ant
@@ -0,0 +1,203 @@
+/*
+*
+* LibAnt - A handy C++ library
+* Copyright (C) 2022 Antigloss Huang (https://github.com/antigloss) All rights reserved.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+
+#ifndef LIBANT_INCLUDE_LIBANT_TIMER_TIMER_SERVICE_H_
+#define LIBANT_INCLUDE_LIBANT_TIMER_TIMER_SERVICE_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <libant/thread/thread_pool_ex.h>
+#include <libant/timer/timer.h>
+#include <libant/utils/noncopyable.h>
+
+namespace ant {
+
+/**
+ * TimerService is a TimerManager shared by many threads. It runs a dedicated timer thread which sleeps until the
+ * earliest deadline and fires the timers, so that no thread has to sleep or call Update() by itself. \n
+ *
+ * Each thread scheduling into a TimerService gets its own single-producer queue. AddTimer(), Cancel() and Reschedule()
+ * only push a command into that queue without taking any lock, and the timer thread merges all the queues into its
+ * TimerManager. The timer thread is woken up only if a new deadline is earlier than the one it is sleeping for. \n
+ *
+ * Callbacks are called on the timer thread by default, where they should finish quickly. Pass an Executor to run them
+ * somewhere else, e.g. OnThreadPool() to run them on a ThreadPoolEx, or an executor posting them back to the thread
+ * owning the reactor.
+ */
+class TimerService {
+public:
+    using Callback = TimerManager::Callback;
+    using TimerId = uint64_t;
+    /**
+     * An Executor takes over a due callback together with the time it fires at, and arranges for it to be called.
+     */
+    using Executor = std::function<void(Callback&& cb, time_t curTimeMS)>;
+
+    static constexpr TimerId kInvalidTimerId = 0;
+
+public:
+    /**
+     * Construct a TimerService object and start the timer thread.
+     *
+     * @param executor where callbacks are called, nullptr means calling them on the timer thread
+     * @param tickMS resolution of the timers in milliseconds
+     */
+    explicit TimerService(Executor executor = nullptr, uint32_t tickMS = 1);
+    ~TimerService();
+
+    NONCOPYABLE(TimerService);
+
+    /**
+     * Get current time in milliseconds of the monotonic clock used by TimerService.
+     *
+     * @return current time in milliseconds
+     */
+    static time_t NowMS();
+
+    /**
+     * Make an executor which runs callbacks on `pool`. The pool must outlive the TimerService.
+     *
+     * @param pool
+     * @return an executor for TimerService
+     */
+    static Executor OnThreadPool(ThreadPoolEx& pool);
+
+    /**
+     * Add a timer which fires when NowMS() reaches `expiringTimeMS`. Can be called from any thread,
+     * including the callbacks.
+     *
+     * @param expiringTimeMS
+     * @param cb
+     * @return id of the timer, kInvalidTimerId if the TimerService is stopped
+     */
+    TimerId AddTimer(time_t expiringTimeMS, Callback cb);
+
+    /**
+     * Cancel a timer asynchronously. It's guaranteed not to fire if it hasn't been handed over to the executor
+     * when the timer thread processes the cancellation, which is always before any timer due later than now.
+     * Can be called from any thread, with an id added by any thread.
+     *
+     * @param id id returned by AddTimer()
+     */
+    void Cancel(TimerId id);
+
+    /**
+     * Change the expiring time of a timer asynchronously. Same as Cancel(), it's a no-op if the timer has fired.
+     * Can be called from any thread, with an id added by any thread.
+     *
+     * @param id id returned by AddTimer()
+     * @param expiringTimeMS new expiring time
+     */
+    void Reschedule(TimerId id, time_t expiringTimeMS);
+
+    /**
+     * Stop the timer thread. Timers not yet fired are discarded, and AddTimer(), Cancel() and Reschedule() are ignored
+     * from now on. Mustn't be called by a callback running on the timer thread.
+     */
+    void Stop();
+
+private:
+    enum CommandType {
+        CommandAdd,
+        CommandCancel,
+        CommandReschedule,
+    };
+
+    struct Command {
+        CommandType type;
+        TimerId id;
+        time_t timeMS;
+        Callback cb;
+    };
+
+    // Single-producer single-consumer queue of commands. Commands which don't fit into the ring spill into `overflow`,
+    // and the producer keeps spilling until the consumer takes them, so that commands are consumed in order.
+    struct SubmitQueue {
+        static constexpr size_t kCapacity = 1024; // must be power of 2
+
+        alignas(64) std::atomic<size_t> head{0}; // written by the timer thread only
+        alignas(64) std::atomic<size_t> tail{0}; // written by the producer only
+        std::atomic<uint64_t> addedSeq{0};       // sequence number of the last timer added, written by the producer only
+        uint64_t mergedSeq{0};                   // sequence number of the last timer merged, timer thread only
+        uint32_t index;
+        std::thread::id owner;
+
+        std::mutex overflowLock;
+        std::atomic<bool> spilled{false};
+        std::vector<Command> overflow;
+
+        Command ring[kCapacity];
+    };
+
+    struct EarlyCommand {
+        bool cancelled;
+        time_t timeMS;
+    };
+
+    static constexpr int kIndexShift = 48;
+
+    SubmitQueue* localQueue();
+    // push a command into the queue of the calling thread, wakes up the timer thread if necessary
+    void submit(Command&& cmd);
+    void run();
+    // move all the submitted commands into the TimerManager
+    void drainQueues();
+    void apply(SubmitQueue& q, Command& cmd);
+    // pass a due callback to the executor
+    void fire(Callback&& cb, time_t curTimeMS);
+    void refreshQueues();
+    bool hasCommands();
+
+private:
+    const uint64_t serviceId_; // distinguishes TimerService objects in the thread-local cache of queues
+    Executor executor_;
+    TimerManager mgr_;                                        // timer thread only
+    std::unordered_map<TimerId, TimerManager::TimerId> ids_;  // timers in mgr_, timer thread only
+    std::unordered_map<TimerId, EarlyCommand> earlyCommands_; // commands arrived ahead of their timers, timer thread only
+    std::atomic<bool> stopped_{false};                        // commands are ignored once set
+
+    std::mutex queuesLock_; // protects queues_
+    std::vector<std::unique_ptr<SubmitQueue>> queues_;
+    std::atomic<size_t> queueNum_{0};
+    std::vector<SubmitQueue*> merging_; // snapshot of queues_, timer thread only
+
+    // deadline the timer thread is sleeping for, kAwake if it's running
+    std::atomic<time_t> sleepUntil_;
+    std::mutex sleepLock_; // protects the following variables
+    std::condition_variable sleepCond_;
+    bool wakeup_{false};
+    bool stop_{false};
+
+    std::thread thr_;
+};
+
+} // namespace ant
+
+#endif //LIBANT_INCLUDE_LIBANT_TIMER_TIMER_SERVICE_H_
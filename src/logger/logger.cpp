@@ -1,22 +1,524 @@
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <filesystem>
+#include <fstream>
+#include <thread>
 
 #ifndef _WIN32
+#include <climits>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <utime.h>
+#ifdef LIBANT_WITH_ZLIB
+#include <zlib.h>
+#endif
 #endif
 
+#include <libant/logger/fmt/args.h>
 #include <libant/logger/logger.h>
+#ifndef _WIN32
+#include <libant/system/signal.h>
+#endif
 
 using namespace std;
 
 namespace ant {
 
 thread_local std::string Logger::thrBuf_;
+thread_local Logger::TimeCache Logger::thrTimeCache_;
+
+static const string sLogLevelNames[Logger::LogLevelCount] = {"TRACE", "INFO", "WARN", "ERROR", "FATAL"};
 
 namespace detail {
 
 std::unique_ptr<Logger> gLogger;
 
+const DeferredFormat* RegisterDeferredFormat(fmt::string_view format)
+{
+    static mutex lock;
+    static deque<DeferredFormat> formats; // never moves the elements
+    lock_guard<mutex> guard(lock);
+    formats.emplace_back();
+    auto& f = formats.back();
+    f.format = format;
+    f.id = static_cast<uint32_t>(formats.size() - 1);
+    // 'F' | id | length | format string
+    const uint32_t len = static_cast<uint32_t>(format.size());
+    f.binaryDef.push_back('F');
+    f.binaryDef.append(reinterpret_cast<const char*>(&f.id), sizeof(f.id));
+    f.binaryDef.append(reinterpret_cast<const char*>(&len), sizeof(len));
+    f.binaryDef.append(format.data(), format.size());
+    return &f;
+}
+
+static constexpr uint64_t kOnes = 0x0101010101010101ULL;
+static constexpr uint64_t kHighBits = 0x8080808080808080ULL;
+
+// nonzero if any byte of `v` is zero
+static inline uint64_t swarHasZero(uint64_t v)
+{
+    return (v - kOnes) & ~v & kHighBits;
+}
+
+// nonzero if any byte of `v` is a control character, '"' or '\\', or ' ' or '=' if `logfmt` is true
+static inline uint64_t swarHasSpecial(uint64_t v, bool logfmt)
+{
+    uint64_t r = ((v - kOnes * 0x20) & ~v & kHighBits) | swarHasZero(v ^ (kOnes * '"')) | swarHasZero(v ^ (kOnes * '\\'));
+    if (logfmt) {
+        r |= swarHasZero(v ^ (kOnes * ' ')) | swarHasZero(v ^ (kOnes * '='));
+    }
+    return r;
+}
+
+static inline bool isSpecial(char c, bool logfmt)
+{
+    return static_cast<unsigned char>(c) < 0x20 || c == '"' || c == '\\' || (logfmt && (c == ' ' || c == '='));
+}
+
+// find the first special character in [p, end), 8 bytes at a time
+static const char* findSpecial(const char* p, const char* end, bool logfmt)
+{
+    for (; end - p >= 8; p += 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        if (swarHasSpecial(v, logfmt)) {
+            break;
+        }
+    }
+    for (; p != end && !isSpecial(*p, logfmt); ++p) {
+    }
+    return p;
+}
+
+void AppendKVString(std::string& buf, std::string_view s, bool logfmt)
+{
+    const char* p = s.data();
+    const char* end = p + s.size();
+    if (logfmt && !s.empty() && findSpecial(p, end, true) == end) {
+        buf.append(s);
+        return;
+    }
+
+    buf.push_back('"');
+    for (;;) {
+        // only '"', '\\' and control characters need escaping inside quotes
+        const char* q = findSpecial(p, end, false);
+        buf.append(p, q);
+        if (q == end) {
+            break;
+        }
+        switch (*q) {
+        case '"':
+            buf.append("\\\"");
+            break;
+        case '\\':
+            buf.append("\\\\");
+            break;
+        case '\n':
+            buf.append("\\n");
+            break;
+        case '\r':
+            buf.append("\\r");
+            break;
+        case '\t':
+            buf.append("\\t");
+            break;
+        default:
+            fmt::format_to(std::back_inserter(buf), "\\u{:04x}", static_cast<unsigned char>(*q));
+        }
+        p = q + 1;
+    }
+    buf.push_back('"');
+}
+
+} // namespace detail
+
+#ifndef _WIN32
+//==========================================================================================
+// Logger::AsyncWriter
+//==========================================================================================
+
+/**
+ * TextArena holds texts which are formatted by the background thread and must stay until they are written.
+ */
+class TextArena {
+public:
+    char* Alloc(size_t size)
+    {
+        if (size > kBlockSize / 4) {
+            large_.emplace_back(new char[size]);
+            return large_.back().get();
+        }
+        if (used_ + size > kBlockSize) {
+            if (++cur_ == blocks_.size()) {
+                blocks_.emplace_back(new char[kBlockSize]);
+            }
+            used_ = 0;
+        }
+        char* p = blocks_[cur_].get() + used_;
+        used_ += size;
+        return p;
+    }
+
+    // free everything, the blocks are kept for reuse
+    void Reset()
+    {
+        cur_ = static_cast<size_t>(-1);
+        used_ = kBlockSize;
+        large_.clear();
+    }
+
+private:
+    static constexpr size_t kBlockSize = 64 * 1024;
+
+    vector<unique_ptr<char[]>> blocks_;
+    vector<unique_ptr<char[]>> large_;
+    size_t cur_{static_cast<size_t>(-1)};
+    size_t used_{kBlockSize};
+};
+
+/**
+ * AsyncWriter passes formatted logs from the logging threads to a background thread through per-thread
+ * single-producer single-consumer ring buffers, and writes them to logfiles in batches.
+ */
+class Logger::AsyncWriter {
+public:
+    AsyncWriter(Logger& logger, const Cfg& cfg);
+    ~AsyncWriter();
+
+    void Submit(LogLevel level, LogLevel lowestLevel, LogDest dest, int64_t timeUS, const string& content);
+    char* Reserve(LogLevel level, LogLevel lowestLevel, LogDest dest, int64_t timeUS, const detail::DeferredFormat* format, size_t size);
+    void Commit();
+    void Flush();
+
+    // arguments of a deferred log must fit in a quarter of the ring
+    size_t MaxDeferredSize() const
+    {
+        return ringCapacity_ / 4 - sizeof(RecordHeader) - sizeof(detail::DeferredFormat*);
+    }
+
+    uint64_t DroppedCount() const
+    {
+        return dropped_.load(memory_order_relaxed);
+    }
+
+private:
+    enum RecordType : uint8_t {
+        RecordInline,   // content follows the header
+        RecordIndirect, // a string* follows the header, for logs too large for the ring
+        RecordDeferred, // a DeferredFormat* and the captured arguments follow the header
+        RecordPadding,  // skip to the beginning of the ring
+    };
+
+    struct RecordHeader {
+        uint32_t size; // size of the whole record, including the header and the padding bytes for alignment
+        uint32_t len;  // length of the content
+        int64_t timeUS;
+        RecordType type;
+        uint8_t level;
+        uint8_t lowestLevel;
+        uint8_t dest;
+    };
+
+    struct Ring {
+        explicit Ring(size_t cap)
+            : buf(new char[cap])
+            , capacity(cap)
+        {
+        }
+
+        alignas(64) atomic<size_t> head{0}; // written by the background thread only
+        alignas(64) atomic<size_t> tail{0}; // written by the producer only
+        size_t reservedTail{0};             // tail after the reserved record is committed, producer only
+        unique_ptr<char[]> buf;
+        const size_t capacity;
+        thread::id owner;
+    };
+
+    static constexpr size_t kAlign = alignof(RecordHeader);
+
+    Ring* localRing();
+    // reserve room for a record in the ring of the calling thread, returns nullptr if dropped
+    RecordHeader* reserve(Ring* ring, LogLevel level, size_t payloadSize);
+    // wake up the background thread if it's sleeping
+    void wakeup();
+    void run();
+    // write all the logs submitted so far
+    void drain();
+    void appendDroppedNotices(const TimeCache& timeCache, uint32_t microSeconds);
+    // format a deferred log into arena_
+    fmt::string_view formatDeferred(const RecordHeader* hdr);
+    // append the record in the binary form
+    void appendBinary(const RecordHeader* hdr, const tm& tmNow, uint32_t microSeconds, const char* content);
+
+private:
+    const uint64_t writerId_; // distinguishes AsyncWriter objects in the thread-local cache of rings
+    Logger& logger_;
+    const OverflowPolicy overflowPolicy_;
+    const size_t ringCapacity_;
+    const chrono::milliseconds flushInterval_;
+
+    atomic<uint64_t> dropped_{0};
+    atomic<uint64_t> droppedSinceNotice_[LogLevelCount]{};
+
+    mutex ringsLock_; // protects rings_
+    vector<unique_ptr<Ring>> rings_;
+    atomic<size_t> ringNum_{0};
+
+    // used by the background thread only
+    vector<Ring*> draining_;
+    vector<size_t> drainTails_;
+    vector<string*> indirects_;
+    vector<string> notices_;
+    vector<iovec> console_;
+    TextArena arena_;
+    fmt::memory_buffer fmtBuf_;
+    fmt::dynamic_format_arg_store<fmt::format_context> fmtArgs_;
+
+    mutex lock_; // protects the following variables
+    condition_variable cond_;
+    condition_variable flushedCond_;
+    atomic<bool> sleeping_{false};
+    bool wakeup_{false};
+    bool stop_{false};
+    uint64_t flushRequested_{0};
+    uint64_t flushed_{0};
+
+    thread thr_;
+};
+
+//==========================================================================================
+// Logger::SegmentPreparer
+//==========================================================================================
+
+/**
+ * SegmentPreparer creates and preallocates the next logfiles in mmap mode on a background thread, so that rotating
+ * a logfile takes only a rename() on the logging thread. It closes the old logfiles and updates the symlinks as well.
+ */
+class Logger::SegmentPreparer {
+public:
+    // rotated logfiles are handed to `compressor` after closed, if it's not nullptr
+    SegmentPreparer(uint64_t preallocSize, Compressor* compressor);
+    ~SegmentPreparer();
+
+    // prepare a logfile at `path` unless there is one already, and point `symlink` to `target` (removed if `target` is empty)
+    void Request(const string& path, const string& symlink, const string& target);
+    // take the logfile prepared at `path`. Returns its fd, or -1 if it's not ready
+    int Take(const string& path);
+    // unmap `map`, truncate the logfile to `size` and close it, then compress it if `path` isn't empty
+    void Retire(int fd, char* map, uint64_t mapSize, uint64_t size, const string& path);
+
+private:
+    void run();
+
+private:
+    struct Job {
+        string path;
+        string symlink;
+        string target;
+        // logfile to be closed
+        int fd{-1};
+        char* map{nullptr};
+        uint64_t mapSize{0};
+        uint64_t size{0};
+        string compressPath;
+    };
+
+    const uint64_t preallocSize_;
+    Compressor* const compressor_;
+
+    mutex lock_; // protects the following variables
+    condition_variable cond_;
+    deque<Job> jobs_;
+    unordered_set<string> pending_;   // paths requested but not ready yet
+    unordered_map<string, int> ready_; // path -> fd
+    bool stop_{false};
+
+    thread thr_;
+};
+
+#ifdef LIBANT_WITH_ZLIB
+//==========================================================================================
+// Logger::Compressor
+//==========================================================================================
+
+/**
+ * Compressor gzips rotated logfiles on a background thread at a limited rate.
+ */
+class Logger::Compressor {
+public:
+    Compressor(int level, uint32_t maxMBPerSecond);
+    ~Compressor();
+
+    // compress the logfile at `path` into `path`.gz and remove it
+    void Add(const string& path);
+
+private:
+    void run();
+    bool compress(const string& path);
+    // account `n` bytes compressed, sleeping if it's over the rate. Returns false if stopping
+    bool throttle(size_t n);
+
+private:
+    const string mode_; // passed to gzopen()
+    const uint64_t maxBytesPerSecond_;
+    chrono::steady_clock::time_point secondStart_;
+    uint64_t bytesThisSecond_{0};
+
+    mutex lock_; // protects the following variables
+    condition_variable cond_;
+    deque<string> paths_;
+    bool stop_{false};
+
+    thread thr_;
+};
+#else
+class Logger::Compressor {
+public:
+    void Add(const string&)
+    {
+    }
+};
+#endif
+#else
+class Logger::AsyncWriter {
+};
+
+class Logger::SegmentPreparer {
+};
+
+class Logger::Compressor {
+};
+#endif
+
+#ifndef _WIN32
+// A binary logfile starts with kBinaryMagic and the control flags (uint32_t), followed by records in native byte order:
+//   'F' | id (uint32_t) | length (uint32_t) | format string
+//   'L' | level (uint8_t) | time in microseconds (int64_t) | format id (uint32_t) | length (uint32_t) | arguments
+//   'T' | level (uint8_t) | time in microseconds (int64_t) | length (uint32_t) | formatted log
+// A format is always defined in the same file before it's referred to.
+static const char kBinaryMagic[8] = {'A', 'N', 'T', 'B', 'L', 'O', 'G', '1'};
+
+static string binaryHeader(uint32_t controlFlags)
+{
+    string header(kBinaryMagic, sizeof(kBinaryMagic));
+    header.append(reinterpret_cast<const char*>(&controlFlags), sizeof(controlFlags));
+    return header;
+}
+
+static const uint64_t sPageSize = sysconf(_SC_PAGESIZE);
+static constexpr uint64_t kMmapSyncSize = 4 * 1024 * 1024; // written back and dropped from memory every so many bytes in mmap mode
+
+// preallocate [offset, offset + len) of `fd`, extending the file if necessary
+static bool preallocate(int fd, uint64_t offset, uint64_t len)
+{
+#ifdef __linux__
+    if (fallocate(fd, 0, static_cast<off_t>(offset), static_cast<off_t>(len)) == 0) {
+        return true;
+    }
+    if (errno != EOPNOTSUPP && errno != ENOSYS) {
+        return false;
+    }
+#endif
+    // fall back to a sparse file
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return false;
+    }
+    return static_cast<uint64_t>(st.st_size) >= offset + len || ftruncate(fd, static_cast<off_t>(offset + len)) == 0;
+}
+
+// format the arguments captured by detail::DeferredArg, followed by a newline. Returns false if `args` is corrupted
+static bool formatDeferredArgs(fmt::memory_buffer& buf, fmt::string_view format, const char* args, size_t len,
+                               fmt::dynamic_format_arg_store<fmt::format_context>& store)
+{
+    store.clear();
+    const char* end = args + len;
+    while (args != end) {
+        auto type = static_cast<detail::DeferredArgType>(*args++);
+        size_t size = 8;
+        if (type == detail::DeferredArgBool || type == detail::DeferredArgChar) {
+            size = 1;
+        } else if (type == detail::DeferredArgString) {
+            size = sizeof(uint32_t);
+        } else if (type == detail::DeferredArgPointer) {
+            size = sizeof(uintptr_t);
+        } else if (type == detail::DeferredArgFloat) {
+            size = sizeof(float);
+        }
+        if (static_cast<size_t>(end - args) < size) {
+            return false;
+        }
+
+        switch (type) {
+        case detail::DeferredArgInt: {
+            int64_t v;
+            memcpy(&v, args, sizeof(v));
+            store.push_back(v);
+            break;
+        }
+        case detail::DeferredArgUInt: {
+            uint64_t v;
+            memcpy(&v, args, sizeof(v));
+            store.push_back(v);
+            break;
+        }
+        case detail::DeferredArgDouble: {
+            double v;
+            memcpy(&v, args, sizeof(v));
+            store.push_back(v);
+            break;
+        }
+        case detail::DeferredArgFloat: {
+            float v;
+            memcpy(&v, args, sizeof(v));
+            store.push_back(v);
+            break;
+        }
+        case detail::DeferredArgBool:
+            store.push_back(*args != 0);
+            break;
+        case detail::DeferredArgChar:
+            store.push_back(*args);
+            break;
+        case detail::DeferredArgString: {
+            uint32_t strLen;
+            memcpy(&strLen, args, sizeof(strLen));
+            if (static_cast<size_t>(end - args - size) < strLen) {
+                return false;
+            }
+            // refers to `args` without copying
+            store.push_back(fmt::string_view(args + size, strLen));
+            size += strLen;
+            break;
+        }
+        case detail::DeferredArgPointer: {
+            uintptr_t v;
+            memcpy(&v, args, sizeof(v));
+            store.push_back(reinterpret_cast<const void*>(v));
+            break;
+        }
+        default:
+            return false;
+        }
+        args += size;
+    }
+
+    try {
+        fmt::vformat_to(std::back_inserter(buf), format, store);
+    } catch (const exception& e) {
+        fmt::format_to(buf, "<{}: {}>", e.what(), format);
+    }
+    buf.push_back('\n');
+    return true;
 }
+#endif
 
 //==========================================================================================
 // Logger Public Methods
@@ -31,34 +533,164 @@ Logger::Logger(const Cfg& cfg)
 #endif
     , logFileMaxSize_(cfg.logFileMaxSize_ ? cfg.logFileMaxSize_ * 1024 * 1024 : 0xFFFFFFFFFF000000)
     , controlFlags_(cfg.controlFlags_)
+    , logThrough_((cfg.controlFlags_ & ControlFlagLogThrough) && !(cfg.controlFlags_ & ControlFlagSingleFile))
     , multiThreaded_(cfg.enableThreadMutex_)
+#ifndef _WIN32
+    , deferred_(cfg.async_ && cfg.formatMode_ != FormatEager)
+    , binary_(cfg.async_ && cfg.formatMode_ == FormatBinary)
+    , mmap_(cfg.mmap_)
+#else
+    , deferred_(false)
+    , binary_(false)
+    , mmap_(false)
+#endif
+    , kvLogfmt_(cfg.kvFormat_ == KVFormatLogfmt)
     , logLevel_(cfg.logLevel_)
     , logDest_(cfg.logDest_)
-    , loggers_{std::make_unique<Impl>(this, cfg.logFilenamePrefix_, LogLevelTrace, cfg.enableThreadMutex_),
-               std::make_unique<Impl>(this, cfg.logFilenamePrefix_, LogLevelInfo, cfg.enableThreadMutex_),
-               std::make_unique<Impl>(this, cfg.logFilenamePrefix_, LogLevelWarn, cfg.enableThreadMutex_),
-               std::make_unique<Impl>(this, cfg.logFilenamePrefix_, LogLevelError, cfg.enableThreadMutex_),
-               std::make_unique<Impl>(this, cfg.logFilenamePrefix_, LogLevelFatal, cfg.enableThreadMutex_)}
 {
+    if (controlFlags_ & ControlFlagSingleFile) {
+        impls_[0] = std::make_unique<Impl>(this, cfg.logFilenamePrefix_, "ALL", cfg.enableThreadMutex_);
+    } else {
+        for (int lv = 0; lv != LogLevelCount; ++lv) {
+            impls_[lv] = std::make_unique<Impl>(this, cfg.logFilenamePrefix_, sLogLevelNames[lv], cfg.enableThreadMutex_);
+        }
+    }
+    for (int lv = 0; lv != LogLevelCount; ++lv) {
+        loggers_[lv] = impls_[lv] ? impls_[lv].get() : impls_[0].get();
+    }
+
+#ifndef _WIN32
+#ifdef LIBANT_WITH_ZLIB
+    if (cfg.compress_) {
+        compressor_ = std::make_unique<Compressor>(cfg.compressionLevel_, cfg.compressionRate_);
+    }
+#endif
+    if (mmap_) {
+        // mapped in pages, and no need to preallocate more than a logfile can hold
+        const uint64_t pageSize = sysconf(_SC_PAGESIZE);
+        mmapChunkSize_ = std::min<uint64_t>(std::max<uint64_t>(cfg.mmapPreallocSize_, 1) * 1024 * 1024, (logFileMaxSize_ + pageSize - 1) / pageSize * pageSize);
+        preparer_ = std::make_unique<SegmentPreparer>(mmapChunkSize_, compressor_.get());
+    }
+    if (cfg.async_) {
+        async_ = std::make_unique<AsyncWriter>(*this, cfg);
+        maxDeferredSize_ = async_->MaxDeferredSize();
+    }
+#endif
 }
 
-//==========================================================================================
+Logger::~Logger()
+{
+    // stop the background thread before the Impls it writes to are destroyed
+    async_.reset();
+}
 
-static const string sLogLevelNames[Logger::LogLevelCount] = {"TRACE", "INFO", "WARN", "ERROR", "FATAL"};
+void Logger::Flush()
+{
+#ifndef _WIN32
+    if (async_) {
+        async_->Flush();
+    }
+#endif
+}
+
+uint64_t Logger::DroppedCount() const
+{
+#ifndef _WIN32
+    if (async_) {
+        return async_->DroppedCount();
+    }
+#endif
+    return 0;
+}
+
+bool Logger::DecodeBinaryLog(const std::string& binPath, const std::string& textPath)
+{
+#ifndef _WIN32
+    ifstream in(binPath, ios::binary);
+    ofstream out(textPath, ios::binary | ios::trunc);
+    if (!in || !out) {
+        return false;
+    }
+    string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+
+    uint32_t controlFlags;
+    if (data.size() < sizeof(kBinaryMagic) + sizeof(controlFlags) || memcmp(data.data(), kBinaryMagic, sizeof(kBinaryMagic)) != 0) {
+        return false;
+    }
+    memcpy(&controlFlags, data.data() + sizeof(kBinaryMagic), sizeof(controlFlags));
+
+    const char* p = data.data() + sizeof(kBinaryMagic) + sizeof(controlFlags);
+    const char* end = data.data() + data.size();
+    auto read = [&p, end](void* v, size_t size) {
+        if (static_cast<size_t>(end - p) < size) {
+            return false;
+        }
+        memcpy(v, p, size);
+        p += size;
+        return true;
+    };
+
+    vector<string> formats;
+    fmt::memory_buffer buf;
+    fmt::dynamic_format_arg_store<fmt::format_context> store;
+    while (p != end) {
+        const char tag = *p++;
+        if (tag == 'F') {
+            uint32_t id, len;
+            if (!read(&id, sizeof(id)) || !read(&len, sizeof(len)) || static_cast<size_t>(end - p) < len) {
+                return false;
+            }
+            if (formats.size() <= id) {
+                formats.resize(id + 1);
+            }
+            formats[id].assign(p, len);
+            p += len;
+            continue;
+        }
+
+        uint8_t level;
+        int64_t timeUS;
+        uint32_t id = 0, len;
+        if ((tag != 'L' && tag != 'T') || !read(&level, sizeof(level)) || level >= LogLevelCount || !read(&timeUS, sizeof(timeUS))
+            || (tag == 'L' && !read(&id, sizeof(id))) || !read(&len, sizeof(len)) || static_cast<size_t>(end - p) < len) {
+            return false;
+        }
+        if (tag == 'T') {
+            out.write(p, len);
+        } else {
+            if (id >= formats.size()) {
+                return false;
+            }
+            buf.clear();
+            appendPrefix(buf, controlFlags, static_cast<LogLevel>(level), cachedTime(timeUS), static_cast<uint32_t>(timeUS % 1000000));
+            if (!formatDeferredArgs(buf, formats[id], p, len, store)) {
+                return false;
+            }
+            out.write(buf.data(), buf.size());
+        }
+        p += len;
+    }
+    return static_cast<bool>(out.flush());
+#else
+    return false;
+#endif
+}
 
 //==========================================================================================
 // Logger::Impl Public Methods
 //==========================================================================================
 
-Logger::Impl::Impl(const Logger* parent, const std::string& filenamePrefix, LogLevel level, bool enableMutex)
+Logger::Impl::Impl(const Logger* parent, const std::string& filenamePrefix, const std::string& levelName, bool enableMutex)
     : parent_(parent)
-    , level_(level)
+    , levelName_(levelName)
     , enableMutex_(enableMutex)
 #ifndef _WIN32
-    , symlink_((!parent_->logDir_.empty() ? parent_->logDir_ + filesystem::path::preferred_separator : "") + sLogLevelNames[level] + "." + filenamePrefix +
-               ".log")
+    , symlink_((!parent_->logDir_.empty() ? parent_->logDir_ + filesystem::path::preferred_separator : "") + levelName_ + "." + filenamePrefix +
+               (parent_->binary_ ? ".bin" : ".log"))
+    , nextPath_((!parent_->logDir_.empty() ? parent_->logDir_ + filesystem::path::preferred_separator : "") + "." + levelName_ + "." + filenamePrefix +
+                ".next")
 #else
-    , symlink_((!parent_->logDir_.empty() ? parent_->logDir_ + '\\' : "") + sLogLevelNames[level] + "." + filenamePrefix +
+    , symlink_((!parent_->logDir_.empty() ? parent_->logDir_ + '\\' : "") + levelName_ + "." + filenamePrefix +
                ".log")
 #endif
 {
@@ -69,15 +701,41 @@ Logger::Impl::Impl(const Logger* parent, const std::string& filenamePrefix, LogL
 //==========================================================================================
 
 bool Logger::Impl::log(const tm& tmNow, uint32_t microSeconds, const string& content)
+{
+    if (!prepareFile(tmNow, microSeconds)) {
+        return false;
+    }
+
+#ifdef _WIN32
+    if (out_.write(content.c_str(), content.size())) {
+        out_.flush();
+        curFileSize_ += content.size();
+        return true;
+    }
+
+    out_.close();
+#else
+    if (writeFile(content.c_str(), content.size())) {
+        return true;
+    }
+
+    closeFile();
+#endif
+    return false;
+}
+
+bool Logger::Impl::prepareFile(const tm& tmNow, uint32_t microSeconds)
 {
 #ifdef _WIN32
     if (curFileSize_ >= parent_->logFileMaxSize_ || curDay_ != tmNow.tm_yday || !out_) {
         out_.close();
 #else
     if (curFileSize_ >= parent_->logFileMaxSize_ || curDay_ != tmNow.tm_yday || (outFD_ == -1)) {
-        close(outFD_);
-        outFD_ = -1;
+        closeFile();
 #endif
+        auto filename = fmt::format("{}.{}.{:%Y%m%d%H%M%S}{:06d}.{}", parent_->logPathPrefix_, levelName_, tmNow, microSeconds,
+                                    parent_->binary_ ? "bin" : "log");
+#ifdef _WIN32
         error_code ec;
         if (!parent_->logDir_.empty()) {
             filesystem::create_directories(parent_->logDir_, ec);
@@ -86,45 +744,924 @@ bool Logger::Impl::log(const tm& tmNow, uint32_t microSeconds, const string& con
             }
         }
 
-        auto filename = fmt::format("{}.{}.{:%Y%m%d%H%M%S}{:06d}.log", parent_->logPathPrefix_, sLogLevelNames[level_], tmNow, microSeconds);
-#ifdef _WIN32
         out_.open(filename, ofstream::app);
         if (!out_) {
             return false;
         }
-#else
-        outFD_ = open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
-        if (outFD_ == -1) {
-            return false;
-        }
-#endif
 
         filesystem::remove(symlink_, ec);
         if (!(parent_->controlFlags_ & ControlFlagNoSymlinks)) {
             filesystem::create_symlink(filesystem::path(filename).filename(), symlink_, ec);
         }
+        curFileSize_ = 0;
+#else
+        if (!openFile(filename)) {
+            return false;
+        }
+        if (parent_->binary_) {
+            auto header = binaryHeader(parent_->controlFlags_);
+            if (!writeFile(header.data(), header.size())) {
+                closeFile();
+                return false;
+            }
+        }
+#endif
 
         curDay_ = tmNow.tm_yday;
-        curFileSize_ = 0;
     }
+    return true;
+}
 
-#ifdef _WIN32
-    if (out_.write(content.c_str(), content.size())) {
-        out_.flush();
-#else
-    if (write(outFD_, content.c_str(), content.size()) >= 0) {
-#endif
-        curFileSize_ += content.size();
-        return true;
+#ifndef _WIN32
+bool Logger::Impl::openFile(const std::string& filename)
+{
+    if (parent_->preparer_) {
+        outFD_ = parent_->preparer_->Take(nextPath_);
+        if (outFD_ != -1 && rename(nextPath_.c_str(), filename.c_str()) != 0) {
+            close(outFD_);
+            outFD_ = -1;
+        }
     }
 
-#ifdef _WIN32
-    out_.close();
-#else
-    close(outFD_);
-    outFD_ = -1;
-#endif
-    return false;
+    curFileSize_ = 0;
+    if (outFD_ == -1) {
+        error_code ec;
+        if (!parent_->logDir_.empty()) {
+            filesystem::create_directories(parent_->logDir_, ec);
+            if (ec) {
+                return false;
+            }
+        }
+
+        if (!parent_->mmap_) {
+            outFD_ = open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        } else {
+            outFD_ = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+            if (outFD_ != -1) {
+                // append to the logs already written, if any
+                auto size = lseek(outFD_, 0, SEEK_END);
+                curFileSize_ = size > 0 ? size : 0;
+            }
+        }
+        if (outFD_ == -1) {
+            return false;
+        }
+    }
+
+    curPath_ = filename;
+    ++fileSeq_; // fileSeq_ starts from 1, so that no format is defined in any logfile initially
+    string target = !(parent_->controlFlags_ & ControlFlagNoSymlinks) ? filesystem::path(filename).filename().string() : "";
+    if (parent_->preparer_) {
+        // leave the symlink and the next logfile to the background thread
+        parent_->preparer_->Request(nextPath_, symlink_, target);
+    } else {
+        error_code ec;
+        filesystem::remove(symlink_, ec);
+        if (!target.empty()) {
+            filesystem::create_symlink(target, symlink_, ec);
+        }
+    }
+    return true;
 }
 
+void Logger::Impl::closeFile(bool compress)
+{
+    compress = compress && parent_->compressor_ && outFD_ != -1;
+    if (parent_->preparer_ && outFD_ != -1) {
+        // compressed after truncated
+        parent_->preparer_->Retire(outFD_, map_, mapSize_, curFileSize_, compress ? curPath_ : "");
+        outFD_ = -1;
+        map_ = nullptr;
+        compress = false;
+    }
+    if (map_) {
+        munmap(map_, mapSize_);
+        map_ = nullptr;
+    }
+    if (outFD_ != -1) {
+        if (parent_->mmap_) {
+            // give back the preallocated space not used
+            std::ignore = ftruncate(outFD_, curFileSize_);
+        }
+        close(outFD_);
+        outFD_ = -1;
+    }
+    if (compress) {
+        parent_->compressor_->Add(curPath_);
+    }
+    curPath_.clear();
+    mapOffset_ = 0;
+    mapSize_ = 0;
+    syncedSize_ = 0;
+}
+
+bool Logger::Impl::writeFile(const char* data, size_t len)
+{
+    if (!parent_->mmap_) {
+        if (write(outFD_, data, len) < 0) {
+            return false;
+        }
+        curFileSize_ += len;
+        return true;
+    }
+
+    while (len) {
+        if (!map_ || curFileSize_ == mapOffset_ + mapSize_) {
+            if (!remap()) {
+                return false;
+            }
+        }
+        auto n = std::min<uint64_t>(len, mapOffset_ + mapSize_ - curFileSize_);
+        memcpy(map_ + (curFileSize_ - mapOffset_), data, n);
+        curFileSize_ += n;
+        data += n;
+        len -= n;
+    }
+
+    // start writing back the pages filled and drop them from the address space every now and then,
+    // instead of leaving them all to munmap()
+    if (curFileSize_ - syncedSize_ >= kMmapSyncSize) {
+        const uint64_t end = curFileSize_ / sPageSize * sPageSize;
+        char* begin = map_ + (syncedSize_ - mapOffset_);
+        msync(begin, end - syncedSize_, MS_ASYNC);
+        madvise(begin, end - syncedSize_, MADV_DONTNEED);
+        syncedSize_ = end;
+    }
+    return true;
+}
+
+bool Logger::Impl::remap()
+{
+    if (map_) {
+        munmap(map_, mapSize_);
+        map_ = nullptr;
+    }
+
+    const uint64_t size = parent_->mmapChunkSize_;
+    const uint64_t offset = curFileSize_ / size * size;
+    if (!preallocate(outFD_, offset, size)) {
+        return false;
+    }
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, outFD_, static_cast<off_t>(offset));
+    if (p == MAP_FAILED) {
+        return false;
+    }
+    map_ = static_cast<char*>(p);
+    mapOffset_ = offset;
+    mapSize_ = size;
+    syncedSize_ = offset;
+    return true;
+}
+#endif
+
+#ifndef _WIN32
+//==========================================================================================
+// Mmap Mode
+//==========================================================================================
+
+Logger::SegmentPreparer::SegmentPreparer(uint64_t preallocSize, Compressor* compressor)
+    : preallocSize_(preallocSize)
+    , compressor_(compressor)
+{
+    thr_ = thread(&SegmentPreparer::run, this);
+}
+
+Logger::SegmentPreparer::~SegmentPreparer()
+{
+    {
+        lock_guard<mutex> lock(lock_);
+        stop_ = true;
+    }
+    cond_.notify_one();
+    thr_.join();
+
+    // remove the logfiles never used
+    for (auto& it : ready_) {
+        close(it.second);
+        unlink(it.first.c_str());
+    }
+}
+
+void Logger::SegmentPreparer::Request(const string& path, const string& symlink, const string& target)
+{
+    {
+        lock_guard<mutex> lock(lock_);
+        const bool prepare = !ready_.count(path) && pending_.insert(path).second;
+        jobs_.push_back(Job{prepare ? path : "", symlink, target, -1, nullptr, 0, 0, ""});
+    }
+    cond_.notify_one();
+}
+
+void Logger::SegmentPreparer::Retire(int fd, char* map, uint64_t mapSize, uint64_t size, const string& path)
+{
+    {
+        lock_guard<mutex> lock(lock_);
+        jobs_.push_back(Job{"", "", "", fd, map, mapSize, size, path});
+    }
+    cond_.notify_one();
+}
+
+int Logger::SegmentPreparer::Take(const string& path)
+{
+    lock_guard<mutex> lock(lock_);
+    auto it = ready_.find(path);
+    if (it == ready_.end()) {
+        return -1;
+    }
+    int fd = it->second;
+    ready_.erase(it);
+    return fd;
+}
+
+void Logger::SegmentPreparer::run()
+{
+    ThreadBlockAllSignals();
+
+    unique_lock<mutex> lock(lock_);
+    for (;;) {
+        cond_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+        if (jobs_.empty()) {
+            return;
+        }
+        auto job = std::move(jobs_.front());
+        jobs_.pop_front();
+        const bool stopping = stop_; // finish the symlinks, but no more logfiles are needed
+        lock.unlock();
+
+        if (job.fd != -1) {
+            if (job.map) {
+                munmap(job.map, job.mapSize);
+            }
+            std::ignore = ftruncate(job.fd, job.size);
+            close(job.fd);
+            if (!job.compressPath.empty()) {
+                compressor_->Add(job.compressPath);
+            }
+        }
+
+        error_code ec;
+        if (!job.symlink.empty()) {
+            filesystem::remove(job.symlink, ec);
+            if (!job.target.empty()) {
+                filesystem::create_symlink(job.target, job.symlink, ec);
+            }
+        }
+
+        int fd = -1;
+        if (!job.path.empty() && !stopping) {
+            fd = open(job.path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (fd != -1 && !preallocate(fd, 0, preallocSize_)) {
+                close(fd);
+                unlink(job.path.c_str());
+                fd = -1;
+            }
+        }
+
+        lock.lock();
+        if (!job.path.empty()) {
+            pending_.erase(job.path);
+            if (fd != -1) {
+                ready_.emplace(job.path, fd);
+            }
+        }
+    }
+}
+
+#ifdef LIBANT_WITH_ZLIB
+//==========================================================================================
+// Compression
+//==========================================================================================
+
+Logger::Compressor::Compressor(int level, uint32_t maxMBPerSecond)
+    : mode_(fmt::format("wb{}", std::clamp(level, 1, 9)))
+    , maxBytesPerSecond_(uint64_t(maxMBPerSecond) * 1024 * 1024)
+{
+    thr_ = thread(&Compressor::run, this);
+}
+
+Logger::Compressor::~Compressor()
+{
+    {
+        lock_guard<mutex> lock(lock_);
+        stop_ = true;
+    }
+    cond_.notify_one();
+    thr_.join();
+}
+
+void Logger::Compressor::Add(const string& path)
+{
+    {
+        lock_guard<mutex> lock(lock_);
+        paths_.push_back(path);
+    }
+    cond_.notify_one();
+}
+
+void Logger::Compressor::run()
+{
+    ThreadBlockAllSignals();
+
+    unique_lock<mutex> lock(lock_);
+    for (;;) {
+        cond_.wait(lock, [this] { return stop_ || !paths_.empty(); });
+        if (stop_) {
+            return;
+        }
+        auto path = std::move(paths_.front());
+        paths_.pop_front();
+        lock.unlock();
+
+        compress(path);
+
+        lock.lock();
+    }
+}
+
+bool Logger::Compressor::compress(const string& path)
+{
+    int in = open(path.c_str(), O_RDONLY);
+    if (in == -1) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(in, &st) != 0) {
+        close(in);
+        return false;
+    }
+
+    // written to a temporary file first, so that a `.gz` file is always complete
+    const string gzPath = path + ".gz";
+    const string tmpPath = gzPath + ".tmp";
+    gzFile out = gzopen(tmpPath.c_str(), mode_.c_str());
+    if (!out) {
+        close(in);
+        return false;
+    }
+    gzbuffer(out, 128 * 1024);
+
+    bool ok = true;
+    vector<char> buf(256 * 1024);
+    for (;;) {
+        auto n = read(in, buf.data(), buf.size());
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            ok = (n == 0);
+            break;
+        }
+        if (gzwrite(out, buf.data(), static_cast<unsigned>(n)) != n || !throttle(n)) {
+            ok = false;
+            break;
+        }
+    }
+    close(in);
+    ok = (gzclose(out) == Z_OK) && ok;
+
+    if (ok) {
+        // keep the modification time for FilePurger
+        utimbuf times{st.st_atime, st.st_mtime};
+        utime(tmpPath.c_str(), &times);
+        ok = (rename(tmpPath.c_str(), gzPath.c_str()) == 0);
+    }
+    if (!ok) {
+        unlink(tmpPath.c_str());
+        return false;
+    }
+    unlink(path.c_str());
+    return true;
+}
+
+bool Logger::Compressor::throttle(size_t n)
+{
+    if (!maxBytesPerSecond_) {
+        return true;
+    }
+
+    auto now = chrono::steady_clock::now();
+    if (now - secondStart_ >= chrono::seconds(1)) {
+        secondStart_ = now;
+        bytesThisSecond_ = 0;
+    }
+    bytesThisSecond_ += n;
+    if (bytesThisSecond_ < maxBytesPerSecond_) {
+        return true;
+    }
+
+    unique_lock<mutex> lock(lock_);
+    cond_.wait_until(lock, secondStart_ + chrono::seconds(1), [this] { return stop_; });
+    secondStart_ = chrono::steady_clock::now();
+    bytesThisSecond_ = 0;
+    return !stop_;
+}
+#endif
+#endif
+
+#ifndef _WIN32
+//==========================================================================================
+// Async Mode
+//==========================================================================================
+
+// write all of `iovs`, removing the written ones. Returns false on failure, with the unwritten ones left in `iovs`
+static bool writeAll(int fd, vector<iovec>& iovs, uint64_t& written)
+{
+    size_t done = 0;
+    while (done != iovs.size()) {
+        auto n = writev(fd, &iovs[done], static_cast<int>(std::min<size_t>(iovs.size() - done, IOV_MAX)));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            iovs.erase(iovs.begin(), iovs.begin() + done);
+            return false;
+        }
+
+        written += n;
+        for (auto len = static_cast<size_t>(n); len;) {
+            auto& iov = iovs[done];
+            if (len < iov.iov_len) {
+                iov.iov_base = static_cast<char*>(iov.iov_base) + len;
+                iov.iov_len -= len;
+                break;
+            }
+            len -= iov.iov_len;
+            ++done;
+        }
+    }
+    iovs.clear();
+    return true;
+}
+
+void Logger::submit(LogLevel level, LogLevel lowestLevel, LogDest dest, int64_t timeUS, const std::string& content)
+{
+    async_->Submit(level, lowestLevel, dest, timeUS, content);
+}
+
+char* Logger::reserveDeferred(LogLevel level, LogLevel lowestLevel, LogDest dest, int64_t timeUS, const detail::DeferredFormat* format, size_t size)
+{
+    return async_->Reserve(level, lowestLevel, dest, timeUS, format, size);
+}
+
+void Logger::commitDeferred()
+{
+    async_->Commit();
+}
+
+void Logger::Impl::Append(const tm& tmNow, uint32_t microSeconds, const char* content, size_t len)
+{
+    prepareBatch(tmNow, microSeconds);
+    batch_.push_back(iovec{const_cast<char*>(content), len});
+    batchSize_ += len;
+}
+
+void Logger::Impl::AppendBinary(const tm& tmNow, uint32_t microSeconds, const detail::DeferredFormat* format, const char* head, size_t headLen,
+                                const char* content, size_t len)
+{
+    prepareBatch(tmNow, microSeconds);
+    if (format) {
+        if (formatBatchSeqs_.size() <= format->id) {
+            formatBatchSeqs_.resize(format->id + 1);
+        }
+        if (formatBatchSeqs_[format->id] != batchSeq_) {
+            formatBatchSeqs_[format->id] = batchSeq_;
+            // defined by writeBatch(), when the logfile it goes to is known
+            batchFormats_.push_back(format);
+            batchSize_ += format->binaryDef.size();
+        }
+    }
+    batch_.push_back(iovec{const_cast<char*>(head), headLen});
+    batch_.push_back(iovec{const_cast<char*>(content), len});
+    batchSize_ += headLen + len;
+}
+
+void Logger::Impl::prepareBatch(const tm& tmNow, uint32_t microSeconds)
+{
+    // a batch is written to a single file, start a new batch if the logfile is going to be rotated
+    if (!batch_.empty()
+        && (batchTm_.tm_yday != tmNow.tm_yday || curFileSize_ + batchSize_ >= parent_->logFileMaxSize_ || batch_.size() >= IOV_MAX)) {
+        WriteBatch();
+    }
+
+    if (batch_.empty()) {
+        batchTm_ = tmNow;
+        batchMicroSeconds_ = microSeconds;
+        ++batchSeq_; // batchSeq_ starts from 1, so that no format is defined in any batch initially
+    }
+}
+
+void Logger::Impl::WriteBatch()
+{
+    if (!batch_.empty()) {
+        if (!writeBatch()) {
+            writeBatch(); // try one more time
+        }
+        batch_.clear();
+        batchFormats_.clear();
+        batchSize_ = 0;
+    }
+}
+
+bool Logger::Impl::writeBatch()
+{
+    if (!prepareFile(batchTm_, batchMicroSeconds_)) {
+        return false;
+    }
+    defineFormats();
+
+    if (parent_->mmap_) {
+        for (size_t i = 0; i != batch_.size(); ++i) {
+            if (!writeFile(static_cast<const char*>(batch_[i].iov_base), batch_[i].iov_len)) {
+                batch_.erase(batch_.begin(), batch_.begin() + i);
+                closeFile();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    if (writeAll(outFD_, batch_, curFileSize_)) {
+        return true;
+    }
+
+    closeFile();
+    return false;
+}
+
+void Logger::Impl::defineFormats()
+{
+    vector<iovec> defs;
+    for (auto format : batchFormats_) {
+        if (formatFileSeqs_.size() <= format->id) {
+            formatFileSeqs_.resize(format->id + 1);
+        }
+        if (formatFileSeqs_[format->id] != fileSeq_) {
+            formatFileSeqs_[format->id] = fileSeq_;
+            defs.push_back(iovec{const_cast<char*>(format->binaryDef.data()), format->binaryDef.size()});
+        }
+    }
+    batch_.insert(batch_.begin(), defs.begin(), defs.end());
+}
+
+static atomic<uint64_t> sNextAsyncWriterId{1};
+
+Logger::AsyncWriter::AsyncWriter(Logger& logger, const Cfg& cfg)
+    : writerId_(sNextAsyncWriterId.fetch_add(1, memory_order_relaxed))
+    , logger_(logger)
+    , overflowPolicy_(cfg.overflowPolicy_)
+    , ringCapacity_(std::max<size_t>(4096, size_t(1) << (64 - __builtin_clzll(std::max<uint64_t>(cfg.asyncBufferSize_, 1) * 1024 - 1))))
+    , flushInterval_(std::max<uint32_t>(cfg.flushInterval_, 1))
+{
+    thr_ = thread(&AsyncWriter::run, this);
+}
+
+Logger::AsyncWriter::~AsyncWriter()
+{
+    {
+        lock_guard<mutex> lock(lock_);
+        stop_ = true;
+    }
+    cond_.notify_one();
+    thr_.join();
+}
+
+void Logger::AsyncWriter::Submit(LogLevel level, LogLevel lowestLevel, LogDest dest, int64_t timeUS, const string& content)
+{
+    auto ring = localRing();
+    // logs too large for the ring are copied to the heap, only the pointer goes through the ring
+    const bool indirect = content.size() > ring->capacity / 4;
+    auto hdr = reserve(ring, level, indirect ? sizeof(string*) : content.size());
+    if (!hdr) {
+        return;
+    }
+
+    hdr->len = static_cast<uint32_t>(content.size());
+    hdr->timeUS = timeUS;
+    hdr->level = static_cast<uint8_t>(level);
+    hdr->lowestLevel = static_cast<uint8_t>(lowestLevel);
+    hdr->dest = static_cast<uint8_t>(dest);
+    if (!indirect) {
+        hdr->type = RecordInline;
+        memcpy(hdr + 1, content.data(), content.size());
+    } else {
+        hdr->type = RecordIndirect;
+        auto str = new string(content);
+        memcpy(hdr + 1, &str, sizeof(str));
+    }
+    Commit();
+}
+
+char* Logger::AsyncWriter::Reserve(LogLevel level, LogLevel lowestLevel, LogDest dest, int64_t timeUS, const detail::DeferredFormat* format,
+                                   size_t size)
+{
+    auto hdr = reserve(localRing(), level, sizeof(format) + size);
+    if (!hdr) {
+        return nullptr;
+    }
+
+    hdr->type = RecordDeferred;
+    hdr->len = static_cast<uint32_t>(size);
+    hdr->timeUS = timeUS;
+    hdr->level = static_cast<uint8_t>(level);
+    hdr->lowestLevel = static_cast<uint8_t>(lowestLevel);
+    hdr->dest = static_cast<uint8_t>(dest);
+    memcpy(hdr + 1, &format, sizeof(format));
+    return reinterpret_cast<char*>(hdr + 1) + sizeof(format);
+}
+
+void Logger::AsyncWriter::Commit()
+{
+    auto ring = localRing();
+    ring->tail.store(ring->reservedTail, memory_order_release);
+    // don't let the background thread sleep when the ring is filling up
+    if (ring->reservedTail - ring->head.load(memory_order_relaxed) >= ring->capacity / 2) {
+        wakeup();
+    }
+}
+
+void Logger::AsyncWriter::Flush()
+{
+    unique_lock<mutex> lock(lock_);
+    const uint64_t seq = ++flushRequested_;
+    cond_.notify_one();
+    flushedCond_.wait(lock, [this, seq] { return flushed_ >= seq; });
+}
+
+Logger::AsyncWriter::Ring* Logger::AsyncWriter::localRing()
+{
+    struct Cache {
+        uint64_t writerId;
+        Ring* ring;
+    };
+    static thread_local Cache cache{0, nullptr};
+    if (cache.writerId == writerId_) {
+        return cache.ring;
+    }
+
+    lock_guard<mutex> lock(ringsLock_);
+    auto self = this_thread::get_id();
+    Ring* ring = nullptr;
+    for (auto& r : rings_) {
+        // a ring left by an exited thread can be taken over by a new thread with the same id
+        if (r->owner == self) {
+            ring = r.get();
+            break;
+        }
+    }
+    if (!ring) {
+        rings_.emplace_back(new Ring(ringCapacity_));
+        ring = rings_.back().get();
+        ring->owner = self;
+        ringNum_.store(rings_.size(), memory_order_release);
+    }
+    cache = Cache{writerId_, ring};
+    return ring;
+}
+
+Logger::AsyncWriter::RecordHeader* Logger::AsyncWriter::reserve(Ring* ring, LogLevel level, size_t payloadSize)
+{
+    const size_t cap = ring->capacity;
+    const size_t size = (sizeof(RecordHeader) + payloadSize + kAlign - 1) & ~(kAlign - 1);
+    const size_t tail = ring->tail.load(memory_order_relaxed);
+    const size_t pos = tail & (cap - 1);
+    // a record never wraps around, the space left at the end of the ring is skipped if it's not enough
+    const size_t skip = (cap - pos < size) ? cap - pos : 0;
+    for (int spins = 0; cap - (tail - ring->head.load(memory_order_acquire)) < skip + size; ++spins) {
+        if (overflowPolicy_ != OverflowBlock) {
+            dropped_.fetch_add(1, memory_order_relaxed);
+            if (overflowPolicy_ == OverflowDropWithCounter) {
+                droppedSinceNotice_[level].fetch_add(1, memory_order_relaxed);
+            }
+            wakeup();
+            return nullptr;
+        }
+
+        wakeup();
+        if (spins < 64) {
+            this_thread::yield();
+        } else {
+            this_thread::sleep_for(chrono::microseconds(100));
+        }
+    }
+
+    char* buf = ring->buf.get();
+    // no room for a header at the end of the ring means skipping implicitly
+    if (skip >= sizeof(RecordHeader)) {
+        auto padding = reinterpret_cast<RecordHeader*>(buf + pos);
+        padding->size = static_cast<uint32_t>(skip);
+        padding->type = RecordPadding;
+    }
+
+    auto hdr = reinterpret_cast<RecordHeader*>(buf + ((tail + skip) & (cap - 1)));
+    hdr->size = static_cast<uint32_t>(size);
+    ring->reservedTail = tail + skip + size;
+    return hdr;
+}
+
+void Logger::AsyncWriter::wakeup()
+{
+    if (sleeping_.load(memory_order_relaxed)) {
+        {
+            lock_guard<mutex> lock(lock_);
+            wakeup_ = true;
+        }
+        cond_.notify_one();
+    }
+}
+
+void Logger::AsyncWriter::run()
+{
+    ThreadBlockAllSignals();
+
+    unique_lock<mutex> lock(lock_);
+    for (;;) {
+        const bool stop = stop_;
+        const uint64_t flushRequested = flushRequested_;
+        wakeup_ = false;
+        lock.unlock();
+
+        drain();
+
+        lock.lock();
+        if (flushed_ != flushRequested) {
+            flushed_ = flushRequested;
+            flushedCond_.notify_all();
+        }
+        if (stop) {
+            break;
+        }
+        if (!wakeup_ && !stop_ && flushRequested_ == flushed_) {
+            sleeping_.store(true, memory_order_relaxed);
+            cond_.wait_for(lock, flushInterval_);
+            sleeping_.store(false, memory_order_relaxed);
+        }
+    }
+}
+
+void Logger::AsyncWriter::drain()
+{
+    if (draining_.size() != ringNum_.load(memory_order_acquire)) {
+        lock_guard<mutex> lock(ringsLock_);
+        draining_.clear();
+        for (auto& r : rings_) {
+            draining_.push_back(r.get());
+        }
+        drainTails_.resize(draining_.size());
+    }
+
+    vector<size_t> heads(draining_.size());
+    for (size_t i = 0; i != draining_.size(); ++i) {
+        heads[i] = draining_[i]->head.load(memory_order_relaxed);
+        drainTails_[i] = draining_[i]->tail.load(memory_order_acquire);
+    }
+
+    // merge the rings by time, so that logs from different threads are written in order
+    int64_t lastTimeUS = 0;
+    for (;;) {
+        const RecordHeader* next = nullptr;
+        size_t nextRing = 0;
+        for (size_t i = 0; i != draining_.size(); ++i) {
+            auto ring = draining_[i];
+            const size_t cap = ring->capacity;
+            while (heads[i] != drainTails_[i]) {
+                const size_t pos = heads[i] & (cap - 1);
+                auto hdr = reinterpret_cast<const RecordHeader*>(ring->buf.get() + pos);
+                if (cap - pos < sizeof(RecordHeader) || hdr->type == RecordPadding) {
+                    heads[i] += cap - pos;
+                    continue;
+                }
+                if (!next || hdr->timeUS < next->timeUS) {
+                    next = hdr;
+                    nextRing = i;
+                }
+                break;
+            }
+        }
+        if (!next) {
+            break;
+        }
+        heads[nextRing] += next->size;
+        lastTimeUS = next->timeUS;
+
+        const tm& tmNow = cachedTime(next->timeUS).tmNow;
+        auto microSeconds = static_cast<uint32_t>(next->timeUS % 1000000);
+        const detail::DeferredFormat* format = nullptr;
+        const char* content;
+        if (next->type == RecordInline) {
+            content = reinterpret_cast<const char*>(next + 1);
+        } else if (next->type == RecordDeferred) {
+            memcpy(&format, next + 1, sizeof(format));
+            content = reinterpret_cast<const char*>(next + 1) + sizeof(format);
+        } else {
+            string* str;
+            memcpy(&str, next + 1, sizeof(str));
+            indirects_.push_back(str);
+            content = str->data();
+        }
+
+        fmt::string_view text(content, next->len);
+        if (format && (!logger_.binary_ || (next->dest & LogDestConsole))) {
+            text = formatDeferred(next);
+        }
+        if (next->dest & LogDestFile) {
+            if (logger_.binary_) {
+                appendBinary(next, tmNow, microSeconds, content);
+            } else {
+                for (int lv = next->level; lv >= next->lowestLevel; --lv) {
+                    logger_.loggers_[lv]->Append(tmNow, microSeconds, text.data(), text.size());
+                }
+            }
+        }
+        if (next->dest & LogDestConsole) {
+            console_.push_back(iovec{const_cast<char*>(text.data()), text.size()});
+        }
+    }
+
+    if (overflowPolicy_ == OverflowDropWithCounter) {
+        if (!lastTimeUS) {
+            lastTimeUS = chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count();
+        }
+        appendDroppedNotices(cachedTime(lastTimeUS), static_cast<uint32_t>(lastTimeUS % 1000000));
+    }
+
+    for (auto& impl : logger_.impls_) {
+        if (impl) {
+            impl->WriteBatch();
+        }
+    }
+    if (!console_.empty()) {
+        uint64_t written = 0;
+        writeAll(STDOUT_FILENO, console_, written);
+        console_.clear();
+    }
+
+    // release the space only after the logs are written, as they are written directly from the rings
+    for (size_t i = 0; i != draining_.size(); ++i) {
+        draining_[i]->head.store(heads[i], memory_order_release);
+    }
+    for (auto str : indirects_) {
+        delete str;
+    }
+    indirects_.clear();
+    notices_.clear();
+    arena_.Reset();
+}
+
+fmt::string_view Logger::AsyncWriter::formatDeferred(const RecordHeader* hdr)
+{
+    const detail::DeferredFormat* format;
+    memcpy(&format, hdr + 1, sizeof(format));
+    const char* args = reinterpret_cast<const char*>(hdr + 1) + sizeof(format);
+
+    fmtBuf_.clear();
+    appendPrefix(fmtBuf_, logger_.controlFlags_, static_cast<LogLevel>(hdr->level), cachedTime(hdr->timeUS), static_cast<uint32_t>(hdr->timeUS % 1000000));
+    formatDeferredArgs(fmtBuf_, format->format, args, hdr->len, fmtArgs_);
+
+    char* text = arena_.Alloc(fmtBuf_.size());
+    memcpy(text, fmtBuf_.data(), fmtBuf_.size());
+    return fmt::string_view(text, fmtBuf_.size());
+}
+
+void Logger::AsyncWriter::appendBinary(const RecordHeader* hdr, const tm& tmNow, uint32_t microSeconds, const char* content)
+{
+    const detail::DeferredFormat* format = nullptr;
+    if (hdr->type == RecordDeferred) {
+        memcpy(&format, hdr + 1, sizeof(format));
+    }
+
+    // 'L' | level | time | format id | length, or 'T' | level | time | length
+    const size_t headLen = 1 + 1 + sizeof(hdr->timeUS) + (format ? sizeof(format->id) : 0) + sizeof(hdr->len);
+    char* head = arena_.Alloc(headLen);
+    char* p = head;
+    *p++ = format ? 'L' : 'T';
+    *p++ = static_cast<char>(hdr->level);
+    memcpy(p, &hdr->timeUS, sizeof(hdr->timeUS));
+    p += sizeof(hdr->timeUS);
+    if (format) {
+        memcpy(p, &format->id, sizeof(format->id));
+        p += sizeof(format->id);
+    }
+    memcpy(p, &hdr->len, sizeof(hdr->len));
+
+    for (int lv = hdr->level; lv >= hdr->lowestLevel; --lv) {
+        logger_.loggers_[lv]->AppendBinary(tmNow, microSeconds, format, head, headLen, content, hdr->len);
+    }
+}
+
+void Logger::AsyncWriter::appendDroppedNotices(const TimeCache& timeCache, uint32_t microSeconds)
+{
+    // make sure the strings never move before they are written
+    notices_.reserve(LogLevelCount);
+    for (int lv = 0; lv != LogLevelCount; ++lv) {
+        auto n = droppedSinceNotice_[lv].exchange(0, memory_order_relaxed);
+        if (n) {
+            auto& notice = notices_.emplace_back();
+            appendPrefix(notice, logger_.controlFlags_, static_cast<LogLevel>(lv), timeCache, microSeconds);
+            fmt::format_to(back_inserter(notice), "{} logs dropped because the buffer is full\n", n);
+            logger_.loggers_[lv]->Append(timeCache.tmNow, microSeconds, notice.data(), notice.size());
+        }
+    }
+}
+#endif
+
 } // namespace ant
\ No newline at end of file
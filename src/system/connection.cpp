@@ -0,0 +1,294 @@
+#include <algorithm>
+#include <cerrno>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <libant/system/connection.h>
+
+using namespace std;
+
+namespace ant {
+
+Connection::Connection(EventPoll& poll, int fd, const StringBufferPool::PoolPtr& pool)
+    : poll_(poll)
+    , fd_(fd)
+    , pool_(pool)
+    , input_(pool->GetBuffer())
+{
+}
+
+void Connection::Start()
+{
+    started_ = true;
+    poll_.Add(fd_, watchingOut_ ? EventPoll::EventIO : EventPoll::EventIn, *this, &Connection::onReadable, &Connection::onWritable);
+    if (pendingErr_) {
+        // Send() failed before Start(), report it in the first iteration
+        poll_.ReportAgainIn(fd_);
+    }
+}
+
+bool Connection::Send(const void* data, size_t len)
+{
+    if (fd_ == -1 || pendingErr_) {
+        return false;
+    }
+
+    auto p = reinterpret_cast<const char*>(data);
+    if (output_.empty()) {
+        // nothing queued, try to send directly without copying
+        for (;;) {
+            ssize_t n = ::send(fd_, p, len, MSG_NOSIGNAL);
+            if (n >= 0) {
+                p += n;
+                len -= n;
+            } else if (errno == EINTR) {
+                continue;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                setPendingError(errno);
+                return false;
+            }
+            break;
+        }
+        if (len == 0) {
+            return true;
+        }
+    }
+
+    enqueue(p, len);
+    watchOut();
+    checkWatermarks();
+    return true;
+}
+
+bool Connection::Send(StringBufferPool::BufferPtr buf)
+{
+    if (fd_ == -1 || pendingErr_) {
+        return false;
+    }
+    if (buf->empty()) {
+        return true;
+    }
+
+    pendingBytes_ += buf->size();
+    output_.push_back(OutputChunk{std::move(buf), 0});
+    if (!watchingOut_) {
+        // send directly since EventOut won't be reported until the socket buffer becomes full
+        int err = flush();
+        if (err) {
+            setPendingError(err);
+            return false;
+        }
+        if (!output_.empty()) {
+            watchOut();
+        }
+    }
+    checkWatermarks();
+    return true;
+}
+
+void Connection::Close()
+{
+    if (fd_ != -1) {
+        if (started_) {
+            poll_.Remove(fd_);
+        }
+        close(fd_);
+        fd_ = -1;
+        output_.clear();
+        pendingBytes_ = 0;
+    }
+}
+
+//--------------------------------------------------
+// private methods
+//
+void Connection::onReadable(int fd)
+{
+    if (pendingErr_) {
+        closeByPeer(pendingErr_);
+        return;
+    }
+
+    auto& input = *input_;
+    char buf[kReadSize];
+    size_t total = 0;
+    int err = -1;
+    for (;;) {
+        if (readBudget_ && total >= readBudget_) {
+            // let the other connections run, the rest will be read in the next iteration
+            poll_.ReportAgainIn(fd);
+            break;
+        }
+
+        // read into the tail of `input` directly. resize() zero fills the tail, so it's sized after the recent reads,
+        // and whatever exceeds it lands in `buf` and is copied
+        size_t size = input.size();
+        input.resize(size + readHint_);
+        iovec iov[2] = {{&input[size], readHint_}, {buf, sizeof(buf)}};
+        ssize_t n = ::readv(fd, iov, 2);
+        if (n > 0) {
+            if (static_cast<size_t>(n) <= readHint_) {
+                input.resize(size + n);
+            } else {
+                input.append(buf, n - readHint_);
+            }
+            if (static_cast<size_t>(n) >= readHint_) {
+                readHint_ = std::min(readHint_ * 2, kReadSize);
+            } else if (static_cast<size_t>(n) < readHint_ / 4) {
+                readHint_ = std::max(readHint_ / 2, kMinReadHint);
+            }
+            total += n;
+            continue;
+        }
+        input.resize(size);
+        if (n == 0) {
+            err = 0;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            err = errno;
+        }
+        break;
+    }
+
+    if (total && onMessage_) {
+        onMessage_(*this, input);
+        if (fd_ == -1) {
+            return;
+        }
+    }
+    if (err != -1) {
+        closeByPeer(err);
+    }
+}
+
+void Connection::onWritable(int)
+{
+    if (pendingErr_) {
+        closeByPeer(pendingErr_);
+        return;
+    }
+
+    int err = flush();
+    if (err) {
+        closeByPeer(err);
+        return;
+    }
+    if (output_.empty() && watchingOut_) {
+        watchingOut_ = false;
+        poll_.Modify(fd_, EventPoll::EventIn);
+    }
+    checkWatermarks();
+}
+
+int Connection::flush()
+{
+    constexpr size_t kMaxIov = 64;
+    iovec iov[kMaxIov];
+    while (!output_.empty()) {
+        size_t iovCnt = 0;
+        for (auto it = output_.begin(); it != output_.end() && iovCnt != kMaxIov; ++it, ++iovCnt) {
+            iov[iovCnt].iov_base = &(*it->buf)[it->offset];
+            iov[iovCnt].iov_len = it->buf->size() - it->offset;
+        }
+
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovCnt;
+        ssize_t n = ::sendmsg(fd_, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            return errno;
+        }
+
+        pendingBytes_ -= n;
+        while (n > 0) {
+            auto& chunk = output_.front();
+            size_t remain = chunk.buf->size() - chunk.offset;
+            if (static_cast<size_t>(n) < remain) {
+                chunk.offset += n;
+                return 0; // socket buffer is full
+            }
+            n -= remain;
+            output_.pop_front();
+        }
+    }
+    return 0;
+}
+
+void Connection::enqueue(const char* data, size_t len)
+{
+    pendingBytes_ += len;
+    if (!output_.empty()) {
+        auto& tail = *output_.back().buf;
+        if (tail.size() < kMaxMergedChunkSize) {
+            size_t n = std::min(len, kMaxMergedChunkSize - tail.size());
+            tail.append(data, n);
+            data += n;
+            len -= n;
+        }
+    }
+    while (len) {
+        auto buf = pool_->GetBuffer();
+        size_t n = std::min(len, kMaxMergedChunkSize);
+        buf->append(data, n);
+        output_.push_back(OutputChunk{std::move(buf), 0});
+        data += n;
+        len -= n;
+    }
+}
+
+void Connection::watchOut()
+{
+    if (!watchingOut_) {
+        watchingOut_ = true;
+        // Start() adds the fd with EventOut if it's not yet added
+        if (started_) {
+            poll_.Modify(fd_, EventPoll::EventIO);
+        }
+    }
+}
+
+void Connection::setPendingError(int err)
+{
+    // the close callback is deferred to the event callbacks, so that it's never invoked inside Send().
+    // Start() reports it if the fd is not yet added
+    pendingErr_ = err;
+    if (started_) {
+        poll_.ReportAgainIn(fd_);
+    }
+}
+
+void Connection::checkWatermarks()
+{
+    if (!aboveHighWatermark_) {
+        if (pendingBytes_ > highWatermark_) {
+            aboveHighWatermark_ = true;
+            if (onHighWatermark_) {
+                onHighWatermark_(*this);
+            }
+        }
+    } else if (pendingBytes_ <= lowWatermark_) {
+        aboveHighWatermark_ = false;
+        if (onLowWatermark_) {
+            onLowWatermark_(*this);
+        }
+    }
+}
+
+void Connection::closeByPeer(int err)
+{
+    Close();
+    if (onClose_) {
+        onClose_(*this, err);
+    }
+}
+
+} // namespace ant
@@ -1,69 +1,258 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <mutex>
 #include <sstream>
 
+#include <sys/eventfd.h>
 #include <unistd.h>
 
 #include <libant/system/epoll.h>
+#include <libant/system/io_uring.h>
 
 using namespace std;
 
 namespace ant {
 
-EventPoll::EventPoll(int maxfd, int timeout)
+// Written by the loop thread only, read by GetStats() from any thread
+struct LoopStats {
+    static constexpr size_t kMaxSlowCallbacks = 32;
+
+    static void Add(atomic<uint64_t>& counter, uint64_t n)
+    {
+        counter.store(counter.load(memory_order_relaxed) + n, memory_order_relaxed);
+    }
+
+    static int Bucket(uint64_t n)
+    {
+        return n ? std::min(64 - __builtin_clzll(n), EventPollStats::kHistogramBuckets - 1) : 0;
+    }
+
+    atomic<bool> enabled{false};
+    atomic<uint32_t> slowThresholdUS{0};
+
+    atomic<uint64_t> iterations{0};
+    atomic<uint64_t> busyHistogram[EventPollStats::kHistogramBuckets]{};
+    atomic<uint64_t> maxBusyUS{0};
+    atomic<uint64_t> totalBusyUS{0};
+    atomic<uint64_t> eventsHistogram[EventPollStats::kHistogramBuckets]{};
+    atomic<uint64_t> totalEvents{0};
+    atomic<uint64_t> redispatchUS{0};
+    atomic<uint64_t> timersUS{0};
+
+    mutable mutex slowLock; // protects the following variables
+    uint64_t slowCallbacks{0};
+    EventPollStats::SlowCallback recentSlowCallbacks[kMaxSlowCallbacks];
+};
+
+static inline uint64_t nowUS()
+{
+    return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// IORING_POLL_ADD_LEVEL needs Linux 5.19 and isn't advertised by any feature flag. Kernels without it fail such requests
+// with -EINVAL, so a readable eventfd is polled with a throwaway ring to find out. Closing the ring cancels the multishot
+// request.
+static bool probeLevelTriggeredPoll()
 {
-    m_epfd = epoll_create(maxfd);
-    if (m_epfd == -1) {
-        throw runtime_error(string("epoll_create failed: ") + strerror(errno));
+    IoUring ring;
+    if (!ring.Init(2, IORING_FEAT_EXT_ARG)) {
+        return false;
+    }
+    int fd = eventfd(1, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+
+    bool supported = false;
+    io_uring_sqe* sqe = ring.GetSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = EPOLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI | IORING_POLL_ADD_LEVEL;
+    sqe->user_data = 1;
+    io_uring_cqe cqe;
+    if (ring.Wait(1000) == 0 && ring.PeekCqes(&cqe, 1) == 1) {
+        supported = cqe.res > 0;
+    }
+    close(fd);
+    return supported;
+}
+
+EventPoll::EventPoll(int maxfd, int timeout, Backend backend)
+{
+    m_epfd = -1;
+    m_uring = 0;
+    m_uring_level = false;
+    if (backend == BackendIoUring) {
+        m_uring = new IoUring;
+        // IORING_FEAT_RSRC_TAGS comes with Linux 5.13, which is the first version supports multishot poll
+        if (m_uring->Init(4096, IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG | IORING_FEAT_RSRC_TAGS)) {
+            // the kernel doesn't change while running, probe it only once
+            static const bool levelTriggeredPoll = probeLevelTriggeredPoll();
+            m_uring_level = levelTriggeredPoll;
+        } else {
+            delete m_uring;
+            m_uring = 0;
+        }
+    }
+    if (!m_uring) {
+        m_epfd = epoll_create(maxfd);
+        if (m_epfd == -1) {
+            throw runtime_error(string("epoll_create failed: ") + strerror(errno));
+        }
     }
 
     m_timeout = timeout;
     m_ev_num = 0;
-    m_maxfd = maxfd;
-    m_ev_hdlrs = new EventHandler[maxfd];
-    m_avail_evs = new epoll_event[maxfd];
+    m_avail_evs = new epoll_event[kMaxEventsPerWait];
     m_plugin = 0;
+    m_stats = new LoopStats;
+    update_now();
 }
 
 EventPoll::~EventPoll()
 {
-    for (int i = 0; i != m_maxfd; ++i) {
-        EventHandler* evhdlr = &m_ev_hdlrs[i];
-        if (evhdlr->in_use) {
-            delete evhdlr->in;
-            delete evhdlr->out;
+    for (auto chunk : m_hdlr_chunks) {
+        for (int i = 0; i != kHandlerChunkSize; ++i) {
+            EventHandler* evhdlr = &chunk[i];
+            if (evhdlr->in_use) {
+                delete evhdlr->in;
+                delete evhdlr->out;
+            }
         }
+        delete[] chunk;
     }
 
-    delete[] m_ev_hdlrs;
     delete[] m_avail_evs;
     delete m_plugin;
-    close(m_epfd);
+    delete m_stats;
+    delete m_uring;
+    if (m_epfd != -1) {
+        close(m_epfd);
+    }
 }
 
 void EventPoll::Dispatch()
 {
-    while (m_ev_num) {
-        int ev_num = epoll_wait(m_epfd, m_avail_evs, m_ev_num, m_timeout);
+    update_now();
+    while (m_ev_num || m_timers.Size()) {
+        flush_modifications();
+        int ev_num = wait_events(wait_timeout());
         if ((ev_num >= 0) || (errno == EINTR)) {
+            update_now();
+            bool stats = m_stats->enabled.load(memory_order_relaxed);
+            uint64_t start = stats ? nowUS() : 0;
             // dispatch all the ready events reported by epoll
             dispatch_ready_events(ev_num);
             // redispatch all the ready but not yet finish processing 'EventIn' events
+            uint64_t t = stats ? nowUS() : 0;
             redispatch_in_events();
+            if (stats) {
+                uint64_t end = nowUS();
+                LoopStats::Add(m_stats->redispatchUS, end - t);
+                t = end;
+            }
+            // fire expired timers
+            m_timers.Update(m_now);
+            if (stats) {
+                uint64_t end = nowUS();
+                LoopStats::Add(m_stats->timersUS, end - t);
+                if (end - t >= m_stats->slowThresholdUS.load(memory_order_relaxed)) {
+                    record_slow_callback(-1, EventPollStats::CallbackTimers, end - t);
+                }
+            }
             // extra user code
             if (m_plugin) {
-                m_plugin->Execute();
+                execute(m_plugin, -1, EventPollStats::CallbackPlugin);
+            }
+
+            if (stats) {
+                uint64_t busy = nowUS() - start;
+                LoopStats::Add(m_stats->iterations, 1);
+                LoopStats::Add(m_stats->busyHistogram[LoopStats::Bucket(busy)], 1);
+                LoopStats::Add(m_stats->totalBusyUS, busy);
+                if (busy > m_stats->maxBusyUS.load(memory_order_relaxed)) {
+                    m_stats->maxBusyUS.store(busy, memory_order_relaxed);
+                }
+                if (ev_num >= 0) {
+                    LoopStats::Add(m_stats->eventsHistogram[LoopStats::Bucket(ev_num)], 1);
+                    LoopStats::Add(m_stats->totalEvents, ev_num);
+                }
             }
         } else {
-            throw runtime_error(string("epoll_wait failed: ") + strerror(errno));
+            throw runtime_error(string(m_uring ? "io_uring_enter failed: " : "epoll_wait failed: ") + strerror(errno));
         }
     }
 }
 
+void EventPoll::EnableStats(uint32_t slowCallbackThresholdUS)
+{
+    m_stats->slowThresholdUS.store(slowCallbackThresholdUS, memory_order_relaxed);
+    m_stats->enabled.store(true, memory_order_relaxed);
+}
+
+void EventPoll::DisableStats()
+{
+    m_stats->enabled.store(false, memory_order_relaxed);
+}
+
+EventPollStats EventPoll::GetStats() const
+{
+    EventPollStats stats;
+    stats.iterations = m_stats->iterations.load(memory_order_relaxed);
+    for (int i = 0; i != EventPollStats::kHistogramBuckets; ++i) {
+        stats.busyHistogram[i] = m_stats->busyHistogram[i].load(memory_order_relaxed);
+        stats.eventsHistogram[i] = m_stats->eventsHistogram[i].load(memory_order_relaxed);
+    }
+    stats.maxBusyUS = m_stats->maxBusyUS.load(memory_order_relaxed);
+    stats.totalBusyUS = m_stats->totalBusyUS.load(memory_order_relaxed);
+    stats.totalEvents = m_stats->totalEvents.load(memory_order_relaxed);
+    stats.redispatchUS = m_stats->redispatchUS.load(memory_order_relaxed);
+    stats.timersUS = m_stats->timersUS.load(memory_order_relaxed);
+
+    lock_guard<mutex> lock(m_stats->slowLock);
+    stats.slowCallbacks = m_stats->slowCallbacks;
+    uint64_t n = std::min<uint64_t>(m_stats->slowCallbacks, LoopStats::kMaxSlowCallbacks);
+    for (uint64_t i = m_stats->slowCallbacks - n; i != m_stats->slowCallbacks; ++i) {
+        stats.recentSlowCallbacks.push_back(m_stats->recentSlowCallbacks[i % LoopStats::kMaxSlowCallbacks]);
+    }
+    return stats;
+}
+
 //--------------------------------------------------
 // private methods
 //
+void EventPoll::execute(CallbackBase* cb, int fd, EventPollStats::CallbackKind kind)
+{
+    if (!m_stats->enabled.load(memory_order_relaxed)) {
+        cb->Execute();
+        return;
+    }
+
+    uint64_t start = nowUS();
+    cb->Execute();
+    uint64_t elapsed = nowUS() - start;
+    if (elapsed >= m_stats->slowThresholdUS.load(memory_order_relaxed)) {
+        record_slow_callback(fd, kind, elapsed);
+    }
+}
+
+void EventPoll::record_slow_callback(int fd, EventPollStats::CallbackKind kind, uint64_t elapsedUS)
+{
+    lock_guard<mutex> lock(m_stats->slowLock);
+    m_stats->recentSlowCallbacks[m_stats->slowCallbacks % LoopStats::kMaxSlowCallbacks] = EventPollStats::SlowCallback{fd, kind, elapsedUS, m_now};
+    ++m_stats->slowCallbacks;
+}
+
 void EventPoll::add_event(int fd, EventType ev_type, CallbackBase* in, CallbackBase* out, bool use_et)
 {
-    assert((fd < m_maxfd) && (fd > -1) && !m_ev_hdlrs[fd].in_use);
+    assert((fd > -1) && (!has_handler(fd) || !get_handler(fd)->in_use));
+
+    while (!has_handler(fd)) {
+        m_hdlr_chunks.push_back(new EventHandler[kHandlerChunkSize]);
+    }
 
     // add to epoll
     if (epoll_control(EPOLL_CTL_ADD, fd, ev_type, use_et) == -1) {
@@ -74,17 +263,25 @@ void EventPoll::add_event(int fd, EventType ev_type, CallbackBase* in, CallbackB
     ++m_ev_num;
 
     // add to event handler
-    EventHandler* evhdlr = &m_ev_hdlrs[fd];
+    EventHandler* evhdlr = get_handler(fd);
     evhdlr->in_use = true;
     evhdlr->use_et = use_et;
+    evhdlr->dirty = false;
+    evhdlr->fd = fd;
+    evhdlr->ev_type = ev_type;
+    evhdlr->registered_ev_type = ev_type;
     evhdlr->in = in;
     evhdlr->out = out;
 }
 
 int EventPoll::epoll_control(int op, int fd, EventType ev_type, bool use_et)
 {
+    if (m_uring) {
+        return uring_control(op, fd, ev_type, use_et);
+    }
+
     epoll_event ev;
-    ev.data.ptr = &m_ev_hdlrs[fd];
+    ev.data.ptr = get_handler(fd);
     ev.events = ev_type | event_rdhup;
     if (use_et) {
         ev.events |= event_et;
@@ -101,6 +298,120 @@ int EventPoll::epoll_control(int op, int fd, EventType ev_type, bool use_et)
     return 0;
 }
 
+int EventPoll::uring_control(int op, int fd, EventType ev_type, bool use_et)
+{
+    static_assert(alignof(EventHandler) > kUringTagMask, "no room for uring_tag");
+
+    EventHandler* evhdlr = get_handler(fd);
+    io_uring_sqe* sqe;
+    if (op != EPOLL_CTL_ADD) {
+        // cancel the current poll request. Its final CQE carries -ECANCELED and is ignored
+        sqe = m_uring->GetSqe();
+        if (!sqe) {
+            errno = EBUSY;
+            return -1;
+        }
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = uring_user_data(evhdlr);
+        if (op == EPOLL_CTL_DEL) {
+            return 0;
+        }
+    }
+
+    sqe = m_uring->GetSqe();
+    if (!sqe) {
+        errno = EBUSY;
+        return -1;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = ev_type | event_rdhup;
+    if (use_et) {
+        sqe->len = IORING_POLL_ADD_MULTI;
+    } else if (m_uring_level) {
+        sqe->len = IORING_POLL_ADD_MULTI | IORING_POLL_ADD_LEVEL;
+    } else {
+        // a oneshot request completes at once if the fd is still ready when it's re-armed, which is level-triggered
+        sqe->len = 0;
+    }
+    evhdlr->uring_tag = (evhdlr->uring_tag + 1) & kUringTagMask;
+    sqe->user_data = uring_user_data(evhdlr);
+    return 0;
+}
+
+void EventPoll::flush_modifications()
+{
+    for (size_t i = 0; i != m_dirty_hdlrs.size(); ++i) {
+        EventHandler* evhdlr = m_dirty_hdlrs[i];
+        // skip duplicates and handlers removed (or removed and added again) after being queued
+        if (!evhdlr->dirty) {
+            continue;
+        }
+        evhdlr->dirty = false;
+        if (!evhdlr->in_use || evhdlr->ev_type == evhdlr->registered_ev_type) {
+            continue;
+        }
+
+        if (epoll_control(EPOLL_CTL_MOD, evhdlr->fd, evhdlr->ev_type, evhdlr->use_et) == -1) {
+            m_dirty_hdlrs.erase(m_dirty_hdlrs.begin(), m_dirty_hdlrs.begin() + i + 1);
+            throw runtime_error(string("epoll_ctl (EPOLL_CTL_MOD) failed: ") + strerror(errno));
+        }
+        evhdlr->registered_ev_type = evhdlr->ev_type;
+    }
+    m_dirty_hdlrs.clear();
+}
+
+int EventPoll::wait_events(int timeout)
+{
+    if (m_uring) {
+        return uring_wait_events(timeout);
+    }
+    return epoll_wait(m_epfd, m_avail_evs, std::max(std::min(m_ev_num, kMaxEventsPerWait), 1), timeout);
+}
+
+int EventPoll::uring_wait_events(int timeout)
+{
+    if (m_uring->Wait(timeout) == -1) {
+        return -1;
+    }
+
+    io_uring_cqe cqes[256];
+    int ev_num = 0;
+    uint32_t n = m_uring->PeekCqes(cqes, 256);
+    for (uint32_t i = 0; i != n; ++i) {
+        const io_uring_cqe& cqe = cqes[i];
+        EventHandler* evhdlr = reinterpret_cast<EventHandler*>(cqe.user_data & ~uint64_t(kUringTagMask));
+        // CQEs of POLL_REMOVE requests carry no user_data, and those of replaced poll requests carry a stale tag
+        if (!evhdlr || !evhdlr->in_use || (cqe.user_data & kUringTagMask) != evhdlr->uring_tag || cqe.res == -ECANCELED) {
+            continue;
+        }
+
+        int fd = evhdlr->fd;
+        if (cqe.res < 0) {
+            ostringstream oss;
+            oss << "io_uring poll failed: fd=" << fd << " error=" << strerror(-cqe.res);
+            throw runtime_error(oss.str());
+        }
+        // a oneshot request completed, or the kernel terminated the multishot one (eg. CQ overflowed), re-arm it. If the SQ
+        // is full, the fd is queued to be registered again by flush_modifications() before the next wait, which throws
+        // if it fails again
+        if (!(cqe.flags & IORING_CQE_F_MORE)
+            && uring_control(EPOLL_CTL_ADD, fd, evhdlr->registered_ev_type, evhdlr->use_et) == -1) {
+            evhdlr->registered_ev_type = static_cast<EventType>(0);
+            if (!evhdlr->dirty) {
+                evhdlr->dirty = true;
+                m_dirty_hdlrs.push_back(evhdlr);
+            }
+        }
+
+        epoll_event* ev = &m_avail_evs[ev_num++];
+        ev->events = cqe.res;
+        ev->data.ptr = evhdlr;
+    }
+    return ev_num;
+}
+
 void EventPoll::dispatch_ready_events(int ev_num)
 {
     for (int i = 0; i < ev_num; ++i) {
@@ -113,14 +424,14 @@ void EventPoll::dispatch_ready_events(int ev_num)
 
         // EPOLLIN: for read
         if (ev->events & EventIn) {
-            evhdlr->in->Execute();
+            execute(evhdlr->in, evhdlr->fd, EventPollStats::CallbackIn);
             if (!evhdlr->in_use) {
                 continue;
             }
         }
         // EPOLLOUT: for write. The user code should add this event only when necessary
         if (ev->events & EventOut) {
-            evhdlr->out->Execute();
+            execute(evhdlr->out, evhdlr->fd, EventPollStats::CallbackOut);
             if (!evhdlr->in_use) {
                 continue;
             }
@@ -135,19 +446,41 @@ void EventPoll::dispatch_ready_events(int ev_num)
         // read() returns 0 indicating EOF is reached. So, we should alway call read on receving
         // this kind of events to aquire the remaining data and/or EOF. (Linux-2.6.18)
         if (ev->events & (event_rdhup | event_hup)) {
-            evhdlr->in->Execute();
+            execute(evhdlr->in, evhdlr->fd, EventPollStats::CallbackIn);
             continue;
         }
 
         // TODO: EPOLLERR: for read & write? Test it! Modify (or remove) it latter!
         if ((ev->events & event_err) && !(ev->events & (EventIn | event_hup | EventOut | event_rdhup))) {
             ostringstream oss;
-            oss << "Unexpected Event Happend: fd=" << evhdlr - &m_ev_hdlrs[0] << "event=" << hex << ev->events;
+            oss << "Unexpected Event Happend: fd=" << evhdlr->fd << "event=" << hex << ev->events;
             throw runtime_error(oss.str());
         }
     }
 }
 
+int EventPoll::wait_timeout() const
+{
+    time_t expiringTime;
+    if (!m_timers.NextExpiringTime(expiringTime)) {
+        return m_timeout;
+    }
+
+    time_t timeout = expiringTime - m_now;
+    if (timeout <= 0) {
+        return 0;
+    }
+    if (m_timeout >= 0 && timeout > m_timeout) {
+        return m_timeout;
+    }
+    return timeout < INT_MAX ? static_cast<int>(timeout) : INT_MAX;
+}
+
+void EventPoll::update_now()
+{
+    m_now = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 void EventPoll::redispatch_in_events()
 {
     while (m_read_evs.size()) {
@@ -155,7 +488,7 @@ void EventPoll::redispatch_in_events()
         m_read_evs.pop();
 
         if (evhdlr->in_use) {
-            evhdlr->in->Execute();
+            execute(evhdlr->in, evhdlr->fd, EventPollStats::CallbackAgainIn);
         }
     }
 }
@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <libant/system/io_uring.h>
+
+namespace ant {
+
+IoUring::~IoUring()
+{
+    if (sqes_) {
+        munmap(sqes_, sqesSize_);
+    }
+    if (cqRing_ && cqRing_ != sqRing_) {
+        munmap(cqRing_, cqRingSize_);
+    }
+    if (sqRing_) {
+        munmap(sqRing_, sqRingSize_);
+    }
+    if (ringFD_ != -1) {
+        close(ringFD_);
+    }
+}
+
+bool IoUring::Init(uint32_t entries, uint32_t requiredFeatures)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ringFD_ = syscall(__NR_io_uring_setup, entries, &params);
+    if (ringFD_ == -1) {
+        return false;
+    }
+    if ((params.features & requiredFeatures) != requiredFeatures) {
+        return false;
+    }
+
+    sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+    }
+
+    sqRing_ = mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFD_, IORING_OFF_SQ_RING);
+    if (sqRing_ == MAP_FAILED) {
+        sqRing_ = nullptr;
+        return false;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        cqRing_ = sqRing_;
+    } else {
+        cqRing_ = mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFD_, IORING_OFF_CQ_RING);
+        if (cqRing_ == MAP_FAILED) {
+            cqRing_ = nullptr;
+            return false;
+        }
+    }
+    sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = reinterpret_cast<io_uring_sqe*>(mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFD_, IORING_OFF_SQES));
+    if (sqes_ == MAP_FAILED) {
+        sqes_ = nullptr;
+        return false;
+    }
+
+    auto sq = reinterpret_cast<char*>(sqRing_);
+    sqHead_ = reinterpret_cast<uint32_t*>(sq + params.sq_off.head);
+    sqTail_ = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+    sqMask_ = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+    sqEntries_ = params.sq_entries;
+    sqeTail_ = *sqTail_;
+    // SQEs are always used in order, so the indirection array is an identity mapping set up once
+    auto sqArray = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+    for (uint32_t i = 0; i != sqEntries_; ++i) {
+        sqArray[i] = i;
+    }
+
+    auto cq = reinterpret_cast<char*>(cqRing_);
+    cqHead_ = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+    cqTail_ = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+    cqMask_ = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    return true;
+}
+
+io_uring_sqe* IoUring::GetSqe()
+{
+    if (sqeTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) >= sqEntries_) {
+        Submit();
+        if (sqeTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) >= sqEntries_) {
+            return nullptr;
+        }
+    }
+
+    auto sqe = &sqes_[sqeTail_ & sqMask_];
+    ++sqeTail_;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int IoUring::Submit()
+{
+    for (;;) {
+        int r = enter(pendingSqes(), 0, -1);
+        if (r >= 0 || errno != EINTR) {
+            return r;
+        }
+    }
+}
+
+int IoUring::Wait(int timeoutMS)
+{
+    if (enter(pendingSqes(), 1, timeoutMS) == -1 && errno != ETIME && errno != EINTR) {
+        return -1;
+    }
+    return 0;
+}
+
+uint32_t IoUring::PeekCqes(io_uring_cqe* cqes, uint32_t maxCqes)
+{
+    uint32_t head = *cqHead_;
+    uint32_t n = std::min(__atomic_load_n(cqTail_, __ATOMIC_ACQUIRE) - head, maxCqes);
+    for (uint32_t i = 0; i != n; ++i) {
+        cqes[i] = cqes_[(head + i) & cqMask_];
+    }
+    __atomic_store_n(cqHead_, head + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+//--------------------------------------------------
+// private methods
+//
+int IoUring::enter(uint32_t toSubmit, uint32_t minComplete, int timeoutMS)
+{
+    // publish SQEs acquired by GetSqe()
+    __atomic_store_n(sqTail_, sqeTail_, __ATOMIC_RELEASE);
+
+    uint32_t flags = 0;
+    io_uring_getevents_arg arg;
+    __kernel_timespec ts;
+    if (minComplete) {
+        flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        memset(&arg, 0, sizeof(arg));
+        arg.sigmask_sz = _NSIG / 8;
+        if (timeoutMS >= 0) {
+            ts.tv_sec = timeoutMS / 1000;
+            ts.tv_nsec = (timeoutMS % 1000) * 1000000LL;
+            arg.ts = reinterpret_cast<uint64_t>(&ts);
+        }
+    }
+    return syscall(__NR_io_uring_enter, ringFD_, toSubmit, minComplete, flags, minComplete ? &arg : nullptr, sizeof(arg));
+}
+
+uint32_t IoUring::pendingSqes() const
+{
+    return sqeTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+}
+
+} // namespace ant
@@ -0,0 +1,299 @@
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+#include <libant/timer/timer.h>
+
+namespace ant {
+
+TimerManager::TimerManager(uint32_t tickMS)
+    : tickMS_(tickMS)
+{
+    assert(tickMS > 0);
+    for (auto& s : slots_) {
+        initList(&s);
+    }
+    initList(&pending_);
+    initList(&firing_);
+}
+
+TimerManager::~TimerManager()
+{
+    Clear();
+    for (auto block : blocks_) {
+        delete[] block;
+    }
+}
+
+void TimerManager::Update(time_t curTimeMS)
+{
+    assert(firing_.next == &firing_); // Update() mustn't be called by a timer callback
+
+    const int64_t target = curTimeMS / tickMS_;
+    if (!started_) {
+        started_ = true;
+        curTick_ = target;
+        while (pending_.next != &pending_) {
+            auto node = static_cast<Node*>(pending_.next);
+            unlink(node);
+            place(node);
+        }
+    }
+
+    while (curTick_ <= target) {
+        // skip the ticks in which nothing could happen
+        int level = 0;
+        while (level != kLevels && levelSize_[level] == 0) {
+            ++level;
+        }
+        if (level == kLevels) {
+            curTick_ = target + 1;
+            break;
+        }
+        if (level) {
+            // levels below `level` are empty, nothing happens until `level` cascades
+            const int64_t step = int64_t(1) << levelShift(level);
+            const int64_t boundary = (curTick_ + step - 1) & ~(step - 1);
+            if (boundary > target) {
+                curTick_ = target + 1;
+                break;
+            }
+            curTick_ = boundary;
+        }
+
+        const int idx = curTick_ & (kRootSlots - 1);
+        if (idx == 0) {
+            for (int lv = 1; lv != kLevels && cascade(lv) == 0; ++lv) {
+            }
+        }
+
+        Link* s = slot(0, idx);
+        if (s->next != s) {
+            firing_.next = s->next;
+            firing_.prev = s->prev;
+            firing_.next->prev = &firing_;
+            firing_.prev->next = &firing_;
+            initList(s);
+        }
+        ++curTick_;
+
+        // a callback may cancel or reschedule the timers left in firing_
+        while (firing_.next != &firing_) {
+            auto node = static_cast<Node*>(firing_.next);
+            unlink(node);
+            --size_;
+            --levelSize_[0];
+            Callback cb = std::move(node->cb);
+            freeNode(node);
+            cb(curTimeMS);
+        }
+    }
+}
+
+TimerManager::TimerId TimerManager::AddTimer(time_t expiringTimeMS, Callback cb)
+{
+    auto node = allocNode();
+    // round up, so that a timer never fires earlier than its expiring time
+    node->tick = (expiringTimeMS + tickMS_ - 1) / tickMS_;
+    node->cb = std::move(cb);
+    ++size_;
+    if (started_) {
+        place(node);
+    } else {
+        node->level = kPendingLevel;
+        pushBack(&pending_, node);
+    }
+    // index is biased by 1 so that an id is never kInvalidTimerId
+    return (TimerId(node->gen) << 32) | (node->index + 1);
+}
+
+bool TimerManager::Cancel(TimerId id)
+{
+    auto node = findNode(id);
+    if (!node) {
+        return false;
+    }
+
+    detach(node);
+    --size_;
+    freeNode(node);
+    return true;
+}
+
+bool TimerManager::Reschedule(TimerId id, time_t expiringTimeMS)
+{
+    auto node = findNode(id);
+    if (!node) {
+        return false;
+    }
+
+    const int64_t tick = (expiringTimeMS + tickMS_ - 1) / tickMS_;
+    if (tick == node->tick) {
+        return true;
+    }
+    detach(node);
+    node->tick = tick;
+    if (started_) {
+        place(node);
+    } else {
+        node->level = kPendingLevel;
+        pushBack(&pending_, node);
+    }
+    return true;
+}
+
+bool TimerManager::NextExpiringTime(time_t& expiringTimeMS) const
+{
+    if (size_ == 0) {
+        return false;
+    }
+
+    if (!started_) {
+        int64_t tick = std::numeric_limits<int64_t>::max();
+        for (auto link = pending_.next; link != &pending_; link = link->next) {
+            tick = std::min(tick, static_cast<const Node*>(link)->tick);
+        }
+        expiringTimeMS = tick * tickMS_;
+        return true;
+    }
+
+    // the earliest cascade, which may bring a timer due before anything in level 0
+    int64_t tick = std::numeric_limits<int64_t>::max();
+    for (int level = 1; level != kLevels; ++level) {
+        if (levelSize_[level] == 0) {
+            continue;
+        }
+        const int shift = levelShift(level);
+        const int64_t cur = curTick_ >> shift;
+        for (int64_t i = (cur << shift) == curTick_ ? cur : cur + 1; i <= cur + kLevelSlots; ++i) {
+            auto s = slot(level, i & (kLevelSlots - 1));
+            if (s->next != s) {
+                tick = std::min(tick, i << shift);
+                break;
+            }
+        }
+    }
+
+    // the earliest level 0 slot before that cascade
+    if (levelSize_[0]) {
+        for (int64_t t = curTick_; t < tick; ++t) {
+            auto s = slot(0, t & (kRootSlots - 1));
+            if (s->next != s) {
+                tick = t;
+                break;
+            }
+        }
+    }
+    expiringTimeMS = tick * tickMS_;
+    return true;
+}
+
+void TimerManager::Clear()
+{
+    for (auto& s : slots_) {
+        clearList(&s);
+    }
+    clearList(&pending_);
+    clearList(&firing_);
+    size_ = 0;
+    std::fill(std::begin(levelSize_), std::end(levelSize_), 0);
+}
+
+//--------------------------------------------------
+// private methods
+//
+TimerManager::Node* TimerManager::allocNode()
+{
+    if (!freeNodes_) {
+        auto block = new Node[kNodesPerBlock];
+        blocks_.push_back(block);
+        const uint32_t base = (blocks_.size() - 1) * kNodesPerBlock;
+        for (int i = kNodesPerBlock - 1; i >= 0; --i) {
+            block[i].index = base + i;
+            block[i].gen = 0;
+            block[i].next = freeNodes_;
+            freeNodes_ = &block[i];
+        }
+    }
+
+    auto node = freeNodes_;
+    freeNodes_ = static_cast<Node*>(node->next);
+    return node;
+}
+
+void TimerManager::freeNode(Node* node)
+{
+    node->cb = nullptr;
+    ++node->gen; // invalidate the ids referring to this node
+    node->next = freeNodes_;
+    freeNodes_ = node;
+}
+
+TimerManager::Node* TimerManager::findNode(TimerId id) const
+{
+    const uint32_t index = static_cast<uint32_t>(id) - 1;
+    const size_t block = index / kNodesPerBlock;
+    if (block >= blocks_.size()) {
+        return nullptr;
+    }
+
+    auto node = &blocks_[block][index % kNodesPerBlock];
+    // a node being fired has been freed already, so its gen doesn't match either
+    return node->gen == static_cast<uint32_t>(id >> 32) ? node : nullptr;
+}
+
+void TimerManager::detach(Node* node)
+{
+    unlink(node);
+    if (node->level != kPendingLevel) {
+        --levelSize_[node->level];
+    }
+}
+
+void TimerManager::place(Node* node)
+{
+    int64_t tick = node->tick;
+    const int64_t delta = tick - curTick_;
+    int level = 0;
+    if (delta < 0) {
+        // already expired, fire it with the next tick
+        tick = curTick_;
+    } else {
+        while (level != kLevels - 1 && delta >= (int64_t(1) << levelShift(level + 1))) {
+            ++level;
+        }
+        // beyond the range of the wheel, park it at the farthest slot and it will be placed again when cascaded
+        const int64_t maxDelta = (int64_t(1) << (levelShift(kLevels - 1) + kLevelBits)) - 1;
+        if (delta > maxDelta) {
+            tick = curTick_ + maxDelta;
+        }
+    }
+
+    pushBack(slot(level, (tick >> levelShift(level)) & (levelSlots(level) - 1)), node);
+    node->level = level;
+    ++levelSize_[level];
+}
+
+int TimerManager::cascade(int level)
+{
+    const int idx = (curTick_ >> levelShift(level)) & (kLevelSlots - 1);
+    Link* s = slot(level, idx);
+    while (s->next != s) {
+        auto node = static_cast<Node*>(s->next);
+        unlink(node);
+        --levelSize_[level];
+        place(node);
+    }
+    return idx;
+}
+
+void TimerManager::clearList(Link* head)
+{
+    while (head->next != head) {
+        auto node = static_cast<Node*>(head->next);
+        unlink(node);
+        freeNode(node);
+    }
+}
+
+} // namespace ant
@@ -0,0 +1,326 @@
+#include <cassert>
+#include <chrono>
+#include <limits>
+
+#include <libant/system/signal.h>
+#include <libant/timer/timer_service.h>
+
+using namespace std;
+
+namespace ant {
+
+namespace {
+
+// sleepUntil_ while the timer thread is running, so that producers never try to wake it up
+constexpr time_t kAwake = numeric_limits<time_t>::min();
+constexpr time_t kForever = numeric_limits<time_t>::max();
+
+atomic<uint64_t> nextServiceId{1};
+
+} // anonymous namespace
+
+TimerService::TimerService(Executor executor, uint32_t tickMS)
+    : serviceId_(nextServiceId.fetch_add(1, memory_order_relaxed))
+    , executor_(move(executor))
+    , mgr_(tickMS)
+    , sleepUntil_(kAwake)
+{
+    thr_ = thread(&TimerService::run, this);
+}
+
+TimerService::~TimerService()
+{
+    Stop();
+}
+
+time_t TimerService::NowMS()
+{
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+TimerService::Executor TimerService::OnThreadPool(ThreadPoolEx& pool)
+{
+    return [&pool](Callback&& cb, time_t curTimeMS) {
+        pool.Run([cb = move(cb), curTimeMS]() -> shared_ptr<ThreadPoolEx::AbsOutput> {
+            cb(curTimeMS);
+            return nullptr;
+        });
+    };
+}
+
+TimerService::TimerId TimerService::AddTimer(time_t expiringTimeMS, Callback cb)
+{
+    if (stopped_.load(memory_order_acquire)) {
+        return kInvalidTimerId;
+    }
+
+    auto q = localQueue();
+    uint64_t seq = q->addedSeq.load(memory_order_relaxed) + 1;
+    // release pairs with apply() checking ids of Cancel/Reschedule submitted by other threads
+    q->addedSeq.store(seq, memory_order_release);
+    TimerId id = (TimerId(q->index + 1) << kIndexShift) | seq;
+    submit(Command{CommandAdd, id, expiringTimeMS, move(cb)});
+    return id;
+}
+
+void TimerService::Cancel(TimerId id)
+{
+    submit(Command{CommandCancel, id, kForever, nullptr});
+}
+
+void TimerService::Reschedule(TimerId id, time_t expiringTimeMS)
+{
+    submit(Command{CommandReschedule, id, expiringTimeMS, nullptr});
+}
+
+void TimerService::Stop()
+{
+    stopped_.store(true, memory_order_release);
+    {
+        lock_guard<mutex> lock(sleepLock_);
+        stop_ = true;
+        sleepUntil_.store(kAwake);
+    }
+    sleepCond_.notify_one();
+    if (thr_.joinable()) {
+        thr_.join();
+    }
+}
+
+//--------------------------------------------------
+// private methods
+//
+TimerService::SubmitQueue* TimerService::localQueue()
+{
+    struct Cache {
+        uint64_t serviceId;
+        SubmitQueue* queue;
+    };
+    // one entry is enough for the common case of a thread scheduling into a single TimerService
+    static thread_local Cache cache{0, nullptr};
+    if (cache.serviceId == serviceId_) {
+        return cache.queue;
+    }
+
+    lock_guard<mutex> lock(queuesLock_);
+    auto self = this_thread::get_id();
+    SubmitQueue* q = nullptr;
+    for (auto& queue : queues_) {
+        // a queue left by an exited thread can be taken over by a new thread with the same id
+        if (queue->owner == self) {
+            q = queue.get();
+            break;
+        }
+    }
+    if (!q) {
+        queues_.emplace_back(new SubmitQueue);
+        q = queues_.back().get();
+        q->index = queues_.size() - 1;
+        q->owner = self;
+        queueNum_.store(queues_.size(), memory_order_release);
+    }
+    cache = Cache{serviceId_, q};
+    return q;
+}
+
+void TimerService::submit(Command&& cmd)
+{
+    // nobody drains the queues after the timer thread exits
+    if (stopped_.load(memory_order_acquire)) {
+        return;
+    }
+
+    auto q = localQueue();
+    const time_t deadline = (cmd.type == CommandCancel) ? kForever : cmd.timeMS;
+
+    size_t backlog = SubmitQueue::kCapacity;
+    if (!q->spilled.load(memory_order_acquire)) {
+        const size_t tail = q->tail.load(memory_order_relaxed);
+        backlog = tail - q->head.load(memory_order_acquire);
+        if (backlog < SubmitQueue::kCapacity) {
+            q->ring[tail & (SubmitQueue::kCapacity - 1)] = move(cmd);
+            // seq_cst pairs with the timer thread publishing sleepUntil_ and then checking the queues
+            q->tail.store(tail + 1, memory_order_seq_cst);
+        }
+    }
+    if (backlog >= SubmitQueue::kCapacity) {
+        lock_guard<mutex> lock(q->overflowLock);
+        q->overflow.emplace_back(move(cmd));
+        q->spilled.store(true, memory_order_seq_cst);
+    }
+
+    // wake up the timer thread if it's sleeping for a later deadline, or if the queue is filling up
+    const time_t sleepUntil = sleepUntil_.load(memory_order_seq_cst);
+    if (sleepUntil != kAwake && (deadline < sleepUntil || backlog >= SubmitQueue::kCapacity / 2)) {
+        {
+            lock_guard<mutex> lock(sleepLock_);
+            wakeup_ = true;
+            sleepUntil_.store(kAwake, memory_order_relaxed);
+        }
+        sleepCond_.notify_one();
+    }
+}
+
+void TimerService::run()
+{
+    ThreadBlockAllSignals();
+
+    for (;;) {
+        drainQueues();
+        mgr_.Update(NowMS());
+
+        time_t next = kForever;
+        mgr_.NextExpiringTime(next);
+        sleepUntil_.store(next, memory_order_seq_cst);
+        // commands submitted before sleepUntil_ is published haven't tried to wake us up
+        if (hasCommands()) {
+            sleepUntil_.store(kAwake, memory_order_relaxed);
+            continue;
+        }
+
+        unique_lock<mutex> lock(sleepLock_);
+        while (!wakeup_ && !stop_) {
+            if (next == kForever) {
+                sleepCond_.wait(lock);
+            } else if (sleepCond_.wait_until(lock, chrono::steady_clock::time_point(chrono::milliseconds(next)))
+                       == cv_status::timeout) {
+                break;
+            }
+        }
+        if (stop_) {
+            break;
+        }
+        wakeup_ = false;
+        sleepUntil_.store(kAwake, memory_order_relaxed);
+    }
+
+    mgr_.Clear();
+    ids_.clear();
+    earlyCommands_.clear();
+}
+
+void TimerService::drainQueues()
+{
+    refreshQueues();
+    for (auto q : merging_) {
+        // Once spilled, the producer doesn't touch the ring until the overflow is taken. Checking `spilled` before
+        // loading `tail` ensures the ring is drained up to the first spilled command, which keeps commands in order.
+        const bool spilled = q->spilled.load(memory_order_acquire);
+        const size_t tail = q->tail.load(memory_order_acquire);
+        size_t head = q->head.load(memory_order_relaxed);
+        for (; head != tail; ++head) {
+            auto& cmd = q->ring[head & (SubmitQueue::kCapacity - 1)];
+            apply(*q, cmd);
+            cmd.cb = nullptr;
+        }
+        q->head.store(head, memory_order_release);
+
+        if (spilled) {
+            vector<Command> overflow;
+            {
+                lock_guard<mutex> lock(q->overflowLock);
+                overflow.swap(q->overflow);
+                q->spilled.store(false, memory_order_release);
+            }
+            for (auto& cmd : overflow) {
+                apply(*q, cmd);
+            }
+        }
+    }
+}
+
+void TimerService::apply(SubmitQueue& q, Command& cmd)
+{
+    const TimerId id = cmd.id;
+    if (cmd.type == CommandAdd) {
+        time_t expiringTimeMS = cmd.timeMS;
+        q.mergedSeq = id & ((TimerId(1) << kIndexShift) - 1);
+        if (!earlyCommands_.empty()) {
+            auto it = earlyCommands_.find(id);
+            if (it != earlyCommands_.end()) {
+                bool cancelled = it->second.cancelled;
+                expiringTimeMS = it->second.timeMS;
+                earlyCommands_.erase(it);
+                if (cancelled) {
+                    return;
+                }
+            }
+        }
+        ids_[id] = mgr_.AddTimer(expiringTimeMS, [this, id, cb = move(cmd.cb)](time_t curTimeMS) mutable {
+            ids_.erase(id);
+            fire(move(cb), curTimeMS);
+        });
+        return;
+    }
+
+    auto it = ids_.find(id);
+    if (it != ids_.end()) {
+        if (cmd.type == CommandCancel) {
+            mgr_.Cancel(it->second);
+            ids_.erase(it);
+        } else {
+            mgr_.Reschedule(it->second, cmd.timeMS);
+        }
+        return;
+    }
+
+    // The timer has fired, or it's added by another thread whose queue hasn't been merged that far
+    const size_t index = (id >> kIndexShift) - 1;
+    if (index >= queueNum_.load(memory_order_acquire)) {
+        return; // invalid id
+    }
+    SubmitQueue* owner;
+    if (index < merging_.size()) {
+        owner = merging_[index];
+    } else {
+        lock_guard<mutex> lock(queuesLock_);
+        owner = queues_[index].get();
+    }
+    // Only ids returned by AddTimer() are remembered, so that every entry is removed once its timer arrives, and
+    // earlyCommands_ never grows beyond the timers on their way
+    const uint64_t seq = id & ((TimerId(1) << kIndexShift) - 1);
+    if (seq > owner->mergedSeq && seq <= owner->addedSeq.load(memory_order_acquire)) {
+        auto& early = earlyCommands_[id];
+        if (cmd.type == CommandCancel) {
+            early.cancelled = true;
+        } else if (!early.cancelled) {
+            early.timeMS = cmd.timeMS;
+        }
+    }
+}
+
+void TimerService::fire(Callback&& cb, time_t curTimeMS)
+{
+    if (executor_) {
+        executor_(move(cb), curTimeMS);
+    } else {
+        cb(curTimeMS);
+    }
+}
+
+void TimerService::refreshQueues()
+{
+    if (merging_.size() != queueNum_.load(memory_order_acquire)) {
+        lock_guard<mutex> lock(queuesLock_);
+        merging_.clear();
+        for (auto& q : queues_) {
+            merging_.push_back(q.get());
+        }
+    }
+}
+
+bool TimerService::hasCommands()
+{
+    if (merging_.size() != queueNum_.load(memory_order_seq_cst)) {
+        return true;
+    }
+    for (auto q : merging_) {
+        if (q->tail.load(memory_order_seq_cst) != q->head.load(memory_order_relaxed)
+            || q->spilled.load(memory_order_seq_cst)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace ant
@@ -0,0 +1,74 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <libant/system/epoll.h>
+
+using namespace std;
+
+// Each socket pair keeps one byte bouncing between its two ends, so every wakeup costs a read and a write.
+
+static ant::EventPoll* sPoll;
+static vector<int> sFDs;
+static long sRounds;
+
+static void onReadable(int fd)
+{
+    char c;
+    while (read(fd, &c, 1) == 1) {
+        if (--sRounds == 0) {
+            for (auto sock : sFDs) {
+                sPoll->Remove(sock);
+            }
+            return;
+        }
+        std::ignore = write(fd, &c, 1);
+    }
+}
+
+static void onWritable(int)
+{
+}
+
+static void runBench(ant::EventPoll::Backend backend, int pairs, long rounds)
+{
+    ant::EventPoll poll(pairs * 2 + 64, -1, backend);
+    sPoll = &poll;
+    sRounds = rounds;
+    sFDs.clear();
+    for (int i = 0; i != pairs; ++i) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv) == -1) {
+            perror("socketpair");
+            exit(-1);
+        }
+        poll.Add(sv[0], ant::EventPoll::EventIn, onReadable, onWritable);
+        poll.Add(sv[1], ant::EventPoll::EventIn, onReadable, onWritable);
+        sFDs.push_back(sv[0]);
+        sFDs.push_back(sv[1]);
+        std::ignore = write(sv[0], "x", 1);
+    }
+
+    auto start = chrono::steady_clock::now();
+    poll.Dispatch();
+    auto elapsed = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+
+    for (auto fd : sFDs) {
+        close(fd);
+    }
+    printf("%-8s pairs=%-6d rounds=%ld elapsed=%lldus %.0f msgs/s\n", poll.GetBackend() == ant::EventPoll::BackendIoUring ? "io_uring" : "epoll",
+           pairs, rounds, static_cast<long long>(elapsed), rounds * 1e6 / elapsed);
+}
+
+int main(int argc, char* argv[])
+{
+    long rounds = argc > 1 ? atol(argv[1]) : 1000000;
+    for (int pairs : {1, 100, 1000}) {
+        runBench(ant::EventPoll::BackendEpoll, pairs, rounds);
+        runBench(ant::EventPoll::BackendIoUring, pairs, rounds);
+    }
+}
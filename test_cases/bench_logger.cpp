@@ -0,0 +1,170 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <libant/logger/logger.h>
+
+using namespace std;
+
+// Logs are written into tmpfs, so that the numbers don't depend on the disk
+static string makeBenchDir()
+{
+    char tmpl[] = "/dev/shm/bench_logger.XXXXXX";
+    char tmplFallback[] = "/tmp/bench_logger.XXXXXX";
+    auto dir = mkdtemp(tmpl);
+    if (!dir) {
+        dir = mkdtemp(tmplFallback);
+    }
+    if (!dir) {
+        perror("mkdtemp");
+        exit(1);
+    }
+    return dir;
+}
+
+static string flagsName(uint32_t flags)
+{
+    static const char* names[] = {"LogThrough", "LogDate", "NoPrepends", "NoSymlinks", "CoarseClock", "LogMicroseconds", "SingleFile"};
+    string s;
+    for (size_t i = 0; i != sizeof(names) / sizeof(names[0]); ++i) {
+        if (flags & (1u << i)) {
+            s += s.empty() ? "" : "|";
+            s += names[i];
+        }
+    }
+    return s.empty() ? "None" : s;
+}
+
+struct Result {
+    double logsPerSecond;
+    // per-call latencies in nanoseconds, empty if not measured
+    vector<int64_t> latencies;
+};
+
+// Write `logsPerThread` logs from each of `threads` threads. The logfiles are 1MB at most, so the runs include rotations.
+static Result runBench(uint32_t flags, bool mutex, ant::Logger::LogDest dest, int threads, int logsPerThread, bool measureLatency,
+                       void (*setup)(ant::Logger::Cfg&) = nullptr)
+{
+    auto dir = makeBenchDir();
+    ant::Logger::Cfg cfg(dir, "bench", 1, mutex, ant::Logger::LogLevelTrace, dest, flags);
+    if (setup) {
+        setup(cfg);
+    }
+
+    Result res;
+    vector<vector<int64_t>> latencies(threads);
+    {
+        ant::Logger logger(cfg);
+        auto worker = [&](int t) {
+            auto& lat = latencies[t];
+            if (measureLatency) {
+                lat.reserve(logsPerThread);
+            }
+            for (int i = 0; i != logsPerThread; ++i) {
+                if (measureLatency) {
+                    auto start = chrono::steady_clock::now();
+                    logger.Log(ant::Logger::LogLevelInfo, FMT_STRING("bench.cpp:42] thread={} seq={} user={} cost={:.3f}"), t, i, "someone", 1.25);
+                    lat.push_back(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+                } else {
+                    logger.Log(ant::Logger::LogLevelInfo, FMT_STRING("bench.cpp:42] thread={} seq={} user={} cost={:.3f}"), t, i, "someone", 1.25);
+                }
+            }
+        };
+
+        auto start = chrono::steady_clock::now();
+        if (threads == 1) {
+            worker(0);
+        } else {
+            vector<thread> thrs;
+            for (int t = 0; t != threads; ++t) {
+                thrs.emplace_back(worker, t);
+            }
+            for (auto& thr : thrs) {
+                thr.join();
+            }
+        }
+        logger.Flush();
+        auto ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        res.logsPerSecond = 1e9 * threads * logsPerThread / static_cast<double>(ns);
+    }
+    filesystem::remove_all(dir);
+
+    for (auto& lat : latencies) {
+        res.latencies.insert(res.latencies.end(), lat.begin(), lat.end());
+    }
+    sort(res.latencies.begin(), res.latencies.end());
+    return res;
+}
+
+static int64_t percentile(const vector<int64_t>& sorted, double p)
+{
+    return sorted.empty() ? 0 : sorted[min(sorted.size() - 1, static_cast<size_t>(p * static_cast<double>(sorted.size())))];
+}
+
+static void printLatency(const char* name, int threads, const Result& res)
+{
+    auto& lat = res.latencies;
+    printf("%-26s threads=%-2d %9.0f logs/s  p50=%5lldns p99=%6lldns p99.9=%7lldns max=%8lldns\n", name, threads, res.logsPerSecond,
+           static_cast<long long>(percentile(lat, 0.5)), static_cast<long long>(percentile(lat, 0.99)),
+           static_cast<long long>(percentile(lat, 0.999)), static_cast<long long>(lat.empty() ? 0 : lat.back()));
+}
+
+// Console logs go to stdout, which is pointed at /dev/null while they are written
+static Result runConsoleBench(bool mutex, int threads, int logsPerThread)
+{
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    FILE* devNull = fopen("/dev/null", "w");
+    dup2(fileno(devNull), STDOUT_FILENO);
+    auto res = runBench(ant::Logger::ControlFlagNone, mutex, ant::Logger::LogDestConsole, threads, logsPerThread, true);
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    fclose(devNull);
+    return res;
+}
+
+/**
+ * Usage: bench_logger [logsPerRun] [threads]
+ */
+int main(int argc, char* argv[])
+{
+    int n = argc > 1 ? atoi(argv[1]) : 200000;
+    int threads = argc > 2 ? atoi(argv[2]) : 4;
+
+    printf("single thread throughput of every ControlFlag combination, no mutex, %d logs each\n", n);
+    for (uint32_t flags = 0; flags != ant::Logger::ControlFlagSingleFile * 2; ++flags) {
+        auto res = runBench(flags, false, ant::Logger::LogDestFile, 1, n, false);
+        printf("%-80s %9.0f logs/s\n", flagsName(flags).c_str(), res.logsPerSecond);
+    }
+
+    printf("\nlatency, %d logs in total per run\n", n);
+    for (int thr : {1, threads}) {
+        int perThread = n / thr;
+        if (thr == 1) {
+            printLatency("no mutex", thr, runBench(ant::Logger::ControlFlagNone, false, ant::Logger::LogDestFile, thr, perThread, true));
+        }
+        printLatency("mutex", thr, runBench(ant::Logger::ControlFlagNone, true, ant::Logger::LogDestFile, thr, perThread, true));
+        printLatency("mutex log through", thr, runBench(ant::Logger::ControlFlagLogThrough, true, ant::Logger::LogDestFile, thr, perThread, true));
+        printLatency("mutex single file", thr, runBench(ant::Logger::ControlFlagSingleFile, true, ant::Logger::LogDestFile, thr, perThread, true));
+        printLatency("mutex coarse clock", thr, runBench(ant::Logger::ControlFlagCoarseClock, true, ant::Logger::LogDestFile, thr, perThread, true));
+        printLatency("mutex mmap", thr, runBench(ant::Logger::ControlFlagNone, true, ant::Logger::LogDestFile, thr, perThread, true, [](ant::Logger::Cfg& cfg) {
+                         cfg.SetMmap(1);
+                     }));
+        printLatency("async block", thr, runBench(ant::Logger::ControlFlagNone, true, ant::Logger::LogDestFile, thr, perThread, true, [](ant::Logger::Cfg& cfg) {
+                         cfg.SetAsync(ant::Logger::OverflowBlock);
+                     }));
+        printLatency("async binary", thr, runBench(ant::Logger::ControlFlagNone, true, ant::Logger::LogDestFile, thr, perThread, true, [](ant::Logger::Cfg& cfg) {
+                         cfg.SetAsync(ant::Logger::OverflowBlock);
+                         cfg.SetFormatMode(ant::Logger::FormatBinary);
+                     }));
+        printLatency("mutex console(/dev/null)", thr, runConsoleBench(true, thr, perThread));
+    }
+}
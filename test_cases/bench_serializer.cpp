@@ -0,0 +1,110 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <libant/encoding/binary/serializer.h>
+
+using namespace std;
+
+using Buffer = ant::BinaryBuffer<ant::Endian::BigEndian>;
+using Reader = ant::BinaryReader<ant::Endian::BigEndian>;
+
+struct Pos {
+    int32_t x;
+    int32_t y;
+    int32_t z;
+};
+ANT_SERIALIZABLE(Pos, x, y, z)
+
+struct Move {
+    uint32_t uid;
+    uint16_t zone;
+    uint8_t state;
+    int64_t time;
+    Pos from;
+    Pos to;
+    uint32_t speed;
+    string name;
+    vector<uint32_t> buffs;
+};
+ANT_SERIALIZABLE(Move, uid, zone, state, time, from, to, speed, name, buffs)
+
+// What has to be written without the serializer
+static void encodeByHand(Buffer& buf, const Move& m)
+{
+    buf.AppendInteger(m.uid);
+    buf.AppendInteger(m.zone);
+    buf.AppendInteger(m.state);
+    buf.AppendInteger(m.time);
+    buf.AppendInteger(m.from.x);
+    buf.AppendInteger(m.from.y);
+    buf.AppendInteger(m.from.z);
+    buf.AppendInteger(m.to.x);
+    buf.AppendInteger(m.to.y);
+    buf.AppendInteger(m.to.z);
+    buf.AppendInteger(m.speed);
+    buf.AppendVarint(m.name.size());
+    buf.AppendString(m.name.data(), m.name.size());
+    buf.AppendVarint(m.buffs.size());
+    for (auto b : m.buffs) {
+        buf.AppendInteger(b);
+    }
+}
+
+static bool decodeByHand(Reader& reader, Move& m)
+{
+    uint32_t n;
+    if (!(reader.ReadInteger(m.uid) && reader.ReadInteger(m.zone) && reader.ReadInteger(m.state) && reader.ReadInteger(m.time)
+          && reader.ReadInteger(m.from.x) && reader.ReadInteger(m.from.y) && reader.ReadInteger(m.from.z) && reader.ReadInteger(m.to.x)
+          && reader.ReadInteger(m.to.y) && reader.ReadInteger(m.to.z) && reader.ReadInteger(m.speed) && reader.ReadVarint(n))) {
+        return false;
+    }
+    string_view name;
+    if (!reader.ReadBytes(n, name) || !reader.ReadVarint(n) || n > reader.RemainingLength() / sizeof(uint32_t)) {
+        return false;
+    }
+    m.name.assign(name.data(), name.size());
+    m.buffs.resize(n);
+    for (auto& b : m.buffs) {
+        reader.ReadInteger(b);
+    }
+    return true;
+}
+
+template<typename Encode, typename Decode>
+static void runBench(const char* name, int n, const Move& m, Encode encode, Decode decode)
+{
+    Buffer buf(1024);
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i != n; ++i) {
+        buf.Clear();
+        encode(buf, m);
+    }
+    auto encodeNS = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+
+    Move got;
+    long ok = 0;
+    start = chrono::steady_clock::now();
+    for (int i = 0; i != n; ++i) {
+        Reader reader(buf.Data(), buf.Size());
+        ok += decode(reader, got);
+    }
+    auto decodeNS = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    printf("%-10s size=%u encode=%.1fns decode=%.1fns ok=%ld\n", name, buf.Size(), double(encodeNS) / n, double(decodeNS) / n, ok);
+}
+
+/**
+ * Usage: bench_serializer [iterations]
+ */
+int main(int argc, char* argv[])
+{
+    int n = argc > 1 ? atoi(argv[1]) : 5000000;
+    Move m{12321, 7, 1, 1600000000000, {1, 2, 3}, {4, 5, 6}, 300, "antigloss", {1, 2, 3, 4, 5, 6, 7, 8}};
+    for (int round = 0; round != 2; ++round) {
+        runBench("by hand", n, m, encodeByHand, decodeByHand);
+        runBench("serializer", n, m, [](Buffer& buf, const Move& m) { ant::Serialize(buf, m); },
+                 [](Reader& reader, Move& m) { return ant::Deserialize(reader, m); });
+    }
+}
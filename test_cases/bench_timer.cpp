@@ -0,0 +1,76 @@
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <vector>
+
+#include <libant/timer/timer.h>
+
+using namespace std;
+
+// The multimap based TimerManager that the timing wheel replaced
+class MultimapTimerManager {
+public:
+    void Update(time_t curTimeMS)
+    {
+        for (auto iter = timers_.begin(); iter != timers_.end(); iter = timers_.erase(iter)) {
+            if (iter->first > curTimeMS) {
+                break;
+            }
+            iter->second(curTimeMS);
+        }
+    }
+
+    void AddTimer(time_t expiringTimeMS, std::function<void(time_t curTimeMS)> cb)
+    {
+        timers_.emplace(std::make_pair(expiringTimeMS, std::move(cb)));
+    }
+
+private:
+    std::multimap<time_t, std::function<void(time_t curTimeMS)>> timers_;
+};
+
+static long long elapsedMS(chrono::steady_clock::time_point start)
+{
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+}
+
+// Add `n` timers expiring within one minute, then drive the manager 1ms by 1ms until all of them fire.
+// Every fired timer re-arms itself once, like a session timeout being pushed back.
+template<typename Manager>
+static void runBench(const char* name, int n)
+{
+    Manager mgr;
+    mt19937 rng(12345);
+    vector<time_t> expiringTimes(n);
+    for (auto& t : expiringTimes) {
+        t = 1 + rng() % 60000;
+    }
+
+    long fired = 0;
+    time_t now = 0;
+    mgr.Update(now);
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i != n; ++i) {
+        mgr.AddTimer(expiringTimes[i], [&mgr, &fired](time_t cur) {
+            if (++fired & 1) {
+                mgr.AddTimer(cur + 30000, [&fired](time_t) { ++fired; });
+            }
+        });
+    }
+    auto addMS = elapsedMS(start);
+
+    start = chrono::steady_clock::now();
+    while (now < 100000) {
+        mgr.Update(++now);
+    }
+    auto updateMS = elapsedMS(start);
+    printf("%-9s timers=%d add=%lldms update+rearm=%lldms fired=%ld\n", name, n, addMS, updateMS, fired);
+}
+
+int main(int argc, char* argv[])
+{
+    int n = argc > 1 ? atoi(argv[1]) : 1000000;
+    runBench<MultimapTimerManager>("multimap", n);
+    runBench<ant::TimerManager>("wheel", n);
+}
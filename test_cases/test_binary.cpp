@@ -0,0 +1,470 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <libant/encoding/binary/binary_buffer.h>
+#include <libant/encoding/binary/binary_chain_buffer.h>
+#include <libant/encoding/binary/binary_reader.h>
+#include <libant/encoding/binary/binary_stream_reader.h>
+#include <libant/encoding/binary/frame_codec.h>
+#include <libant/encoding/binary/serializer.h>
+
+using namespace std;
+
+using Buffer = ant::BinaryBuffer<ant::Endian::BigEndian>;
+using Reader = ant::BinaryReader<ant::Endian::BigEndian>;
+
+static void testVarint()
+{
+    static_assert(ant::ZigZagEncode(int32_t(0)) == 0 && ant::ZigZagEncode(int32_t(-1)) == 1 && ant::ZigZagEncode(int32_t(1)) == 2);
+    static_assert(ant::ZigZagDecode(ant::ZigZagEncode(numeric_limits<int64_t>::min())) == numeric_limits<int64_t>::min());
+    static_assert(ant::ZigZagDecode(ant::ZigZagEncode(numeric_limits<int8_t>::max())) == numeric_limits<int8_t>::max());
+
+    Buffer buf(16, 10);
+    const vector<uint64_t> values = {0, 1, 127, 128, 300, 16383, 16384, (1ull << 56) - 1, 1ull << 56, numeric_limits<uint64_t>::max()};
+    for (auto v : values) {
+        buf.AppendVarint(v);
+    }
+    buf.AppendVarint(int32_t(-1));
+    buf.AppendVarint(numeric_limits<int64_t>::min());
+    buf.AppendFixedPoint(-12.346, 2);
+    buf.AppendVarint(uint32_t(300)); // too large for uint8
+    buf.PrependVarint(uint32_t(buf.Size()));
+
+    Reader reader(buf.Data(), buf.Size());
+    uint32_t len;
+    assert(reader.ReadVarint(len) && len == reader.RemainingLength());
+    for (auto v : values) {
+        uint64_t got;
+        assert(reader.ReadVarint(got) && got == v);
+    }
+    int32_t i32;
+    int64_t i64;
+    double d;
+    uint8_t u8;
+    assert(reader.ReadVarint(i32) && i32 == -1);
+    assert(reader.ReadVarint(i64) && i64 == numeric_limits<int64_t>::min());
+    assert(reader.ReadFixedPoint(d, 2) && fabs(d + 12.35) < 1e-9);
+    auto pos = reader.CurrentPosition();
+    assert(!reader.ReadVarint(u8) && reader.CurrentPosition() == pos);
+
+    // truncated and overlong
+    const char truncated[] = {char(0x80), char(0x80)};
+    assert(!Reader(truncated, sizeof(truncated)).ReadVarint(i64));
+    const char overlong[] = {char(0xFF), char(0xFF), char(0xFF), char(0xFF), char(0xFF), char(0xFF), char(0xFF), char(0xFF), char(0xFF), 0x02};
+    assert(!Reader(overlong, sizeof(overlong)).ReadVarint(i64));
+}
+
+static void testVarints()
+{
+    vector<int32_t> vals;
+    for (int i = 0; i != 1000; ++i) {
+        vals.push_back(i % 7 ? i % 50 - 25 : i * 1000 - 300000);
+    }
+    Buffer buf;
+    buf.AppendVarints(vals.data(), vals.size());
+
+    vector<int32_t> got(vals.size());
+    Reader reader(buf.Data(), buf.Size());
+    assert(reader.ReadVarints(got.data(), got.size()) && got == vals && reader.RemainingLength() == 0);
+    Reader truncatedReader(buf.Data(), buf.Size() - 1);
+    assert(!truncatedReader.ReadVarints(got.data(), got.size()) && truncatedReader.CurrentPosition() == 0);
+}
+
+template<ant::Endian endian, typename T>
+static void testArray(size_t count)
+{
+    vector<T> vals(count);
+    for (size_t i = 0; i != count; ++i) {
+        vals[i] = static_cast<T>(0x0102030405060708ull * (i + 1));
+    }
+    ant::BinaryBuffer<endian> buf(16);
+    buf.AppendArray(vals.data(), vals.size());
+    ant::BinaryBuffer<endian> expected(16);
+    for (auto v : vals) {
+        expected.AppendInteger(v);
+    }
+    assert(buf.Size() == expected.Size() && memcmp(buf.Data(), expected.Data(), buf.Size()) == 0);
+
+    vector<T> got(count + 1);
+    ant::BinaryReader<endian> reader(buf.Data(), buf.Size());
+    assert(!reader.ReadArray(got.data(), count + 1) && reader.CurrentPosition() == 0);
+    assert(reader.ReadArray(got.data(), count) && equal(vals.begin(), vals.end(), got.begin()) && reader.RemainingLength() == 0);
+}
+
+static void testArrays()
+{
+    // odd counts to cover the scalar tails of the SIMD loops
+    for (size_t count : {0, 1, 7, 33, 1001}) {
+        testArray<ant::Endian::BigEndian, uint16_t>(count);
+        testArray<ant::Endian::BigEndian, int32_t>(count);
+        testArray<ant::Endian::BigEndian, uint64_t>(count);
+        testArray<ant::Endian::LittleEndian, int8_t>(count);
+        testArray<ant::Endian::LittleEndian, uint32_t>(count);
+    }
+}
+
+static void testViews()
+{
+    Buffer buf;
+    buf.AppendString<uint16_t>(string("hello"));
+    buf.AppendInteger(uint32_t(0xAABBCCDD));
+    buf.AppendString("world", 5);
+    buf.AppendInteger(uint16_t(100)); // length of a truncated string
+
+    Reader reader(buf.Data(), buf.Size());
+    string_view view;
+    assert(reader.ReadStringView<uint16_t>(view) && view == "hello" && view.data() == static_cast<const char*>(buf.Data()) + 2);
+    uint32_t u32 = 0;
+    assert(reader.PeekInteger(u32) && u32 == 0xAABBCCDD && reader.CurrentPosition() == 7);
+    assert(reader.Skip(4) && reader.PeekBytes(5, view) && view == "world" && reader.CurrentPosition() == 11);
+    assert(reader.ReadBytes(5, view) && view == "world");
+    auto pos = reader.CurrentPosition();
+    string str;
+    assert(!reader.ReadStringView<uint16_t>(view) && !reader.ReadString<uint16_t>(str) && reader.CurrentPosition() == pos);
+    assert(!reader.ReadBytes(3, view) && !reader.Skip(3) && reader.CurrentPosition() == pos);
+    reader.ReadStringView(view);
+    assert(view.size() == 2 && reader.RemainingLength() == 0);
+}
+
+namespace msg {
+
+enum class Color : uint8_t { Red = 1, Blue = 2 };
+
+struct Pos {
+    int32_t x;
+    int32_t y;
+};
+ANT_SERIALIZABLE(Pos, x, y)
+
+struct Player {
+    uint32_t uid;
+    Color color;
+    Pos pos;
+    double score;
+    std::string name;
+    std::vector<int64_t> items;
+    std::vector<Pos> path;
+    std::optional<uint16_t> guild;
+    std::optional<Pos> home;
+    std::vector<std::string> tags;
+    std::string_view note;
+};
+ANT_SERIALIZABLE(Player, uid, color, pos, score, name, items, path, guild, home, tags, note)
+
+} // namespace msg
+
+static void testSerializer()
+{
+    static_assert(ant::detail::FixedSize<msg::Pos>() == 8 && ant::detail::FixedSize<msg::Player>() == 0);
+
+    msg::Player player{12321, msg::Color::Blue, {-1, 2}, 0.5, "ant", {1, -2, 3}, {{3, 4}, {5, 6}}, 7, std::nullopt, {"a", "bc"}, "note"};
+    Buffer buf;
+    ant::Serialize(buf, player);
+
+    // the leading fields of fixed size are encoded as AppendInteger does
+    Buffer expected;
+    expected.AppendInteger(uint32_t(12321));
+    expected.AppendInteger(uint8_t(2));
+    expected.AppendInteger(int32_t(-1));
+    expected.AppendInteger(int32_t(2));
+    assert(memcmp(buf.Data(), expected.Data(), expected.Size()) == 0);
+
+    msg::Player got{};
+    Reader reader(buf.Data(), buf.Size());
+    assert(ant::Deserialize(reader, got) && reader.RemainingLength() == 0);
+    assert(got.uid == player.uid && got.color == player.color && got.pos.x == -1 && got.pos.y == 2 && got.score == 0.5);
+    assert(got.name == "ant" && got.items == player.items && got.path.size() == 2 && got.path[1].y == 6);
+    assert(got.guild == 7 && !got.home && got.tags == player.tags && got.note == "note");
+    assert(got.note.data() >= static_cast<const char*>(buf.Data()) && got.note.data() < static_cast<const char*>(buf.Data()) + buf.Size());
+
+    for (uint32_t len = 0; len != buf.Size(); ++len) {
+        Reader truncated(buf.Data(), len);
+        assert(!ant::Deserialize(truncated, got));
+    }
+}
+
+static void testStreamReader()
+{
+    // frames of {uint16 length, varint seq, payload}
+    Buffer buf;
+    const int kFrames = 50;
+    for (int i = 0; i != kFrames; ++i) {
+        Buffer frame(16, 2);
+        frame.AppendVarint(uint64_t(i) << (i % 60));
+        frame.AppendString(string(i, 'x'));
+        frame.PrependInteger(uint16_t(frame.Size()));
+        buf.AppendString(frame.Data(), frame.Size());
+    }
+
+    auto data = static_cast<const char*>(buf.Data());
+    for (size_t chunkSize : {1, 2, 3, 7, 64, 1024}) {
+        ant::BinaryStreamReader<ant::Endian::BigEndian> reader;
+        string scratch;
+        int frames = 0;
+        for (size_t pos = 0; pos < buf.Size(); pos += chunkSize) {
+            reader.Append(data + pos, min<size_t>(chunkSize, buf.Size() - pos));
+            for (;;) {
+                uint16_t len;
+                string_view body;
+                if (!reader.ReadInteger(len) || !reader.ReadBytes(len, body, scratch)) {
+                    reader.Rollback();
+                    break;
+                }
+                uint64_t seq;
+                Reader bodyReader(body.data(), body.size());
+                assert(bodyReader.ReadVarint(seq) && seq == uint64_t(frames) << (frames % 60));
+                assert(bodyReader.RemainingLength() == size_t(frames));
+                reader.Commit();
+                ++frames;
+            }
+        }
+        assert(frames == kFrames && reader.Available() == 0);
+    }
+
+    // varints and integers spanning chunks, read in a transaction
+    ant::BinaryStreamReader<ant::Endian::LittleEndian> reader;
+    ant::BinaryBuffer<ant::Endian::LittleEndian> le;
+    le.AppendVarint(numeric_limits<uint64_t>::max());
+    le.AppendInteger(uint32_t(0xAABBCCDD));
+    auto read = [](ant::BinaryStreamReader<ant::Endian::LittleEndian>& r) {
+        uint64_t v;
+        uint32_t u;
+        return r.ReadVarint(v) && v == numeric_limits<uint64_t>::max() && r.ReadInteger(u) && u == 0xAABBCCDD;
+    };
+    auto leData = static_cast<const char*>(le.Data());
+    for (uint32_t i = 0; i != le.Size(); ++i) {
+        assert(!reader.Transact(read) && reader.Available() == i);
+        reader.Append(leData + i, 1);
+    }
+    assert(reader.Transact(read) && reader.Available() == 0);
+    assert(!reader.Malformed());
+
+    // zero length bodies are valid, even when no chunk is queued, or every chunk has been released
+    string_view empty("x");
+    string scratch;
+    ant::BinaryStreamReader<ant::Endian::LittleEndian> none;
+    assert(none.ReadBytes(0, empty, scratch) && empty.empty());
+    reader.Commit();
+    empty = "x";
+    assert(reader.ReadBytes(0, empty, scratch) && empty.empty());
+
+    // an 11 byte varint is malformed, however it's split, while a truncated one just needs more data
+    const string overlong(10, '\x80');
+    for (size_t split = 1; split <= overlong.size(); ++split) {
+        ant::BinaryStreamReader<ant::Endian::LittleEndian> r;
+        uint64_t v;
+        r.Append(overlong.substr(0, split));
+        assert(!r.ReadVarint(v) && r.Malformed() == (split == overlong.size()));
+        r.Append(overlong.substr(split) + '\x01');
+        assert(!r.ReadVarint(v) && r.Malformed() && r.Available() == 11);
+    }
+    // so is one which doesn't fit in the type it's read into
+    ant::BinaryStreamReader<ant::Endian::LittleEndian> r;
+    uint8_t u8;
+    r.Append("\x80\x02", 2);
+    assert(!r.ReadVarint(u8) && r.Malformed() && r.Available() == 2);
+}
+
+static int gAllocations = 0;
+
+template<typename T>
+struct CountingAllocator : allocator<T> {
+    T* allocate(size_t n)
+    {
+        ++gAllocations;
+        return allocator<T>::allocate(n);
+    }
+};
+
+static void testGrowth()
+{
+    ant::BinaryBuffer<ant::Endian::BigEndian, CountingAllocator<char>> buf(16, 4);
+    for (int i = 0; i != 1024 * 1024; ++i) {
+        buf.AppendInteger(uint8_t(i));
+    }
+    buf.PrependInteger(buf.Size());
+    assert(gAllocations <= 20 && buf.Size() == 1024 * 1024 + 4);
+
+    auto block = buf.Release();
+    assert(block.size == 1024 * 1024 + 4 && block.offset == 0 && static_cast<uint8_t>(block.mem[4 + 300]) == 300 % 256);
+    assert(buf.Size() == 0 && buf.Capacity() == 0 && buf.Data() == nullptr);
+    buf.Adopt(block);
+    assert(buf.Size() == 0 && buf.Capacity() == block.capacity && buf.Data() == block.mem + 4);
+    gAllocations = 0;
+    buf.Reserve(block.capacity - 4);
+    buf.PrependInteger(uint32_t(0));
+    assert(gAllocations == 0);
+
+    // allocates anew after released
+    CountingAllocator<char>().deallocate(buf.Release().mem, block.capacity);
+    buf.AppendInteger(uint32_t(1));
+    buf.PrependInteger(uint32_t(2));
+    assert(gAllocations == 1 && buf.Size() == 8);
+}
+
+static void testChainBuffer()
+{
+    auto pool = ant::BinaryChainBuffer<ant::Endian::BigEndian>::StringBufferPool::CreateBufferPool(1024 * 1024);
+    ant::BinaryChainBuffer<ant::Endian::BigEndian> chain(pool, 64, 32, 4);
+    Buffer expected(16, 4);
+    const string blob(1000, 'b');
+    auto shared = make_shared<const string>(100, 's');
+    vector<uint32_t> arr(50, 0x01020304);
+
+    for (int round = 0; round != 2; ++round) {
+        for (int i = 0; i != 10; ++i) {
+            chain.AppendInteger(uint16_t(i));
+            expected.AppendInteger(uint16_t(i));
+            chain.AppendVarint(-i * 1000);
+            expected.AppendVarint(-i * 1000);
+        }
+        chain.AppendStringRef<uint32_t>(blob.data(), blob.size());
+        expected.AppendString<uint32_t>(blob.data(), blob.size());
+        chain.AppendStringRef("tiny", 4); // copied
+        expected.AppendString("tiny", 4);
+        chain.AppendStringRef(shared);
+        expected.AppendString(*shared);
+        chain.AppendArray(arr.data(), arr.size());
+        expected.AppendArray(arr.data(), arr.size());
+        chain.AppendString(string(100, 'c'));
+        expected.AppendString(string(100, 'c'));
+        chain.PrependInteger(uint32_t(chain.Size()));
+        expected.PrependInteger(uint32_t(expected.Size()));
+
+        string flat;
+        chain.CopyTo(flat);
+        assert(flat.size() == chain.Size() && flat == string(reinterpret_cast<const char*>(expected.Data()), expected.Size()));
+        // the blobs are referenced rather than copied
+        size_t refs = 0;
+        for (auto& iov : chain.Iovecs()) {
+            refs += (iov.iov_base == blob.data() && iov.iov_len == blob.size()) || (iov.iov_base == shared->data() && iov.iov_len == shared->size());
+        }
+        assert(refs == 2);
+
+        chain.Clear();
+        expected.Clear();
+        assert(chain.Size() == 0);
+    }
+
+    // large copies take a single iovec rather than one per chunk, keeping far below IOV_MAX
+    const string big(4 * 1024 * 1024, 'B');
+    vector<uint32_t> bigArr(256 * 1024, 0x01020304);
+    chain.AppendInteger(uint16_t(1));
+    expected.AppendInteger(uint16_t(1));
+    chain.AppendString(big);
+    expected.AppendString(big);
+    chain.AppendArray(bigArr.data(), bigArr.size());
+    expected.AppendArray(bigArr.data(), bigArr.size());
+    assert(chain.Iovecs().size() <= 4);
+    string flat;
+    chain.CopyTo(flat);
+    assert(flat == string(reinterpret_cast<const char*>(expected.Data()), expected.Size()));
+    chain.Clear();
+    chain.AppendString("after", 5);
+    assert(chain.Size() == 5 && chain.Iovecs().size() == 1);
+}
+
+static void testFrameCodec()
+{
+    vector<string> msgs;
+    for (int i = 0; i != 40; ++i) {
+        msgs.emplace_back(i * 7, static_cast<char>('a' + i % 26));
+    }
+    msgs.emplace_back(300, 'z');
+    vector<string_view> views(msgs.begin(), msgs.end());
+
+    for (auto header : {ant::FrameHeader::BigEndian16, ant::FrameHeader::LittleEndian16, ant::FrameHeader::BigEndian32,
+                        ant::FrameHeader::LittleEndian32, ant::FrameHeader::Varint}) {
+        ant::FrameCodec codec(header, 1000);
+
+        // batched, one by one and sealed frames produce the same bytes
+        Buffer batched, single;
+        assert(codec.Encode(batched, views.data(), views.size()));
+        for (auto& m : msgs) {
+            Buffer sealed(16, codec.MaxHeaderSize());
+            sealed.AppendString(m);
+            assert(codec.Seal(sealed));
+            assert(sealed.Size() == codec.HeaderSize(m.size()) + m.size());
+            single.AppendString(sealed.Data(), sealed.Size());
+        }
+        assert(batched.Size() == single.Size() && memcmp(batched.Data(), single.Data(), batched.Size()) == 0);
+        Buffer tmp;
+        for (auto& m : msgs) {
+            assert(codec.Encode(tmp, m.data(), m.size()));
+        }
+        assert(tmp.Size() == batched.Size() && memcmp(tmp.Data(), batched.Data(), tmp.Size()) == 0);
+
+        // all frames at once
+        vector<string_view> frames;
+        size_t consumed;
+        assert(codec.Decode(batched.Data(), batched.Size(), frames, consumed));
+        assert(consumed == batched.Size() && frames == views);
+
+        // the stream split at arbitrary points
+        auto data = static_cast<const char*>(batched.Data());
+        for (size_t step : {1, 2, 5, 64, 333}) {
+            string input;
+            vector<string> decoded;
+            for (size_t pos = 0; pos < batched.Size(); pos += step) {
+                input.append(data + pos, min<size_t>(step, batched.Size() - pos));
+                assert(codec.Decode(
+                    input.data(), input.size(), [&decoded](string_view body) { decoded.emplace_back(body); }, consumed));
+                input.erase(0, consumed);
+            }
+            assert(input.empty() && decoded == msgs);
+        }
+
+        // oversized frames are rejected on both ends
+        string big(1001, 'x');
+        string_view bigView(big);
+        assert(!codec.Encode(tmp, big.data(), big.size()) && !codec.Encode(tmp, &bigView, 1));
+        Buffer bad;
+        codec.Encode(bad, msgs[3].data(), msgs[3].size());
+        auto goodSize = bad.Size();
+        assert(ant::FrameCodec(header).Encode(bad, big.data(), big.size()));
+        frames.clear();
+        assert(!codec.Decode(bad.Data(), bad.Size(), frames, consumed));
+        assert(frames.size() == 1 && frames[0] == msgs[3] && consumed == goodSize);
+    }
+
+    // a varint header longer than the max header is malformed, a shorter truncated one is incomplete
+    ant::FrameCodec codec(ant::FrameHeader::Varint, 1000);
+    vector<string_view> frames;
+    size_t consumed;
+    assert(codec.Decode("\x80", 1, frames, consumed) && consumed == 0);
+    assert(!codec.Decode("\x80\x80", 2, frames, consumed) && consumed == 0);
+    assert(ant::FrameCodec(ant::FrameHeader::BigEndian16, 100000).MaxFrameSize() == 0xFFFF);
+
+    // frames which don't fit in the 4GB limit of a BinaryBuffer are rejected rather than truncated. The bodies are
+    // rejected before being read, so they needn't be backed by real memory
+    ant::FrameCodec permissive(ant::FrameHeader::BigEndian32);
+    Buffer out;
+    out.AppendInteger(uint8_t(1));
+    const char dummy = 0;
+    string_view huge[] = {string_view(&dummy, 0x80000000), string_view(&dummy, 0x80000000)};
+    assert(!permissive.Encode(out, huge, 2) && out.Size() == 1);
+    assert(!permissive.Encode(out, &dummy, 0xFFFFFFFF) && out.Size() == 1);
+}
+
+int main()
+{
+    testVarint();
+    testVarints();
+    testArrays();
+    testGrowth();
+    testViews();
+    testSerializer();
+    testStreamReader();
+    testChainBuffer();
+    testFrameCodec();
+    printf("ok\n");
+}
@@ -0,0 +1,116 @@
+#include <cassert>
+#include <cstdio>
+#include <string>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <libant/system/connection.h>
+
+using namespace std;
+
+static void testEcho()
+{
+    ant::EventPoll poll;
+    auto pool = ant::Connection::StringBufferPool::CreateBufferPool(16 * 1024 * 1024);
+
+    int sv[2];
+    int r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv);
+    assert(r == 0);
+    (void)r;
+
+    ant::Connection server(poll, sv[0], pool);
+    ant::Connection client(poll, sv[1], pool);
+
+    const size_t total = 8 * 1024 * 1024;
+    string payload(total, 'x');
+    for (size_t i = 0; i != total; ++i) {
+        payload[i] = static_cast<char>(i * 131);
+    }
+
+    // the server greets with the payload, then echoes whatever it receives
+    int highCnt = 0;
+    int lowCnt = 0;
+    int closeErr = -1;
+    server.SetWatermarks(
+        16 * 1024, 0, [&](ant::Connection&) { ++highCnt; }, [&](ant::Connection&) { ++lowCnt; });
+    server.SetMessageCallback([](ant::Connection& conn, string& input) {
+        conn.Send(input.data(), input.size());
+        input.clear();
+    });
+    server.SetCloseCallback([&](ant::Connection&, int err) { closeErr = err; });
+
+    string echoed;
+    client.SetReadBudget(4096);
+    client.SetMessageCallback([&](ant::Connection& conn, string& input) {
+        echoed.append(input);
+        input.clear();
+        if (echoed.size() == total * 2) {
+            conn.Close();
+        }
+    });
+
+    server.Start();
+    client.Start();
+    server.Send(payload.data(), payload.size());
+    auto buf = pool->GetBuffer();
+    buf->assign(payload);
+    client.Send(std::move(buf));
+    poll.Dispatch();
+
+    assert(echoed == payload + payload);
+    assert(closeErr == 0);
+    assert(server.Closed());
+    assert(highCnt > 0 && highCnt == lowCnt);
+}
+
+// output queued and errors occurred before Start() are handled once the connection is started
+static void testSendBeforeStart()
+{
+    ant::EventPoll poll;
+    auto pool = ant::Connection::StringBufferPool::CreateBufferPool(16 * 1024 * 1024);
+
+    int sv[2];
+    int r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv);
+    assert(r == 0);
+    ant::Connection sender(poll, sv[0], pool);
+    ant::Connection receiver(poll, sv[1], pool);
+    string payload(4 * 1024 * 1024, 'y');
+    assert(sender.Send(payload.data(), payload.size()));
+    assert(sender.PendingOutputBytes() > 0);
+
+    string received;
+    receiver.SetMessageCallback([&](ant::Connection& conn, string& input) {
+        received.append(input);
+        input.clear();
+        if (received.size() == payload.size()) {
+            conn.Close();
+            sender.Close();
+        }
+    });
+
+    int brokenSv[2];
+    r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, brokenSv);
+    assert(r == 0);
+    close(brokenSv[1]);
+    ant::Connection broken(poll, brokenSv[0], pool);
+    int closeErr = -1;
+    broken.SetCloseCallback([&](ant::Connection&, int err) { closeErr = err; });
+    assert(!broken.Send("hello", 5));
+
+    sender.Start();
+    receiver.Start();
+    broken.Start();
+    poll.Dispatch();
+
+    assert(received == payload);
+    assert(closeErr == EPIPE && broken.Closed());
+    (void)r;
+}
+
+int main()
+{
+    testEcho();
+    testSendBeforeStart();
+    printf("ok\n");
+}
@@ -0,0 +1,187 @@
+#include <cassert>
+#include <cstdio>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <libant/system/epoll.h>
+
+using namespace std;
+
+class Session {
+public:
+    Session(ant::EventPoll& poll, int fd, int peer)
+        : poll_(poll)
+        , fd_(fd)
+        , peer_(peer)
+    {
+    }
+
+    void OnReadable(int fd)
+    {
+        char buf[64];
+        while (read(fd, buf, sizeof(buf)) > 0) {
+            ++reads_;
+        }
+        // toggling EventOut on and off within one iteration must end up with EventIn only
+        poll_.Modify(fd, ant::EventPoll::EventIO);
+        poll_.Modify(fd, ant::EventPoll::EventIn);
+    }
+
+    void OnWritable(int)
+    {
+        ++writes_;
+    }
+
+    void Ping()
+    {
+        std::ignore = write(peer_, "ping", 4);
+    }
+
+public:
+    ant::EventPoll& poll_;
+    int fd_;
+    int peer_;
+    int reads_{0};
+    int writes_{0};
+};
+
+// reports and skips the tests of a backend unavailable on the running kernel, rather than testing the fallback twice
+static bool available(const ant::EventPoll& poll, ant::EventPoll::Backend backend)
+{
+    if (poll.GetBackend() != backend) {
+        printf("backend %d unavailable, skipped\n", backend);
+        return false;
+    }
+    return true;
+}
+
+static void testBackend(ant::EventPoll::Backend backend)
+{
+    // fd larger than maxfd should be accepted, the handler table grows on demand
+    ant::EventPoll poll(1, -1, backend);
+    if (!available(poll, backend)) {
+        return;
+    }
+
+    int sv[2];
+    int r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv);
+    assert(r == 0);
+    int fd = dup2(sv[0], 3000);
+    assert(fd == 3000);
+    close(sv[0]);
+
+    Session session(poll, fd, sv[1]);
+    poll.Add(fd, ant::EventPoll::EventIn, session, &Session::OnReadable, &Session::OnWritable);
+
+    // every callback is slow with a zero threshold
+    poll.EnableStats(0);
+
+    int fired = 0;
+    time_t start = poll.NowMS();
+    poll.Timers().AddTimer(start + 20, [&](time_t) {
+        ++fired;
+        session.Ping();
+    });
+    poll.Timers().AddTimer(start + 60, [&](time_t now) {
+        ++fired;
+        assert(now >= start + 60);
+        poll.Remove(fd);
+    });
+    poll.Dispatch();
+
+    assert(fired == 2);
+    assert(session.reads_ == 1);
+    assert(session.writes_ == 0);
+
+    auto stats = poll.GetStats();
+    assert(stats.iterations >= 2 && stats.totalEvents >= 1);
+    assert(stats.slowCallbacks >= 3 && !stats.recentSlowCallbacks.empty());
+    assert(stats.recentSlowCallbacks.front().fd == fd || stats.recentSlowCallbacks.front().fd == -1);
+    close(fd);
+    close(sv[1]);
+    (void)r;
+}
+
+class Trickle {
+public:
+    // reads a byte at a time, a level-triggered fd must be reported again until it's drained
+    void OnReadable(int fd)
+    {
+        char c;
+        if (read(fd, &c, 1) == 1) {
+            ++reads_;
+        }
+    }
+
+    void OnWritable(int)
+    {
+    }
+
+public:
+    int reads_{0};
+};
+
+static void testLevelTriggered(ant::EventPoll::Backend backend)
+{
+    ant::EventPoll poll(1, -1, backend);
+    if (!available(poll, backend)) {
+        return;
+    }
+
+    int sv[2];
+    int r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv);
+    assert(r == 0);
+    Trickle trickle;
+    poll.Add(sv[0], ant::EventPoll::EventIn, trickle, &Trickle::OnReadable, &Trickle::OnWritable, false);
+    r = write(sv[1], "four", 4);
+    assert(r == 4);
+
+    time_t start = poll.NowMS();
+    poll.Timers().AddTimer(start + 30, [&](time_t) {
+        assert(trickle.reads_ == 4);
+        // arrives after the fd has been drained, so it must be reported afresh
+        r = write(sv[1], "!", 1);
+        assert(r == 1);
+    });
+    poll.Timers().AddTimer(start + 60, [&](time_t) {
+        poll.Remove(sv[0]);
+    });
+    poll.Dispatch();
+    assert(trickle.reads_ == 5);
+    close(sv[0]);
+    close(sv[1]);
+    (void)r;
+}
+
+// Dispatch() must keep running while timers are pending, even without any fd
+static void testTimersOnly(ant::EventPoll::Backend backend)
+{
+    ant::EventPoll poll(1, -1, backend);
+    if (!available(poll, backend)) {
+        return;
+    }
+
+    int fired = 0;
+    time_t start = poll.NowMS();
+    poll.Timers().AddTimer(start + 10, [&](time_t now) {
+        ++fired;
+        poll.Timers().AddTimer(now + 10, [&](time_t) {
+            ++fired;
+        });
+    });
+    poll.Dispatch();
+    assert(fired == 2);
+    assert(poll.NowMS() >= start + 20);
+}
+
+int main()
+{
+    testBackend(ant::EventPoll::BackendEpoll);
+    testBackend(ant::EventPoll::BackendIoUring);
+    testLevelTriggered(ant::EventPoll::BackendEpoll);
+    testLevelTriggered(ant::EventPoll::BackendIoUring);
+    testTimersOnly(ant::EventPoll::BackendEpoll);
+    testTimersOnly(ant::EventPoll::BackendIoUring);
+    printf("ok\n");
+}
@@ -0,0 +1,434 @@
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <libant/logger/logger.h>
+#ifdef LIBANT_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+using namespace std;
+
+// lines of all the logfiles of `level` in `dir` containing `needle`
+static vector<string> grepLines(const string& dir, const string& level, const string& needle = "")
+{
+    vector<string> lines;
+    for (auto& entry : filesystem::directory_iterator(dir)) {
+        auto name = entry.path().filename().string();
+        if (entry.is_symlink() || name.find("." + level + ".") == string::npos || entry.path().extension() == ".bin"
+            || entry.path().extension() == ".gz") {
+            continue;
+        }
+        ifstream in(entry.path());
+        for (string line; getline(in, line);) {
+            if (line.find(needle) != string::npos) {
+                lines.push_back(line);
+            }
+        }
+    }
+    return lines;
+}
+
+// count lines of all the logfiles of `level` in `dir`
+static size_t countLines(const string& dir, const string& level, const string& needle = "")
+{
+    return grepLines(dir, level, needle).size();
+}
+
+static string makeTempDir()
+{
+    char tmpl[] = "/tmp/test_logger.XXXXXX";
+    auto dir = mkdtemp(tmpl);
+    assert(dir);
+    return dir;
+}
+
+// read the first line of the logfiles of `level` in `dir`
+static string firstLine(const string& dir, const string& level)
+{
+    for (auto& entry : filesystem::directory_iterator(dir)) {
+        auto name = entry.path().filename().string();
+        if (!entry.is_symlink() && name.find("." + level + ".") != string::npos) {
+            ifstream in(entry.path());
+            string line;
+            getline(in, line);
+            return line;
+        }
+    }
+    return "";
+}
+
+static void testPrefix()
+{
+    auto dir = makeTempDir();
+    {
+        ant::Logger::Cfg cfg(dir, "prefix", 1, true, ant::Logger::LogLevelInfo, ant::Logger::LogDestFile,
+                             ant::Logger::ControlFlagLogDate | ant::Logger::ControlFlagLogMicroseconds | ant::Logger::ControlFlagCoarseClock);
+        ant::Logger logger(cfg);
+        logger.Log(ant::Logger::LogLevelInfo, "hello {}", 1);
+        logger.Log(ant::Logger::LogLevelWarn, "hello {}", 2);
+    }
+    assert(regex_match(firstLine(dir, "INFO"), regex(R"(I\d{8} \d{2}:\d{2}:\d{2}\.\d{6} hello 1)")));
+    assert(regex_match(firstLine(dir, "WARN"), regex(R"(W\d{8} \d{2}:\d{2}:\d{2}\.\d{6} hello 2)")));
+    filesystem::remove_all(dir);
+
+    dir = makeTempDir();
+    {
+        ant::Logger::Cfg cfg(dir, "prefix", 1, true, ant::Logger::LogLevelInfo, ant::Logger::LogDestFile, ant::Logger::ControlFlagNone);
+        ant::Logger logger(cfg);
+        logger.Log(ant::Logger::LogLevelInfo, "hello");
+    }
+    assert(regex_match(firstLine(dir, "INFO"), regex(R"(I\d{2}:\d{2}:\d{2} hello)")));
+    filesystem::remove_all(dir);
+}
+
+static void testSingleFile()
+{
+    for (bool async : {false, true}) {
+        auto dir = makeTempDir();
+        {
+            ant::Logger::Cfg cfg(dir, "single", 1, true, ant::Logger::LogLevelTrace, ant::Logger::LogDestFile,
+                                 ant::Logger::ControlFlagLogThrough | ant::Logger::ControlFlagSingleFile);
+            if (async) {
+                cfg.SetAsync();
+            }
+            ant::Logger logger(cfg);
+            for (int i = 0; i != 100; ++i) {
+                logger.Log(ant::Logger::LogLevelInfo, "info {}", i);
+                logger.Log(ant::Logger::LogLevelError, "error {}", i);
+            }
+        }
+        size_t files = 0;
+        for (auto& entry : filesystem::directory_iterator(dir)) {
+            if (!entry.is_symlink()) {
+                assert(entry.path().filename().string().find(".ALL.") != string::npos);
+                ++files;
+            }
+        }
+        assert(files == 1);
+        // written once no matter ControlFlagLogThrough
+        assert(countLines(dir, "ALL", "info ") == 100);
+        assert(countLines(dir, "ALL", "error ") == 100);
+        assert(firstLine(dir, "ALL")[0] == 'I');
+        filesystem::remove_all(dir);
+    }
+}
+
+static void testMmap()
+{
+    for (bool async : {false, true}) {
+        auto dir = makeTempDir();
+        {
+            ant::Logger::Cfg cfg(dir, "mmap", 1, true, ant::Logger::LogLevelInfo);
+            cfg.SetMmap(1);
+            if (async) {
+                cfg.SetAsync();
+            }
+            ant::Logger logger(cfg);
+            for (int i = 0; i != 30000; ++i) {
+                logger.Log(ant::Logger::LogLevelWarn, "seq={} {}", i, string(100, 'm'));
+            }
+        }
+
+        size_t files = 0;
+        for (auto& entry : filesystem::directory_iterator(dir)) {
+            auto name = entry.path().filename().string();
+            // the logfiles prepared but not used are removed
+            assert(name.find(".next") == string::npos);
+            if (entry.is_symlink()) {
+                assert(filesystem::exists(entry.path()));
+                continue;
+            }
+            // truncated to the logs written
+            ifstream in(entry.path(), ios::binary);
+            string content((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+            assert(!content.empty() && content.back() == '\n' && content.find('\0') == string::npos);
+            ++files;
+        }
+        assert(files > 4); // rotated
+        assert(countLines(dir, "WARN", "seq=") == 30000);
+        assert(countLines(dir, "INFO", "seq=") == 30000);
+        filesystem::remove_all(dir);
+    }
+}
+
+#ifdef LIBANT_WITH_ZLIB
+// count lines of all the compressed logfiles of `level` in `dir`
+static size_t countCompressedLines(const string& dir, const string& level, const string& needle)
+{
+    size_t n = 0;
+    for (auto& entry : filesystem::directory_iterator(dir)) {
+        auto name = entry.path().filename().string();
+        if (name.find("." + level + ".") == string::npos || entry.path().extension() != ".gz") {
+            continue;
+        }
+        auto in = gzopen(entry.path().c_str(), "rb");
+        assert(in);
+        char line[1024];
+        while (gzgets(in, line, sizeof(line))) {
+            if (strstr(line, needle.c_str())) {
+                ++n;
+            }
+        }
+        gzclose(in);
+    }
+    return n;
+}
+
+static void testCompression()
+{
+    for (bool mmap : {false, true}) {
+        auto dir = makeTempDir();
+        {
+            ant::Logger::Cfg cfg(dir, "gz", 1, true, ant::Logger::LogLevelWarn, ant::Logger::LogDestFile, ant::Logger::ControlFlagNone);
+            cfg.SetCompression(1, 0);
+            if (mmap) {
+                cfg.SetMmap(1);
+            }
+            ant::Logger logger(cfg);
+            for (int i = 0; i != 30000; ++i) {
+                logger.Log(ant::Logger::LogLevelWarn, "seq={} {}", i, string(100, 'z'));
+            }
+
+            // wait until all the rotated logfiles are compressed
+            for (int i = 0; i != 1000; ++i) {
+                size_t plain = 0;
+                for (auto& entry : filesystem::directory_iterator(dir)) {
+                    plain += (!entry.is_symlink() && entry.path().extension() == ".log");
+                }
+                if (plain == 1) {
+                    break;
+                }
+                this_thread::sleep_for(chrono::milliseconds(10));
+            }
+        }
+
+        auto compressed = countCompressedLines(dir, "WARN", "seq=");
+        assert(compressed > 0);
+        assert(compressed + countLines(dir, "WARN", "seq=") == 30000);
+        filesystem::remove_all(dir);
+    }
+}
+#endif
+
+static void testLimited()
+{
+    auto dir = makeTempDir();
+    ant::InitGlobalLogger(ant::Logger::Cfg(dir, "limited", 1, true, ant::Logger::LogLevelInfo, ant::Logger::LogDestFile, ant::Logger::ControlFlagNone));
+    for (int i = 0; i != 10000; ++i) {
+        LOG_WARN_EVERY_N(100, "every {}", i);
+        LOG_WARN_RATE_LIMITED(10, "limited {}", i);
+        LOG_TRACE_EVERY_N(1, "disabled {}", i);
+    }
+    this_thread::sleep_for(chrono::milliseconds(1100));
+    LOG_WARN_RATE_LIMITED(10, "limited {}", -1); // not the same call site
+    for (int i = 0; i != 2; ++i) {
+        LOG_WARN_RATE_LIMITED(1, "once {}", i);
+        this_thread::sleep_for(chrono::milliseconds(i ? 0 : 1100));
+    }
+    ant::detail::gLogger.reset();
+
+    assert(countLines(dir, "WARN", "] every ") == 100);
+    assert(countLines(dir, "WARN", "[99 similar logs suppressed]") == 99);
+    auto limited = countLines(dir, "WARN", "] limited ");
+    assert(limited >= 10 && limited <= 20 + 1);
+    assert(countLines(dir, "WARN", "] once ") == 2);
+    assert(countLines(dir, "WARN", "] once 1") == 1);
+    assert(countLines(dir, "TRACE", "disabled") == 0);
+    assert(!ant::Logger(ant::Logger::Cfg(dir, "limited", 1)).IsEnabled(ant::Logger::LogLevelTrace));
+    filesystem::remove_all(dir);
+}
+
+static void testKV()
+{
+    auto dir = makeTempDir();
+    {
+        ant::Logger::Cfg cfg(dir, "json", 1, true, ant::Logger::LogLevelInfo, ant::Logger::LogDestFile, ant::Logger::ControlFlagNone);
+        ant::Logger logger(cfg);
+        logger.LogKV(ant::Logger::LogLevelInfo, "login \"a\"\n", "uid", 12321, "ok", true, "ratio", 0.5, "none", nullptr, "path", "C:\\x\ty");
+    }
+    assert(regex_match(firstLine(dir, "INFO"),
+                       regex(R"(\{"time":"\d{4}-\d{2}-\d{2}T\d{2}:\d{2}:\d{2}\.\d{6}","level":"INFO","msg":"login \\"a\\"\\n",)"
+                             R"("uid":12321,"ok":true,"ratio":0.5,"none":null,"path":"C:\\\\x\\ty"\})")));
+    filesystem::remove_all(dir);
+
+    dir = makeTempDir();
+    {
+        ant::Logger::Cfg cfg(dir, "logfmt", 1, true, ant::Logger::LogLevelInfo, ant::Logger::LogDestFile, ant::Logger::ControlFlagNoPrepends);
+        cfg.SetKVFormat(ant::Logger::KVFormatLogfmt);
+        ant::InitGlobalLogger(cfg);
+        LOG_INFO_KV("login", "uid", 12321, "name", "a b", "empty", "", "eq", "a=b", "plain", "abcdefghijklmnop");
+        ant::detail::gLogger.reset();
+    }
+    assert(regex_match(firstLine(dir, "INFO"),
+                       regex(R"(msg=login src=test_logger\.cpp:\d+ uid=12321 name="a b" empty="" eq="a=b" plain=abcdefghijklmnop)")));
+    filesystem::remove_all(dir);
+}
+
+static void testAsync()
+{
+    auto dir = makeTempDir();
+    ant::Logger::Cfg cfg(dir, "async", 1, true, ant::Logger::LogLevelTrace);
+    cfg.SetAsync(ant::Logger::OverflowBlock, 16);
+    ant::Logger logger(cfg);
+
+    const int kThreads = 4;
+    const int kLogs = 20000;
+    vector<thread> threads;
+    for (int t = 0; t != kThreads; ++t) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i != kLogs; ++i) {
+                logger.Log(ant::Logger::LogLevelInfo, "thread={} seq={}", t, i);
+            }
+        });
+    }
+    for (auto& thr : threads) {
+        thr.join();
+    }
+    // larger than the ring buffer
+    logger.Log(ant::Logger::LogLevelWarn, "{}", string(64 * 1024, 'x'));
+    logger.Flush();
+
+    assert(countLines(dir, "INFO", "seq=") == kThreads * kLogs);
+    // written through to the lower levels
+    assert(countLines(dir, "TRACE", "seq=") == kThreads * kLogs);
+    assert(countLines(dir, "INFO", "xxxx") == 1);
+    assert(logger.DroppedCount() == 0);
+    filesystem::remove_all(dir);
+}
+
+static void testDrop()
+{
+    auto dir = makeTempDir();
+    {
+        ant::Logger::Cfg cfg(dir, "drop", 0, true, ant::Logger::LogLevelInfo, ant::Logger::LogDestFile,
+                             ant::Logger::ControlFlagLogDate | ant::Logger::ControlFlagLogMicroseconds);
+        cfg.SetAsync(ant::Logger::OverflowDropWithCounter, 4, 1000);
+        ant::Logger logger(cfg);
+        // the background thread might keep up for a while
+        int n = 0;
+        for (; n != 10000 || (logger.DroppedCount() == 0 && n != 10000000); ++n) {
+            logger.Log(ant::Logger::LogLevelError, "seq={} {}", n, string(100, 'y'));
+        }
+        logger.Flush();
+        auto dropped = logger.DroppedCount();
+        assert(dropped > 0);
+        assert(countLines(dir, "ERROR", "seq=") + dropped == static_cast<size_t>(n));
+        // notices are prefixed the same way as the other logs
+        auto notices = grepLines(dir, "ERROR", "logs dropped");
+        assert(!notices.empty());
+        for (auto& notice : notices) {
+            assert(regex_match(notice, regex(R"(E\d{8} \d{2}:\d{2}:\d{2}\.\d{6} \d+ logs dropped because the buffer is full)")));
+        }
+    }
+    filesystem::remove_all(dir);
+}
+
+enum Color { Red, Green };
+
+static void testDeferred()
+{
+    auto dir = makeTempDir();
+    {
+        ant::Logger::Cfg cfg(dir, "deferred", 1, true, ant::Logger::LogLevelInfo, ant::Logger::LogDestFile, ant::Logger::ControlFlagNone);
+        cfg.SetAsync(ant::Logger::OverflowBlock, 16);
+        cfg.SetFormatMode(ant::Logger::FormatDeferred);
+        ant::Logger logger(cfg);
+        string name = "ant";
+        for (int i = 0; i != 1000; ++i) {
+            logger.Log(ant::Logger::LogLevelInfo, FMT_STRING("seq={} name={} ratio={:.2f} ok={} c={} s={}"), i, name, 0.5, true, 'x', "abc");
+        }
+        // not captured, formatted eagerly
+        logger.Log(ant::Logger::LogLevelInfo, FMT_STRING("color={}"), Green);
+        // formatted as a float rather than widened to a double
+        logger.Log(ant::Logger::LogLevelInfo, FMT_STRING("float={} double={}"), 0.1f, 0.1);
+        logger.Flush();
+    }
+    assert(countLines(dir, "INFO", "] seq=") == 0);
+    assert(countLines(dir, "INFO", "seq=999 name=ant ratio=0.50 ok=true c=x s=abc") == 1);
+    assert(countLines(dir, "INFO", "color=1") == 1);
+    assert(countLines(dir, "INFO", "float=0.1 double=0.1") == 1);
+    filesystem::remove_all(dir);
+}
+
+static void testBinary()
+{
+    auto dir = makeTempDir();
+    {
+        // small logfiles to check every file is decodable on its own
+        ant::Logger::Cfg cfg(dir, "binary", 0, true, ant::Logger::LogLevelInfo, ant::Logger::LogDestFile, ant::Logger::ControlFlagNone);
+        cfg.SetAsync(ant::Logger::OverflowBlock, 16);
+        cfg.SetFormatMode(ant::Logger::FormatBinary);
+        ant::Logger logger(cfg);
+        for (int i = 0; i != 1000; ++i) {
+            logger.Log(ant::Logger::LogLevelWarn, FMT_STRING("seq={} neg={} name={}"), i, -i, string("ant"));
+        }
+        logger.Log(ant::Logger::LogLevelWarn, FMT_STRING("color={}"), Green);
+        logger.Log(ant::Logger::LogLevelWarn, FMT_STRING("float={} double={}"), 0.1f, 0.1);
+        logger.Flush();
+    }
+
+    size_t n = 0;
+    for (auto& entry : filesystem::directory_iterator(dir)) {
+        auto path = entry.path().string();
+        if (entry.is_symlink() || path.find(".WARN.") == string::npos || entry.path().extension() != ".bin") {
+            continue;
+        }
+        auto textPath = path + ".log";
+        assert(ant::Logger::DecodeBinaryLog(path, textPath));
+        ++n;
+    }
+    assert(n > 0);
+    assert(countLines(dir, "WARN", "seq=") == 1000);
+    assert(countLines(dir, "WARN", "seq=999 neg=-999 name=ant") == 1);
+    assert(countLines(dir, "WARN", "color=1") == 1);
+    assert(countLines(dir, "WARN", "float=0.1 double=0.1") == 1);
+    assert(!ant::Logger::DecodeBinaryLog(dir + "/nonexistent.bin", dir + "/nonexistent.log"));
+    filesystem::remove_all(dir);
+
+    // a format is defined once per logfile, not once per batch
+    dir = makeTempDir();
+    {
+        ant::Logger::Cfg cfg(dir, "binary", 0, true, ant::Logger::LogLevelInfo, ant::Logger::LogDestFile, ant::Logger::ControlFlagNone);
+        cfg.SetAsync(ant::Logger::OverflowBlock, 16);
+        cfg.SetFormatMode(ant::Logger::FormatBinary);
+        ant::Logger logger(cfg);
+        for (int i = 0; i != 10; ++i) {
+            logger.Log(ant::Logger::LogLevelWarn, FMT_STRING("rare={}"), i);
+            logger.Flush();
+        }
+    }
+    for (auto& entry : filesystem::directory_iterator(dir)) {
+        if (!entry.is_symlink() && entry.path().extension() == ".bin" && entry.path().string().find(".WARN.") != string::npos) {
+            ifstream in(entry.path(), ios::binary);
+            string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+            assert(data.find("rare={}") != string::npos && data.find("rare={}") == data.rfind("rare={}"));
+            assert(ant::Logger::DecodeBinaryLog(entry.path().string(), entry.path().string() + ".log"));
+        }
+    }
+    assert(countLines(dir, "WARN", "rare=") == 10 && countLines(dir, "WARN", "rare=9") == 1);
+    filesystem::remove_all(dir);
+}
+
+int main()
+{
+    testPrefix();
+    testSingleFile();
+    testMmap();
+#ifdef LIBANT_WITH_ZLIB
+    testCompression();
+#endif
+    testLimited();
+    testKV();
+    testAsync();
+    testDrop();
+    testDeferred();
+    testBinary();
+    printf("ok\n");
+}
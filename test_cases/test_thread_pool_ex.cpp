@@ -0,0 +1,39 @@
+#include <cassert>
+#include <cstdio>
+#include <memory>
+
+#include <libant/thread/thread_pool_ex.h>
+
+using namespace std;
+
+class Output : public ant::ThreadPoolEx::AbsOutput {
+public:
+    explicit Output(int v)
+        : val(v)
+    {
+    }
+
+    int val;
+};
+
+int main()
+{
+    // a single worker runs the tasks in order
+    ant::ThreadPoolEx pool(1, 1);
+    for (int i = 0; i != 100; ++i) {
+        pool.Run([i]() -> shared_ptr<ant::ThreadPoolEx::AbsOutput> {
+            if (i % 2) {
+                return make_shared<Output>(i);
+            }
+            return nullptr;
+        });
+    }
+
+    // tasks returning nullptr have no output, GetJobOutput() gets the outputs of the others only
+    for (int i = 1; i < 100; i += 2) {
+        auto output = pool.GetJobOutput(-1);
+        assert(output && static_cast<Output*>(output.get())->val == i);
+    }
+    assert(!pool.GetJobOutput(50));
+    printf("ok\n");
+}
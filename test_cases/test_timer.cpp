@@ -0,0 +1,143 @@
+#include <cassert>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include <libant/timer/timer.h>
+
+using namespace std;
+
+static void testRandom(uint32_t tickMS)
+{
+    ant::TimerManager mgr(tickMS);
+    mt19937_64 rng(tickMS);
+    const time_t start = 1000000;
+    time_t now = start;
+
+    // expiring times spread over every level of the wheel, including some beyond its range
+    vector<time_t> expiringTimes;
+    for (int i = 0; i != 20000; ++i) {
+        time_t delta = rng() % (time_t(1) << (rng() % 36));
+        expiringTimes.push_back(now - 100 + delta);
+    }
+    vector<time_t> firedAt(expiringTimes.size(), -1);
+    for (size_t i = 0; i != expiringTimes.size(); ++i) {
+        mgr.AddTimer(expiringTimes[i], [&, i](time_t cur) { firedAt[i] = cur; });
+    }
+    assert(mgr.Size() == expiringTimes.size());
+
+    // jump to the next expiring time, with some random extra steps in between which never go past it. Timers are
+    // added as the wheel turns too, so that timers placed into level 0 meet older ones cascading from upper levels
+    int added = 0;
+    while (mgr.Size()) {
+        if (added != 5000 && rng() % 4 == 0) {
+            ++added;
+            const size_t i = expiringTimes.size();
+            expiringTimes.push_back(now + 1 + rng() % (time_t(1) << (rng() % 20)));
+            firedAt.push_back(-1);
+            mgr.AddTimer(expiringTimes[i], [&, i](time_t cur) { firedAt[i] = cur; });
+        }
+        time_t next;
+        bool ok = mgr.NextExpiringTime(next);
+        assert(ok);
+        (void)ok;
+        if (rng() % 4 == 0 && now + 1 < next) {
+            now += 1 + rng() % std::min<time_t>(next - now - 1, 1000);
+        } else {
+            now = std::max(now, next);
+        }
+        mgr.Update(now);
+    }
+
+    // each timer fires within a tick after its expiring time, or at the first Update() if it has expired already
+    for (size_t i = 0; i != expiringTimes.size(); ++i) {
+        assert(firedAt[i] >= expiringTimes[i]);
+        assert(firedAt[i] - std::max(expiringTimes[i], start) <= time_t(tickMS));
+    }
+}
+
+static void testNextExpiringTime()
+{
+    // a timer due to cascade from level 1 is earlier than the one in level 0
+    ant::TimerManager mgr;
+    vector<time_t> fired;
+    mgr.Update(0);
+    mgr.AddTimer(1100, [&](time_t cur) { fired.push_back(cur); });
+    mgr.Update(500);
+    mgr.AddTimer(1500, [&](time_t cur) { fired.push_back(cur); });
+    time_t next;
+    while (mgr.NextExpiringTime(next)) {
+        assert(next <= 1100 || !fired.empty());
+        mgr.Update(next);
+    }
+    assert(fired.size() == 2 && fired[0] == 1100 && fired[1] == 1500);
+}
+
+static void testNested()
+{
+    ant::TimerManager mgr;
+    vector<int> order;
+    mgr.AddTimer(10, [&](time_t) { order.push_back(2); });
+    mgr.AddTimer(5, [&](time_t) {
+        order.push_back(1);
+        // already expired, fires with the next tick
+        mgr.AddTimer(5, [&](time_t) { order.push_back(3); });
+    });
+    mgr.Update(0);
+    mgr.Update(5);
+    assert(order.size() == 1 && order[0] == 1);
+    mgr.Update(10);
+    assert(order.size() == 3 && order[1] == 3 && order[2] == 2);
+
+    mgr.AddTimer(100, [&](time_t) { order.push_back(4); });
+    mgr.Clear();
+    mgr.Update(1000);
+    assert(order.size() == 3 && mgr.Size() == 0);
+}
+
+static void testCancelReschedule()
+{
+    ant::TimerManager mgr;
+    vector<int> fired;
+    mgr.Update(0);
+    auto id1 = mgr.AddTimer(10, [&](time_t) { fired.push_back(1); });
+    auto id2 = mgr.AddTimer(20, [&](time_t) { fired.push_back(2); });
+    auto id3 = mgr.AddTimer(100000, [&](time_t) { fired.push_back(3); });
+    assert(id1 != ant::TimerManager::kInvalidTimerId && id1 != id2);
+    assert(!mgr.Cancel(ant::TimerManager::kInvalidTimerId));
+
+    // push an idle timeout back again and again, it must never fire before the last expiring time
+    for (time_t now = 1; now < 50000; now += 7) {
+        assert(mgr.Reschedule(id3, now + 1000));
+        mgr.Update(now);
+    }
+    assert(mgr.Cancel(id2) == false); // already fired
+    assert(fired.size() == 2 && fired[0] == 1 && fired[1] == 2);
+    assert(mgr.Size() == 1);
+
+    assert(mgr.Cancel(id3));
+    assert(!mgr.Cancel(id3));
+    assert(!mgr.Reschedule(id3, 60000));
+    assert(mgr.Size() == 0);
+
+    // a callback cancels a timer due in the same tick, and the stale id must not hit the reused node
+    ant::TimerManager::TimerId victim = 0;
+    mgr.AddTimer(60000, [&](time_t) { assert(mgr.Cancel(victim)); });
+    victim = mgr.AddTimer(60000, [&](time_t) { fired.push_back(4); });
+    mgr.Update(60000);
+    auto reused = mgr.AddTimer(60001, [&](time_t) { fired.push_back(5); });
+    assert(!mgr.Cancel(victim));
+    mgr.Update(60001);
+    assert(fired.size() == 3 && fired[2] == 5);
+    assert(!mgr.Cancel(reused));
+}
+
+int main()
+{
+    testRandom(1);
+    testRandom(7);
+    testNextExpiringTime();
+    testNested();
+    testCancelReschedule();
+    printf("ok\n");
+}
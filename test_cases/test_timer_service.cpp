@@ -0,0 +1,128 @@
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include <libant/timer/timer_service.h>
+
+using namespace std;
+
+static void testMultiThreads()
+{
+    ant::TimerService svc;
+    const int kThreads = 4;
+    const int kTimersPerThread = 5000;
+
+    atomic<int> fired{0};
+    atomic<int> early{0};
+    atomic<int> cancelledFired{0};
+    vector<vector<ant::TimerService::TimerId>> ids(kThreads);
+    vector<thread> threads;
+    for (int t = 0; t != kThreads; ++t) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i != kTimersPerThread; ++i) {
+                // cancellation is asynchronous, give the cancelled timers enough time not to fire before it
+                bool cancel = (i % 10 == 0);
+                time_t expiringTime = ant::TimerService::NowMS() + (cancel ? 300 : i % 50);
+                ids[t].push_back(svc.AddTimer(expiringTime, [&, expiringTime, cancel](time_t now) {
+                    if (now < expiringTime || ant::TimerService::NowMS() < expiringTime) {
+                        ++early;
+                    }
+                    if (cancel) {
+                        ++cancelledFired;
+                    }
+                    ++fired;
+                }));
+                if (cancel) {
+                    svc.Cancel(ids[t].back());
+                }
+            }
+        });
+    }
+    for (auto& thr : threads) {
+        thr.join();
+    }
+
+    // cancel a timer added by another thread, possibly before the timer thread sees it
+    atomic<bool> crossFired{false};
+    ant::TimerService::TimerId crossId = ant::TimerService::kInvalidTimerId;
+    const time_t crossDeadline = ant::TimerService::NowMS() + 300;
+    thread adder([&] { crossId = svc.AddTimer(crossDeadline, [&](time_t) { crossFired = true; }); });
+    adder.join();
+    svc.Cancel(crossId);
+
+    // push back an idle timeout from another thread
+    atomic<time_t> idleFiredAt{0};
+    auto idleStart = ant::TimerService::NowMS();
+    auto idleId = svc.AddTimer(idleStart + 20, [&](time_t now) { idleFiredAt = now; });
+    thread([&] { svc.Reschedule(idleId, idleStart + 150); }).join();
+
+    const int expected = kThreads * kTimersPerThread * 9 / 10;
+    while (fired < expected || idleFiredAt == 0 || ant::TimerService::NowMS() < crossDeadline + 50) {
+        this_thread::sleep_for(chrono::milliseconds(5));
+    }
+    assert(fired == expected);
+    assert(early == 0 && cancelledFired == 0);
+    assert(!crossFired);
+    assert(idleFiredAt >= idleStart + 150);
+}
+
+static void testThreadPool()
+{
+    ant::ThreadPoolEx pool(2, 2);
+    auto onPool = ant::TimerService::OnThreadPool(pool);
+    atomic<thread::id> timerThread;
+    atomic<int> fired{0};
+    atomic<bool> onTimerThread{false};
+    {
+        // the executor is called on the timer thread
+        ant::TimerService svc([&](ant::TimerService::Callback&& cb, time_t now) {
+            timerThread = this_thread::get_id();
+            onPool(move(cb), now);
+        });
+        for (int i = 0; i != 100; ++i) {
+            svc.AddTimer(ant::TimerService::NowMS() + i % 5, [&](time_t) {
+                if (this_thread::get_id() == timerThread.load()) {
+                    onTimerThread = true;
+                }
+                ++fired;
+            });
+        }
+        while (fired < 100) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+    }
+    pool.Stop();
+    assert(!onTimerThread);
+    // tasks posted by the executor leave nothing in the output queue
+    assert(!pool.GetJobOutput());
+}
+
+static void testStop()
+{
+    ant::TimerService svc;
+    atomic<int> fired{0};
+    auto id = svc.AddTimer(ant::TimerService::NowMS() + 10000, [&](time_t) { ++fired; });
+    assert(id != ant::TimerService::kInvalidTimerId);
+    // ids never returned by AddTimer() are ignored
+    svc.Cancel(id + 1000);
+    svc.Reschedule(id + 1000, 0);
+    svc.Stop();
+
+    // commands are ignored once stopped, rather than piling up in the queues
+    assert(svc.AddTimer(0, [&](time_t) { ++fired; }) == ant::TimerService::kInvalidTimerId);
+    for (int i = 0; i != 100000; ++i) {
+        svc.Cancel(id);
+        svc.Reschedule(id, 0);
+    }
+    assert(fired == 0);
+}
+
+int main()
+{
+    testMultiThreads();
+    testThreadPool();
+    testStop();
+    printf("ok\n");
+}